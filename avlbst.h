@@ -6,10 +6,37 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 #include "bst.h"
+#include "frozenbst.h"
+#include "countingbloom.h"
+#include "snapshot.h"
 
 struct KeyError { };
 
+/**
+* std::hash<Key> for key types that have one. Trees of other key types
+* still work, but cannot turn on the features that hash keys: the lookup
+* cache, the hash index and the membership filter.
+*/
+template <typename Key, bool = std::is_default_constructible<std::hash<Key> >::value>
+struct KeyHash
+{
+    static const bool available = true;
+    size_t operator()(const Key& key) const { return std::hash<Key>()(key); }
+};
+
+template <typename Key>
+struct KeyHash<Key, false>
+{
+    static const bool available = false;
+    size_t operator()(const Key&) const { return 0; }
+};
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
@@ -28,6 +55,10 @@ public:
     void setBalance(int8_t balance);
     void updateBalance(int8_t diff);
 
+    // Set while the node waits for relaxed rebalancing; see AVLTree::setRelaxed.
+    bool isQueued() const;
+    void setQueued(bool queued);
+
     // Getters for parent, left, and right. These need to be redefined since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
@@ -35,8 +66,11 @@ public:
     virtual AVLNode<Key, Value>* getLeft() const override;
     virtual AVLNode<Key, Value>* getRight() const override;
 
+    virtual AVLNode<Key, Value>* clone(Node<Key, Value>* parent) const override;
+
 protected:
     int8_t balance_;    // effectively a signed char
+    bool queued_;
 };
 
 /*
@@ -50,7 +84,7 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent), balance_(0), queued_(false)
 {
 
 }
@@ -91,6 +125,36 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
     balance_ += diff;
 }
 
+/**
+* Whether the node is in its tree's relaxed-rebalancing queue.
+*/
+template<class Key, class Value>
+bool AVLNode<Key, Value>::isQueued() const
+{
+    return queued_;
+}
+
+/**
+* A setter for the queued flag; only the tree that owns the queue sets it.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::setQueued(bool queued)
+{
+    queued_ = queued;
+}
+
+/**
+* Copies the item and the balance under parent. The copy is not queued.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLNode<Key, Value>::clone(Node<Key, Value>* parent) const
+{
+    AVLNode<Key, Value>* n = new AVLNode<Key, Value>(this->item_.first, this->item_.second,
+                                                     static_cast<AVLNode<Key, Value>*>(parent));
+    n->balance_ = balance_;
+    return n;
+}
+
 /**
 * An overridden function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
@@ -131,9 +195,83 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
+    AVLTree();
+    AVLTree(const AVLTree<Key, Value>& other);
+    AVLTree(AVLTree<Key, Value>&& other) noexcept;
+    AVLTree<Key, Value>& operator=(AVLTree<Key, Value> other);
+    void swap(AVLTree<Key, Value>& other);
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+    virtual void clear();
+
+    // Relaxed balancing. While relaxed, insert and remove only keep the
+    // balance factors exact and record the nodes that became skewed; the
+    // rotations are deferred to rebalance() or to later updates once more
+    // than maxPending nodes are waiting. Lookups are always correct.
+    void setRelaxed(bool relaxed, size_t maxPending = 64);
+    bool isRelaxed() const;
+    size_t rebalance(size_t budget = static_cast<size_t>(-1));
+    size_t pendingRebalance() const;
+
+    void split(const Key& key, AVLTree<Key, Value>& left, AVLTree<Key, Value>& right);
+    void join(AVLTree<Key, Value>& left, AVLTree<Key, Value>& right);
+
+    // Set operations. Each one consumes other (leaving it empty) and stores
+    // the result in this tree. The merge policy is called as
+    // merge(thisValue, otherValue) for keys present in both trees, possibly
+    // from several pool threads at once, and must not throw.
+    void unionWith(AVLTree<Key, Value>& other,
+                   WorkStealingPool& pool = WorkStealingPool::global());
+    template<typename Merge>
+    void unionWith(AVLTree<Key, Value>& other, Merge merge,
+                   WorkStealingPool& pool = WorkStealingPool::global());
+    void intersectWith(AVLTree<Key, Value>& other,
+                       WorkStealingPool& pool = WorkStealingPool::global());
+    template<typename Merge>
+    void intersectWith(AVLTree<Key, Value>& other, Merge merge,
+                       WorkStealingPool& pool = WorkStealingPool::global());
+    void differenceWith(AVLTree<Key, Value>& other,
+                        WorkStealingPool& pool = WorkStealingPool::global());
+
+    template<typename InputIt>
+    void build_parallel(InputIt first, InputIt last,
+                        WorkStealingPool& pool = WorkStealingPool::global());
+
+    FrozenTree<Key, Value> freeze() const;
+
+    // Binary snapshots for trivially copyable keys and values; see
+    // snapshot.h for the format and SnapshotView for serving lookups
+    // straight from a snapshot file.
+    void save(const std::string& path) const;
+    void load(const std::string& path, WorkStealingPool& pool = WorkStealingPool::global());
+
+    // Hot-key lookup cache, off by default. While it is on, find and
+    // operator[] first check a direct-mapped table of recently found nodes
+    // and only walk the tree on a miss. Lookups then write to the table, so
+    // const lookups must not run concurrently with each other.
+    void setLookupCache(size_t slots);
+    size_t lookupCacheSize() const;
+    size_t cacheHits() const;
+    size_t cacheMisses() const;
+    void resetCacheStats();
+
+    // Hash side-index, off by default. While it is on, an open-addressing
+    // table maps every key to its node: find, operator[], remove and
+    // updates of existing keys locate nodes in O(1) expected time, while
+    // ordered operations keep using the tree. It takes precedence over the
+    // lookup cache.
+    void setHashIndex(bool on);
+    bool hasHashIndex() const;
+    size_t hashIndexBytes() const;
+
+    // Membership filter, off by default. While it is on, a counting Bloom
+    // filter kept in sync with the tree answers most lookups of absent keys
+    // without touching the tree. See setMembershipFilter().
+    void setMembershipFilter(size_t expectedKeys, double falsePositiveRate = 0.01);
+    size_t filterRejects() const;
+    size_t filterBytes() const;
 protected:
+    virtual Node<Key, Value>* internalFind(const Key& key) const;
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
     // Add helper functions here
@@ -142,9 +280,251 @@ protected:
     void fixInsert(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
     void fixRemove(AVLNode<Key,Value>* n, char diff);
     virtual void deleteNode(AVLNode<Key, Value>* node);
+    virtual bool storedBalanceMatches(Node<Key, Value>* node, int actual) const;
+
+    // Join/split helpers. These work on detached subtrees and pass heights
+    // explicitly so that no step has to walk a whole subtree.
+    static int subtreeHeight(AVLNode<Key, Value>* n);
+    static int childHeight(AVLNode<Key, Value>* n, int h, bool left);
+    static AVLNode<Key, Value>* attach(AVLNode<Key, Value>* n, AVLNode<Key, Value>* l, int hl,
+                                       AVLNode<Key, Value>* r, int hr, int& h);
+    static AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* l, int hl, AVLNode<Key, Value>* k,
+                                          AVLNode<Key, Value>* r, int hr, int& h);
+    static AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* l, int hl,
+                                          AVLNode<Key, Value>* r, int hr, int& h);
+    static AVLNode<Key, Value>* splitFirst(AVLNode<Key, Value>* t, int ht,
+                                           AVLNode<Key, Value>*& rest, int& hrest);
+    static void splitNodes(AVLNode<Key, Value>* t, int ht, const Key& key,
+                           AVLNode<Key, Value>*& l, int& hl, AVLNode<Key, Value>*& m,
+                           AVLNode<Key, Value>*& r, int& hr);
+    AVLNode<Key, Value>* detachRoot();
+
+    // Relaxed balancing helpers.
+    void relaxedInsert(const std::pair<const Key, Value>& new_item);
+    void relaxedRemove(const Key& key);
+    void adjustUp(AVLNode<Key, Value>* p, bool fromLeft, int delta);
+    void repair(AVLNode<Key, Value>* n);
+    void drainPending();
+    static int nodeDepth(AVLNode<Key, Value>* n);
+    static const int maxSlack_ = 32;
+    static const size_t repairBudget_ = 2;
+    bool relaxed_;
+    bool overSlack_;
+    size_t maxPending_;
+    // nodes queued by adjustUp since the last rebalance(), and the skewed
+    // nodes carried over between calls as a max-heap on their depth; a node
+    // is in at most one of them, once, exactly while it is marked queued
+    std::vector<AVLNode<Key, Value>*> pending_;
+    std::vector<std::pair<int, AVLNode<Key, Value>*> > repairHeap_;
+
+    // Every node created, freed or moved in bulk goes through these, which
+    // keep the lookup cache, the hash index and the filter in step.
+    void nodeAdded(Node<Key, Value>* node);
+    void nodeRemoved(AVLNode<Key, Value>* node);
+    void nodesReplaced();
 
+    // Lookup cache helpers. A slot holds a node pointer or nullptr; every
+    // path that frees a node or hands it to another tree clears its slot.
+    size_t cacheSlot(const Key& key) const;
+    void forgetNode(AVLNode<Key, Value>* node);
+    void flushLookupCache();
+    mutable std::vector<Node<Key, Value>*> cache_;
+    int cacheShift_;
+    mutable size_t cacheHits_;
+    mutable size_t cacheMisses_;
+
+    // Hash index helpers. Slots are linear-probed and keep the mixed hash
+    // next to the node, so a probe only touches nodes whose hash matches.
+    // Bulk operations just mark the index stale; the next lookup rebuilds
+    // it from the tree in O(n).
+    struct IndexSlot
+    {
+        uint64_t hash;
+        Node<Key, Value>* node;
+    };
+    static uint64_t indexHash(const Key& key);
+    Node<Key, Value>* indexFind(const Key& key) const;
+    void indexNode(Node<Key, Value>* node) const;
+    void unindexNode(Node<Key, Value>* node);
+    void rebuildIndex() const;
+    void growIndex(size_t slots) const;
+    void markIndexStale();
+    bool indexed_;
+    mutable bool indexStale_;
+    mutable std::vector<IndexSlot> index_;
+    mutable size_t indexCount_;
+    mutable int indexShift_;
+
+    // Filter helpers. Like the index, the filter is rebuilt lazily after
+    // bulk operations, and also once the tree outgrows the size it was
+    // made for, so that its false positive rate stays near the target.
+    void rebuildFilter() const;
+    bool filtered_;
+    mutable bool filterStale_;
+    size_t filterExpected_;
+    double filterRate_;
+    mutable CountingBloomFilter<Key, KeyHash<Key> > filter_;
+    mutable size_t filterRejects_;
+
+    // Divide-and-conquer set operation helpers; subtrees taller than
+    // parallelHeight_ fork their two halves onto the pool.
+    static const int parallelHeight_ = 12;
+    template<typename Merge>
+    static AVLNode<Key, Value>* unionNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                           Merge& merge, WorkStealingPool& pool, int& h);
+    template<typename Merge>
+    static AVLNode<Key, Value>* intersectNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                               Merge& merge, WorkStealingPool& pool, int& h);
+    static AVLNode<Key, Value>* differenceNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                                WorkStealingPool& pool, int& h);
+    template<typename Items>
+    static AVLNode<Key, Value>* buildNodes(const Items& items,
+                                           size_t lo, size_t hi, AVLNode<Key, Value>* parent,
+                                           int depth, WorkStealingPool& pool, int& h);
+    static int buildDepth(const WorkStealingPool& pool);
+    template<typename InputIt>
+    static void copyItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items,
+                          WorkStealingPool& pool, std::random_access_iterator_tag);
+    template<typename InputIt, typename Tag>
+    static void copyItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items,
+                          WorkStealingPool& pool, Tag);
+    // The de-duplicated items of build_parallel: the sorted items at the
+    // kept positions.
+    struct KeptItems
+    {
+        const std::pair<Key, Value>& operator[](size_t i) const
+        {
+            return (*items)[(*kept)[i]];
+        }
+        const std::vector<std::pair<Key, Value> >* items;
+        const std::vector<size_t>* kept;
+    };
+    // The items of a snapshot for buildNodes, read from its two arrays.
+    struct ArrayItems
+    {
+        std::pair<const Key&, const Value&> operator[](size_t i) const
+        {
+            return std::pair<const Key&, const Value&>(keys[i], values[i]);
+        }
+        const Key* keys;
+        const Value* values;
+    };
+    struct KeyLess
+    {
+        bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+    struct KeepOther
+    {
+        Value operator()(const Value&, const Value& theirs) const { return theirs; }
+    };
+    struct KeepMine
+    {
+        Value operator()(const Value& mine, const Value&) const { return mine; }
+    };
 };
 
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree() :
+    relaxed_(false), overSlack_(false), maxPending_(0),
+    cacheShift_(0), cacheHits_(0), cacheMisses_(0),
+    indexed_(false), indexStale_(false), indexCount_(0), indexShift_(64),
+    filtered_(false), filterStale_(false), filterExpected_(0), filterRate_(0.01), filterRejects_(0)
+{
+
+}
+
+/**
+* Clones other's nodes, balances included, in one O(n) pass. The settings
+* carry over; the lookup cache starts empty, the hash index and the filter
+* are rebuilt on first use, and the counters start at zero. Nodes that
+* other still had to rebalance are found again by their balance.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree(const AVLTree<Key, Value>& other) :
+    BinarySearchTree<Key, Value>(other),
+    relaxed_(other.relaxed_), overSlack_(other.overSlack_), maxPending_(other.maxPending_),
+    cache_(other.cache_.size(), nullptr), cacheShift_(other.cacheShift_), cacheHits_(0), cacheMisses_(0),
+    indexed_(other.indexed_), indexStale_(other.indexed_), indexCount_(0), indexShift_(64),
+    filtered_(other.filtered_), filterStale_(other.filtered_), filterExpected_(other.filterExpected_),
+    filterRate_(other.filterRate_), filterRejects_(0)
+{
+    if(other.pendingRebalance() > 0){
+        for(Node<Key, Value>* p = this->getSmallestNode(); p != nullptr; p = BinarySearchTree<Key, Value>::successor(p)){
+            AVLNode<Key, Value>* n = static_cast<AVLNode<Key, Value>*>(p);
+            if(std::abs(n->getBalance()) >= 2){
+                n->setQueued(true);
+                pending_.push_back(n);
+            }
+        }
+    }
+}
+
+/**
+* Takes over other's nodes and side structures in O(1). other is left
+* empty, with its settings but without a cache, index or filter.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree(AVLTree<Key, Value>&& other) noexcept :
+    BinarySearchTree<Key, Value>(std::move(other)),
+    relaxed_(other.relaxed_), overSlack_(other.overSlack_), maxPending_(other.maxPending_),
+    pending_(std::move(other.pending_)), repairHeap_(std::move(other.repairHeap_)),
+    cache_(std::move(other.cache_)), cacheShift_(other.cacheShift_),
+    cacheHits_(other.cacheHits_), cacheMisses_(other.cacheMisses_),
+    indexed_(other.indexed_), indexStale_(other.indexStale_), index_(std::move(other.index_)),
+    indexCount_(other.indexCount_), indexShift_(other.indexShift_),
+    filtered_(other.filtered_), filterStale_(other.filterStale_), filterExpected_(other.filterExpected_),
+    filterRate_(other.filterRate_), filter_(std::move(other.filter_)), filterRejects_(other.filterRejects_)
+{
+    other.pending_.clear();
+    other.repairHeap_.clear();
+    other.overSlack_ = false;
+    other.cache_.clear();
+    other.cacheShift_ = 0;
+    other.indexed_ = false;
+    other.indexStale_ = false;
+    other.index_.clear();
+    other.indexCount_ = 0;
+    other.indexShift_ = 64;
+    other.filtered_ = false;
+    other.filterStale_ = false;
+}
+
+template<class Key, class Value>
+AVLTree<Key, Value>& AVLTree<Key, Value>::operator=(AVLTree<Key, Value> other)
+{
+    swap(other);
+    return *this;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::swap(AVLTree<Key, Value>& other)
+{
+    BinarySearchTree<Key, Value>::swap(other);
+    std::swap(relaxed_, other.relaxed_);
+    std::swap(overSlack_, other.overSlack_);
+    std::swap(maxPending_, other.maxPending_);
+    pending_.swap(other.pending_);
+    repairHeap_.swap(other.repairHeap_);
+    cache_.swap(other.cache_);
+    std::swap(cacheShift_, other.cacheShift_);
+    std::swap(cacheHits_, other.cacheHits_);
+    std::swap(cacheMisses_, other.cacheMisses_);
+    std::swap(indexed_, other.indexed_);
+    std::swap(indexStale_, other.indexStale_);
+    index_.swap(other.index_);
+    std::swap(indexCount_, other.indexCount_);
+    std::swap(indexShift_, other.indexShift_);
+    std::swap(filtered_, other.filtered_);
+    std::swap(filterStale_, other.filterStale_);
+    std::swap(filterExpected_, other.filterExpected_);
+    std::swap(filterRate_, other.filterRate_);
+    std::swap(filter_, other.filter_);
+    std::swap(filterRejects_, other.filterRejects_);
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
@@ -153,8 +533,20 @@ template<class Key, class Value>
 void AVLTree<Key, Value>::insert(const std::pair<const Key,Value> &new_item)
 {
     // TODO
+    if(indexed_){
+        Node<Key, Value>* existing = indexFind(new_item.first);
+        if(existing != nullptr){
+            existing->setValue(new_item.second);
+            return;
+        }
+    }
+    if(relaxed_){
+        relaxedInsert(new_item);
+        return;
+    }
     if(this->root_==nullptr){ //nothing in AVL
         this->root_=new AVLNode<Key,Value>(new_item.first, new_item.second, nullptr);
+        nodeAdded(this->root_);
         return;
     }
     //else
@@ -168,6 +560,7 @@ void AVLTree<Key, Value>::insert(const std::pair<const Key,Value> &new_item)
                 leftNode->setBalance(0);
                 temp->setLeft(leftNode);
                 leftNode->setParent(temp);
+                nodeAdded(leftNode);
                 nextTemp =leftNode;
                 isLeft =true;
                 break;
@@ -182,6 +575,7 @@ void AVLTree<Key, Value>::insert(const std::pair<const Key,Value> &new_item)
                 rightNode->setBalance(0);
                 temp->setRight(rightNode);
                 rightNode->setParent(temp);
+                nodeAdded(rightNode);
                 nextTemp = rightNode;
                 isLeft = false;
                 break;
@@ -332,6 +726,10 @@ template<class Key, class Value>
 void AVLTree<Key, Value>:: remove(const Key& key)
 {
     // TODO
+    if(relaxed_){
+        relaxedRemove(key);
+        return;
+    }
     AVLNode<Key,Value>* n =static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
     if(n ==nullptr){
         return;
@@ -414,7 +812,10 @@ void AVLTree<Key, Value>::fixRemove(AVLNode<Key,Value>* n, char diff){
 
 template<typename Key, typename Value>
 void AVLTree<Key, Value>::deleteNode(AVLNode<Key, Value>* node){
+    //nodeRemoved runs only in the branches that free the node, since the
+    //two-kids branch comes back here and must not report it twice
     if((node->getLeft() == nullptr) && (node->getRight() == nullptr)){ //leaf
+        nodeRemoved(node);
         if(node == this->root_){
             this->root_ = nullptr;
             delete node;
@@ -431,6 +832,7 @@ void AVLTree<Key, Value>::deleteNode(AVLNode<Key, Value>* node){
         nodeSwap(node, temp);
         deleteNode(node);
     } else {
+        nodeRemoved(node);
         AVLNode<Key,Value>* temp = node;
         if(node->getLeft() != nullptr){
             node->getLeft()->setParent(node->getParent());
@@ -462,6 +864,7 @@ void AVLTree<Key, Value>::deleteNode(AVLNode<Key, Value>* node){
 
 
 
+//items stay with their nodes, so a swap leaves the lookup cache valid
 template<class Key, class Value>
 void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
@@ -469,6 +872,1289 @@ void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>*
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    bool tempQ = n1->isQueued();
+    n1->setQueued(n2->isQueued());
+    n2->setQueued(tempQ);
+}
+
+
+/**
+* Frees every node and drops the nodes waiting for relaxed rebalancing.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::clear()
+{
+    pending_.clear();
+    repairHeap_.clear();
+    overSlack_ = false;
+    nodesReplaced();
+    BinarySearchTree<Key, Value>::clear();
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::nodeAdded(Node<Key, Value>* node)
+{
+    indexNode(node);
+    if(filtered_ && !filterStale_){
+        filter_.add(node->getKey());
+        if(filter_.size() > 2 * filterExpected_){
+            filterExpected_ = 2 * filter_.size();
+            filterStale_ = true;
+        }
+    }
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::nodeRemoved(AVLNode<Key, Value>* node)
+{
+    forgetNode(node);
+    unindexNode(node);
+    if(filtered_ && !filterStale_){
+        filter_.remove(node->getKey());
+    }
+}
+
+//the node set changed wholesale, as in clear() or split()
+template<class Key, class Value>
+void AVLTree<Key, Value>::nodesReplaced()
+{
+    flushLookupCache();
+    markIndexStale();
+    filterStale_ = filtered_;
+}
+
+/**
+* Turns the lookup cache on with slots entries, rounded up to a power of
+* two, or off when slots is 0. A few thousand slots cover the hot keys of
+* a skewed workload. Resizing empties the cache; the counters are kept.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setLookupCache(size_t slots)
+{
+    if(slots > 0 && !KeyHash<Key>::available){
+        throw std::invalid_argument("setLookupCache: the key type has no std::hash");
+    }
+    if(slots == 0){
+        std::vector<Node<Key, Value>*>().swap(cache_);
+        cacheShift_ = 0;
+        return;
+    }
+    size_t size = 1;
+    int bits = 0;
+    while(size < slots){
+        size <<= 1;
+        ++bits;
+    }
+    cache_.assign(size, nullptr);
+    cacheShift_ = 64 - bits;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::lookupCacheSize() const
+{
+    return cache_.size();
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::cacheHits() const
+{
+    return cacheHits_;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::cacheMisses() const
+{
+    return cacheMisses_;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::resetCacheStats()
+{
+    cacheHits_ = 0;
+    cacheMisses_ = 0;
+}
+
+/**
+* Checks the cache slot of key before walking the tree. A slot is only
+* trusted if its node holds key, so two keys sharing a slot just evict
+* each other. Only keys that are found get cached.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::internalFind(const Key& key) const
+{
+    if(filtered_){
+        if(filterStale_){
+            rebuildFilter();
+        }
+        if(!filter_.mayContain(key)){
+            ++filterRejects_;
+            return nullptr;
+        }
+    }
+    if(indexed_){
+        return indexFind(key);
+    }
+    if(cache_.empty()){
+        return BinarySearchTree<Key, Value>::internalFind(key);
+    }
+    Node<Key, Value>*& slot = cache_[cacheSlot(key)];
+    if(slot != nullptr && slot->getKey() == key){
+        ++cacheHits_;
+        return slot;
+    }
+    ++cacheMisses_;
+    Node<Key, Value>* n = BinarySearchTree<Key, Value>::internalFind(key);
+    if(n != nullptr){
+        slot = n;
+    }
+    return n;
+}
+
+//Fibonacci hashing on top of KeyHash; std::hash's integer hash is the identity
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::cacheSlot(const Key& key) const
+{
+    uint64_t h = static_cast<uint64_t>(KeyHash<Key>()(key)) * 0x9E3779B97F4A7C15ull;
+    return (cacheShift_ == 64) ? 0 : static_cast<size_t>(h >> cacheShift_);
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::forgetNode(AVLNode<Key, Value>* node)
+{
+    if(cache_.empty()){
+        return;
+    }
+    Node<Key, Value>*& slot = cache_[cacheSlot(node->getKey())];
+    if(slot == node){
+        slot = nullptr;
+    }
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::flushLookupCache()
+{
+    std::fill(cache_.begin(), cache_.end(), static_cast<Node<Key, Value>*>(nullptr));
+}
+
+/**
+* Turns the hash index on, building it from the tree in O(n), or off,
+* freeing it. The table holds 16-byte slots and stays between 3/8 and 3/4
+* full as it grows; it does not shrink on removal until the next bulk
+* operation or clear().
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setHashIndex(bool on)
+{
+    if(on && !KeyHash<Key>::available){
+        throw std::invalid_argument("setHashIndex: the key type has no std::hash");
+    }
+    indexed_ = on;
+    std::vector<IndexSlot>().swap(index_);
+    indexCount_ = 0;
+    indexShift_ = 64;
+    indexStale_ = on;
+    if(on){
+        rebuildIndex();
+    }
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::hasHashIndex() const
+{
+    return indexed_;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::hashIndexBytes() const
+{
+    return index_.capacity() * sizeof(IndexSlot);
+}
+
+//KeyHash mixed so that the top bits, which pick the home slot, vary
+template<class Key, class Value>
+uint64_t AVLTree<Key, Value>::indexHash(const Key& key)
+{
+    uint64_t h = static_cast<uint64_t>(KeyHash<Key>()(key)) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::indexFind(const Key& key) const
+{
+    if(indexStale_){
+        rebuildIndex();
+    }
+    if(index_.empty()){
+        return nullptr;
+    }
+    uint64_t h = indexHash(key);
+    size_t mask = index_.size() - 1;
+    for(size_t i = static_cast<size_t>(h >> indexShift_); ; i = (i + 1) & mask){
+        const IndexSlot& slot = index_[i];
+        if(slot.node == nullptr){
+            return nullptr;
+        }
+        if(slot.hash == h && slot.node->getKey() == key){
+            return slot.node;
+        }
+    }
+}
+
+//adds a node whose key is not indexed yet
+template<class Key, class Value>
+void AVLTree<Key, Value>::indexNode(Node<Key, Value>* node) const
+{
+    if(!indexed_ || indexStale_){
+        return;
+    }
+    if((indexCount_ + 1) * 4 > index_.size() * 3){
+        growIndex(std::max<size_t>(16, 2 * index_.size()));
+    }
+    uint64_t h = indexHash(node->getKey());
+    size_t mask = index_.size() - 1;
+    size_t i = static_cast<size_t>(h >> indexShift_);
+    while(index_[i].node != nullptr){
+        i = (i + 1) & mask;
+    }
+    index_[i].hash = h;
+    index_[i].node = node;
+    ++indexCount_;
+}
+
+/**
+* Removes a node with backward-shift deletion: the entries after the hole
+* that may move back are shifted into it, so no tombstones are left and
+* probe lengths do not degrade over time.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::unindexNode(Node<Key, Value>* node)
+{
+    if(!indexed_ || indexStale_){
+        return;
+    }
+    uint64_t h = indexHash(node->getKey());
+    size_t mask = index_.size() - 1;
+    size_t i = static_cast<size_t>(h >> indexShift_);
+    while(index_[i].node != node){
+        i = (i + 1) & mask;
+    }
+    for(size_t j = (i + 1) & mask; index_[j].node != nullptr; j = (j + 1) & mask){
+        size_t home = static_cast<size_t>(index_[j].hash >> indexShift_);
+        //j may fill the hole unless its home lies in (i, j]
+        if(((j - home) & mask) >= ((j - i) & mask)){
+            index_[i] = index_[j];
+            i = j;
+        }
+    }
+    index_[i].node = nullptr;
+    --indexCount_;
+}
+
+//indexes every node of the tree, sized so that the table is at most half full
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebuildIndex() const
+{
+    size_t n = 0;
+    for(Node<Key, Value>* p = this->getSmallestNode(); p != nullptr; p = BinarySearchTree<Key, Value>::successor(p)){
+        ++n;
+    }
+    indexStale_ = false;
+    indexCount_ = 0;
+    std::vector<IndexSlot>().swap(index_);
+    indexShift_ = 64;
+    if(n > 0){
+        growIndex(std::max<size_t>(16, 2 * n));
+    }
+    for(Node<Key, Value>* p = this->getSmallestNode(); p != nullptr; p = BinarySearchTree<Key, Value>::successor(p)){
+        indexNode(p);
+    }
+}
+
+//moves the entries into a table of at least slots slots
+template<class Key, class Value>
+void AVLTree<Key, Value>::growIndex(size_t slots) const
+{
+    size_t size = 1;
+    int bits = 0;
+    while(size < slots){
+        size <<= 1;
+        ++bits;
+    }
+    std::vector<IndexSlot> old(size);
+    old.swap(index_);
+    indexShift_ = 64 - bits;
+    size_t mask = size - 1;
+    for(size_t k = 0; k < old.size(); ++k){
+        if(old[k].node == nullptr){
+            continue;
+        }
+        size_t i = static_cast<size_t>(old[k].hash >> indexShift_);
+        while(index_[i].node != nullptr){
+            i = (i + 1) & mask;
+        }
+        index_[i] = old[k];
+    }
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::markIndexStale()
+{
+    if(indexed_){
+        indexStale_ = true;
+    }
+}
+
+/**
+* Turns the membership filter on, sized for expectedKeys keys (or the
+* current size, if larger) at the given false positive rate, or off when
+* expectedKeys is 0. With the default 1% rate the filter takes about 5
+* bytes per key. The counts of rejected lookups are kept across calls.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setMembershipFilter(size_t expectedKeys, double falsePositiveRate)
+{
+    if(expectedKeys > 0 && !KeyHash<Key>::available){
+        throw std::invalid_argument("setMembershipFilter: the key type has no std::hash");
+    }
+    filtered_ = expectedKeys > 0;
+    filterExpected_ = expectedKeys;
+    filterRate_ = falsePositiveRate;
+    filter_ = CountingBloomFilter<Key, KeyHash<Key> >();
+    filterStale_ = filtered_;
+    if(filtered_){
+        rebuildFilter();
+    }
+}
+
+//lookups that the filter answered without touching the tree
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::filterRejects() const
+{
+    return filterRejects_;
+}
+
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::filterBytes() const
+{
+    return filtered_ ? filter_.bytes() : 0;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebuildFilter() const
+{
+    size_t n = 0;
+    for(Node<Key, Value>* p = this->getSmallestNode(); p != nullptr; p = BinarySearchTree<Key, Value>::successor(p)){
+        ++n;
+    }
+    filter_ = CountingBloomFilter<Key, KeyHash<Key> >(std::max(filterExpected_, n), filterRate_);
+    for(Node<Key, Value>* p = this->getSmallestNode(); p != nullptr; p = BinarySearchTree<Key, Value>::successor(p)){
+        filter_.add(p->getKey());
+    }
+    filterStale_ = false;
+}
+
+/**
+* Turns relaxed balancing on or off. Leaving relaxed mode does all the
+* deferred rotations, so the tree is a proper AVL tree again afterwards.
+* While relaxed, an update that leaves more than maxPending skewed nodes
+* repairs the deepest repairBudget_ of them, so no single update pays for
+* the whole backlog. A node whose balance reaches maxSlack_ makes the next
+* update repair everything, which also keeps the balance factors within
+* int8_t range and bounds the height by the AVL bound plus maxSlack_ per
+* node still waiting.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setRelaxed(bool relaxed, size_t maxPending)
+{
+    if(!relaxed){
+        rebalance();
+    }
+    relaxed_ = relaxed;
+    maxPending_ = maxPending;
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::isRelaxed() const
+{
+    return relaxed_;
+}
+
+/**
+* Repairs up to budget skewed nodes, deepest first, and returns the number
+* still waiting. Each repair re-joins the node with its two (already
+* balanced) subtrees in O(|hl - hr| + 1) rotations; a repair that shortens
+* the subtree may skew an ancestor, which is then queued as well.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::rebalance(size_t budget)
+{
+    size_t done = 0;
+    while(true){
+        for(size_t i = 0; i < pending_.size(); ++i){
+            if(std::abs(pending_[i]->getBalance()) >= 2){
+                repairHeap_.push_back(std::make_pair(nodeDepth(pending_[i]), pending_[i]));
+                std::push_heap(repairHeap_.begin(), repairHeap_.end());
+            } else {
+                pending_[i]->setQueued(false);
+            }
+        }
+        pending_.clear();
+        if(repairHeap_.empty() || done == budget){
+            break;
+        }
+        std::pop_heap(repairHeap_.begin(), repairHeap_.end());
+        std::pair<int, AVLNode<Key, Value>*> top = repairHeap_.back();
+        repairHeap_.pop_back();
+        AVLNode<Key, Value>* n = top.second;
+        if(std::abs(n->getBalance()) < 2){ //balanced out since it was queued
+            n->setQueued(false);
+            continue;
+        }
+        int depth = nodeDepth(n);
+        if(depth != top.first){ //moved by an earlier repair
+            repairHeap_.push_back(std::make_pair(depth, n));
+            std::push_heap(repairHeap_.begin(), repairHeap_.end());
+            continue;
+        }
+        n->setQueued(false);
+        repair(n);
+        ++done;
+    }
+    if(repairHeap_.empty()){
+        overSlack_ = false;
+    }
+    return repairHeap_.size();
+}
+
+/**
+* The number of nodes queued for relaxed rebalancing. Nodes that later
+* balanced out on their own may still be counted until the next rebalance().
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::pendingRebalance() const
+{
+    return pending_.size() + repairHeap_.size();
+}
+
+//insert without rotations; see setRelaxed
+template<class Key, class Value>
+void AVLTree<Key, Value>::relaxedInsert(const std::pair<const Key, Value>& new_item)
+{
+    AVLNode<Key, Value>* parent = nullptr;
+    AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->root_);
+    while(temp != nullptr){
+        parent = temp;
+        if(new_item.first < temp->getKey()){
+            temp = temp->getLeft();
+        } else if(temp->getKey() < new_item.first){
+            temp = temp->getRight();
+        } else {
+            temp->setValue(new_item.second);
+            return;
+        }
+    }
+    AVLNode<Key, Value>* n = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+    nodeAdded(n);
+    if(parent == nullptr){
+        this->root_ = n;
+        return;
+    }
+    bool fromLeft = new_item.first < parent->getKey();
+    if(fromLeft){
+        parent->setLeft(n);
+    } else {
+        parent->setRight(n);
+    }
+    adjustUp(parent, fromLeft, 1);
+    drainPending();
+}
+
+//remove without rotations; see setRelaxed
+template<class Key, class Value>
+void AVLTree<Key, Value>::relaxedRemove(const Key& key)
+{
+    AVLNode<Key, Value>* n = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    if(n == nullptr){
+        return;
+    }
+    if(n->getLeft() != nullptr && n->getRight() != nullptr){
+        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(this->predecessor(n));
+        bool queued = n->isQueued() || pred->isQueued();
+        nodeSwap(n, pred);
+        //the balances stay with the positions, so the markers must follow them
+        if(queued){
+            for(size_t i = 0; i < pending_.size(); ++i){
+                if(pending_[i] == n) pending_[i] = pred;
+                else if(pending_[i] == pred) pending_[i] = n;
+            }
+            for(size_t i = 0; i < repairHeap_.size(); ++i){
+                if(repairHeap_[i].second == n) repairHeap_[i].second = pred;
+                else if(repairHeap_[i].second == pred) repairHeap_[i].second = n;
+            }
+            std::make_heap(repairHeap_.begin(), repairHeap_.end());
+        }
+    }
+    if(n->isQueued()){
+        pending_.erase(std::remove(pending_.begin(), pending_.end(), n), pending_.end());
+        for(size_t i = 0; i < repairHeap_.size(); ++i){
+            if(repairHeap_[i].second == n){
+                repairHeap_[i] = repairHeap_.back();
+                repairHeap_.pop_back();
+                std::make_heap(repairHeap_.begin(), repairHeap_.end());
+                break;
+            }
+        }
+    }
+    AVLNode<Key, Value>* p = n->getParent();
+    bool fromLeft = (p != nullptr && p->getLeft() == n);
+    deleteNode(n);
+    adjustUp(p, fromLeft, -1);
+    drainPending();
+}
+
+/**
+* Updates the exact balances on the path from p to the root after p's left
+* (fromLeft) or right subtree grew (delta 1) or shrank (delta -1) by one
+* level, stopping as soon as a subtree keeps its height. Nodes that become
+* skewed are queued for repair.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::adjustUp(AVLNode<Key, Value>* p, bool fromLeft, int delta)
+{
+    while(p != nullptr){
+        int old = p->getBalance();
+        int b = fromLeft ? old - delta : old + delta;
+        p->setBalance(static_cast<int8_t>(b));
+        if(std::abs(b) >= 2 && !p->isQueued()){
+            p->setQueued(true);
+            pending_.push_back(p);
+        }
+        if(std::abs(b) >= maxSlack_){
+            overSlack_ = true;
+        }
+        bool changed;
+        if(delta > 0){
+            changed = fromLeft ? old <= 0 : old >= 0;
+        } else {
+            changed = fromLeft ? old < 0 : old > 0;
+        }
+        if(!changed){
+            return;
+        }
+        AVLNode<Key, Value>* g = p->getParent();
+        if(g != nullptr){
+            fromLeft = (g->getLeft() == p);
+        }
+        p = g;
+    }
+}
+
+/**
+* Rebuilds the skewed subtree rooted at n, whose two subtrees must already be
+* AVL trees, by joining them back together with n as the pivot.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::repair(AVLNode<Key, Value>* n)
+{
+    AVLNode<Key, Value>* parent = n->getParent();
+    bool fromLeft = (parent != nullptr && parent->getLeft() == n);
+    int h = subtreeHeight(n);
+    int hl = childHeight(n, h, true);
+    int hr = childHeight(n, h, false);
+    int hn;
+    AVLNode<Key, Value>* t = joinNodes(n->getLeft(), hl, n, n->getRight(), hr, hn);
+    t->setParent(parent);
+    if(parent == nullptr){
+        this->root_ = t;
+    } else if(fromLeft){
+        parent->setLeft(t);
+    } else {
+        parent->setRight(t);
+    }
+    if(hn < h){
+        adjustUp(parent, fromLeft, -1);
+    }
+}
+
+//called after every relaxed update to keep the backlog within its limits;
+//an overfull backlog is worked off a few repairs per update
+template<class Key, class Value>
+void AVLTree<Key, Value>::drainPending()
+{
+    if(overSlack_){
+        rebalance();
+        return;
+    }
+    if(pendingRebalance() > maxPending_){
+        rebalance(repairBudget_);
+    }
+}
+
+template<class Key, class Value>
+int AVLTree<Key, Value>::nodeDepth(AVLNode<Key, Value>* n)
+{
+    int depth = 0;
+    for(; n != nullptr; n = n->getParent()){
+        ++depth;
+    }
+    return depth;
+}
+
+/**
+* Checks a node's stored balance against the balance stats() measured.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::storedBalanceMatches(Node<Key, Value>* node, int actual) const
+{
+    return static_cast<AVLNode<Key, Value>*>(node)->getBalance() == actual;
+}
+
+/**
+* Splits the tree around key in O(log n). Every item with a key smaller than
+* key ends up in left and every other item in right; this tree is left empty.
+* Whatever left and right held before is cleared. left and right must be
+* different trees, otherwise std::invalid_argument is thrown and nothing is
+* changed.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::split(const Key& key, AVLTree<Key, Value>& left, AVLTree<Key, Value>& right)
+{
+    if(&left == &right){
+        throw std::invalid_argument("split: left and right are the same tree");
+    }
+    AVLNode<Key, Value>* t = detachRoot();
+    left.clear();
+    right.clear();
+    AVLNode<Key, Value>* l;
+    AVLNode<Key, Value>* m;
+    AVLNode<Key, Value>* r;
+    int hl, hr;
+    splitNodes(t, subtreeHeight(t), key, l, hl, m, r, hr);
+    if(m != nullptr){
+        int hm;
+        r = joinNodes(nullptr, 0, m, r, hr, hm);
+    }
+    if(l != nullptr) l->setParent(nullptr);
+    if(r != nullptr) r->setParent(nullptr);
+    left.root_ = l;
+    right.root_ = r;
+}
+
+/**
+* Replaces the contents of this tree with the union of left and right in
+* O(log n). Every key in left must be smaller than every key in right,
+* otherwise std::invalid_argument is thrown and nothing is changed.
+* On success left and right are left empty.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::join(AVLTree<Key, Value>& left, AVLTree<Key, Value>& right)
+{
+    if(!left.empty() && !right.empty()){
+        Node<Key, Value>* lmax = left.root_;
+        while(lmax->getRight() != nullptr) lmax = lmax->getRight();
+        if(!(lmax->getKey() < right.getSmallestNode()->getKey())){
+            throw std::invalid_argument("join: key ranges overlap");
+        }
+    }
+    AVLNode<Key, Value>* l = left.detachRoot();
+    AVLNode<Key, Value>* r = right.detachRoot();
+    this->clear();
+    int h;
+    AVLNode<Key, Value>* t = joinNodes(l, subtreeHeight(l), r, subtreeHeight(r), h);
+    if(t != nullptr) t->setParent(nullptr);
+    this->root_ = t;
+}
+
+//hands the node structure over to the caller and leaves the tree empty;
+//deferred rotations are done first, since the callers need an AVL tree
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::detachRoot()
+{
+    rebalance();
+    nodesReplaced();
+    AVLNode<Key, Value>* t = static_cast<AVLNode<Key, Value>*>(this->root_);
+    this->root_ = nullptr;
+    return t;
+}
+
+//height of an AVL subtree in O(log n), following the taller child at each step
+template<class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(AVLNode<Key, Value>* n)
+{
+    int h = 0;
+    while(n != nullptr){
+        ++h;
+        n = (n->getBalance() > 0) ? n->getRight() : n->getLeft();
+    }
+    return h;
+}
+
+//height of n's left (or right) child, given that n's subtree has height h
+template<class Key, class Value>
+int AVLTree<Key, Value>::childHeight(AVLNode<Key, Value>* n, int h, bool left)
+{
+    int b = n->getBalance();
+    if(left){
+        return (b > 0) ? h - 1 - b : h - 1;
+    }
+    return (b < 0) ? h - 1 + b : h - 1;
+}
+
+/**
+* Makes l and r the children of n and returns the root of the resulting
+* subtree, whose height is stored in h. The heights of l and r may differ by
+* at most two; a difference of two is repaired with a single or double rotation.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::attach(AVLNode<Key, Value>* n, AVLNode<Key, Value>* l, int hl,
+                                                 AVLNode<Key, Value>* r, int hr, int& h)
+{
+    if(hr - hl == 2){
+        AVLNode<Key, Value>* rl = r->getLeft();
+        AVLNode<Key, Value>* rr = r->getRight();
+        int hrl = childHeight(r, hr, true);
+        int hrr = childHeight(r, hr, false);
+        if(hrr >= hrl){ //left rotation
+            int hn;
+            attach(n, l, hl, rl, hrl, hn);
+            return attach(r, n, hn, rr, hrr, h);
+        }
+        //right-left rotation
+        int ha = childHeight(rl, hrl, true);
+        int hb = childHeight(rl, hrl, false);
+        AVLNode<Key, Value>* a = rl->getLeft();
+        AVLNode<Key, Value>* b = rl->getRight();
+        int h1, h2;
+        attach(n, l, hl, a, ha, h1);
+        attach(r, b, hb, rr, hrr, h2);
+        return attach(rl, n, h1, r, h2, h);
+    }
+    if(hl - hr == 2){
+        AVLNode<Key, Value>* ll = l->getLeft();
+        AVLNode<Key, Value>* lr = l->getRight();
+        int hll = childHeight(l, hl, true);
+        int hlr = childHeight(l, hl, false);
+        if(hll >= hlr){ //right rotation
+            int hn;
+            attach(n, lr, hlr, r, hr, hn);
+            return attach(l, ll, hll, n, hn, h);
+        }
+        //left-right rotation
+        int ha = childHeight(lr, hlr, true);
+        int hb = childHeight(lr, hlr, false);
+        AVLNode<Key, Value>* a = lr->getLeft();
+        AVLNode<Key, Value>* b = lr->getRight();
+        int h1, h2;
+        attach(l, ll, hll, a, ha, h1);
+        attach(n, b, hb, r, hr, h2);
+        return attach(lr, l, h1, n, h2, h);
+    }
+    n->setLeft(l);
+    n->setRight(r);
+    if(l != nullptr) l->setParent(n);
+    if(r != nullptr) r->setParent(n);
+    n->setBalance(static_cast<int8_t>(hr - hl));
+    h = std::max(hl, hr) + 1;
+    return n;
+}
+
+/**
+* Joins l, the single node k and r, where every key in l is smaller than k's
+* key and every key in r is larger. Descends the spine of the taller tree
+* until the heights match, so the cost is O(|hl - hr| + 1).
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinNodes(AVLNode<Key, Value>* l, int hl, AVLNode<Key, Value>* k,
+                                                    AVLNode<Key, Value>* r, int hr, int& h)
+{
+    if(hl > hr + 1){
+        int hll = childHeight(l, hl, true);
+        int hlr = childHeight(l, hl, false);
+        AVLNode<Key, Value>* ll = l->getLeft();
+        int ht;
+        AVLNode<Key, Value>* t = joinNodes(l->getRight(), hlr, k, r, hr, ht);
+        return attach(l, ll, hll, t, ht, h);
+    }
+    if(hr > hl + 1){
+        int hrl = childHeight(r, hr, true);
+        int hrr = childHeight(r, hr, false);
+        AVLNode<Key, Value>* rr = r->getRight();
+        int ht;
+        AVLNode<Key, Value>* t = joinNodes(l, hl, k, r->getLeft(), hrl, ht);
+        return attach(r, t, ht, rr, hrr, h);
+    }
+    return attach(k, l, hl, r, hr, h);
+}
+
+/**
+* Joins l and r without a separating node by pulling the smallest node out
+* of r and using it as the pivot.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinNodes(AVLNode<Key, Value>* l, int hl,
+                                                    AVLNode<Key, Value>* r, int hr, int& h)
+{
+    if(l == nullptr){
+        h = hr;
+        return r;
+    }
+    if(r == nullptr){
+        h = hl;
+        return l;
+    }
+    AVLNode<Key, Value>* rest;
+    int hrest;
+    AVLNode<Key, Value>* k = splitFirst(r, hr, rest, hrest);
+    return joinNodes(l, hl, k, rest, hrest, h);
+}
+
+//removes the smallest node from t and returns it; the remaining tree goes in rest
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::splitFirst(AVLNode<Key, Value>* t, int ht,
+                                                     AVLNode<Key, Value>*& rest, int& hrest)
+{
+    AVLNode<Key, Value>* tl = t->getLeft();
+    AVLNode<Key, Value>* tr = t->getRight();
+    int htr = childHeight(t, ht, false);
+    if(tl == nullptr){
+        rest = tr;
+        hrest = htr;
+        return t;
+    }
+    AVLNode<Key, Value>* l;
+    int hl;
+    AVLNode<Key, Value>* first = splitFirst(tl, childHeight(t, ht, true), l, hl);
+    rest = joinNodes(l, hl, t, tr, htr, hrest);
+    return first;
+}
+
+/**
+* Splits the subtree t (of height ht) into l, holding keys smaller than key,
+* r, holding keys larger than key, and m, the detached node whose key equals
+* key (or NULL). Each level re-joins the untouched sibling subtree, and the
+* join costs telescope to O(log n) overall.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::splitNodes(AVLNode<Key, Value>* t, int ht, const Key& key,
+                                     AVLNode<Key, Value>*& l, int& hl, AVLNode<Key, Value>*& m,
+                                     AVLNode<Key, Value>*& r, int& hr)
+{
+    if(t == nullptr){
+        l = m = r = nullptr;
+        hl = hr = 0;
+        return;
+    }
+    AVLNode<Key, Value>* tl = t->getLeft();
+    AVLNode<Key, Value>* tr = t->getRight();
+    int htl = childHeight(t, ht, true);
+    int htr = childHeight(t, ht, false);
+    if(t->getKey() < key){
+        AVLNode<Key, Value>* rest;
+        int hrest;
+        splitNodes(tr, htr, key, rest, hrest, m, r, hr);
+        l = joinNodes(tl, htl, t, rest, hrest, hl);
+    }
+    else if(key < t->getKey()){
+        AVLNode<Key, Value>* rest;
+        int hrest;
+        splitNodes(tl, htl, key, l, hl, m, rest, hrest);
+        r = joinNodes(rest, hrest, t, tr, htr, hr);
+    }
+    else{
+        l = tl;
+        hl = htl;
+        r = tr;
+        hr = htr;
+        t->setLeft(nullptr);
+        t->setRight(nullptr);
+        t->setBalance(0);
+        m = t;
+    }
+}
+
+/**
+* Adds every item of other to this tree. For keys in both trees the value
+* from other wins, as if each of its items had been inserted here.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::unionWith(AVLTree<Key, Value>& other, WorkStealingPool& pool)
+{
+    unionWith(other, KeepOther(), pool);
+}
+
+/**
+* Adds every item of other to this tree; keys in both trees get the value
+* merge(thisValue, otherValue). Runs in O(m log(n/m + 1)) work for trees of
+* sizes m <= n, with the top levels of the recursion spread over the pool.
+*/
+template<class Key, class Value>
+template<typename Merge>
+void AVLTree<Key, Value>::unionWith(AVLTree<Key, Value>& other, Merge merge, WorkStealingPool& pool)
+{
+    if(&other == this) return;
+    AVLNode<Key, Value>* a = detachRoot();
+    AVLNode<Key, Value>* b = other.detachRoot();
+    int h;
+    AVLNode<Key, Value>* t = unionNodes(a, subtreeHeight(a), b, subtreeHeight(b), merge, pool, h);
+    if(t != nullptr) t->setParent(nullptr);
+    this->root_ = t;
+}
+
+/**
+* Keeps only the keys that are also in other, with their values from this tree.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::intersectWith(AVLTree<Key, Value>& other, WorkStealingPool& pool)
+{
+    intersectWith(other, KeepMine(), pool);
+}
+
+/**
+* Keeps only the keys that are also in other; their values become
+* merge(thisValue, otherValue).
+*/
+template<class Key, class Value>
+template<typename Merge>
+void AVLTree<Key, Value>::intersectWith(AVLTree<Key, Value>& other, Merge merge, WorkStealingPool& pool)
+{
+    if(&other == this) return;
+    AVLNode<Key, Value>* a = detachRoot();
+    AVLNode<Key, Value>* b = other.detachRoot();
+    int h;
+    AVLNode<Key, Value>* t = intersectNodes(a, subtreeHeight(a), b, subtreeHeight(b), merge, pool, h);
+    if(t != nullptr) t->setParent(nullptr);
+    this->root_ = t;
+}
+
+/**
+* Removes every key that is in other from this tree.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::differenceWith(AVLTree<Key, Value>& other, WorkStealingPool& pool)
+{
+    if(&other == this){
+        this->clear();
+        return;
+    }
+    AVLNode<Key, Value>* a = detachRoot();
+    AVLNode<Key, Value>* b = other.detachRoot();
+    int h;
+    AVLNode<Key, Value>* t = differenceNodes(a, subtreeHeight(a), b, subtreeHeight(b), pool, h);
+    if(t != nullptr) t->setParent(nullptr);
+    this->root_ = t;
+}
+
+/**
+* Union of the detached subtrees a and b: b is split around a's root, the
+* two halves are merged recursively (in parallel near the top) and joined
+* back with a's root as the pivot.
+*/
+template<class Key, class Value>
+template<typename Merge>
+AVLNode<Key, Value>* AVLTree<Key, Value>::unionNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                                     Merge& merge, WorkStealingPool& pool, int& h)
+{
+    if(a == nullptr){
+        h = hb;
+        return b;
+    }
+    if(b == nullptr){
+        h = ha;
+        return a;
+    }
+    AVLNode<Key, Value>* al = a->getLeft();
+    AVLNode<Key, Value>* ar = a->getRight();
+    int hal = childHeight(a, ha, true);
+    int har = childHeight(a, ha, false);
+    AVLNode<Key, Value>* bl;
+    AVLNode<Key, Value>* bm;
+    AVLNode<Key, Value>* br;
+    int hbl, hbr;
+    splitNodes(b, hb, a->getKey(), bl, hbl, bm, br, hbr);
+
+    AVLNode<Key, Value>* l;
+    AVLNode<Key, Value>* r;
+    int hl, hr;
+    auto left = [&]() { l = unionNodes(al, hal, bl, hbl, merge, pool, hl); };
+    auto right = [&]() { r = unionNodes(ar, har, br, hbr, merge, pool, hr); };
+    if(std::max(ha, hb) > parallelHeight_){
+        pool.invoke(left, right);
+    }
+    else{
+        left();
+        right();
+    }
+
+    if(bm != nullptr){
+        a->setValue(merge(a->getValue(), bm->getValue()));
+        delete bm;
+    }
+    return joinNodes(l, hl, a, r, hr, h);
+}
+
+/**
+* Intersection of the detached subtrees a and b. Nodes of a without a
+* partner in b, and all nodes of b, are freed.
+*/
+template<class Key, class Value>
+template<typename Merge>
+AVLNode<Key, Value>* AVLTree<Key, Value>::intersectNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                                         Merge& merge, WorkStealingPool& pool, int& h)
+{
+    if(a == nullptr || b == nullptr){
+        BinarySearchTree<Key, Value>::clHelper(a);
+        BinarySearchTree<Key, Value>::clHelper(b);
+        h = 0;
+        return nullptr;
+    }
+    AVLNode<Key, Value>* al = a->getLeft();
+    AVLNode<Key, Value>* ar = a->getRight();
+    int hal = childHeight(a, ha, true);
+    int har = childHeight(a, ha, false);
+    AVLNode<Key, Value>* bl;
+    AVLNode<Key, Value>* bm;
+    AVLNode<Key, Value>* br;
+    int hbl, hbr;
+    splitNodes(b, hb, a->getKey(), bl, hbl, bm, br, hbr);
+
+    AVLNode<Key, Value>* l;
+    AVLNode<Key, Value>* r;
+    int hl, hr;
+    auto left = [&]() { l = intersectNodes(al, hal, bl, hbl, merge, pool, hl); };
+    auto right = [&]() { r = intersectNodes(ar, har, br, hbr, merge, pool, hr); };
+    if(std::max(ha, hb) > parallelHeight_){
+        pool.invoke(left, right);
+    }
+    else{
+        left();
+        right();
+    }
+
+    if(bm != nullptr){
+        a->setValue(merge(a->getValue(), bm->getValue()));
+        delete bm;
+        return joinNodes(l, hl, a, r, hr, h);
+    }
+    delete a;
+    return joinNodes(l, hl, r, hr, h);
+}
+
+/**
+* Difference a - b of the detached subtrees: a is split around b's root so
+* that the matching node (if any) drops out. All nodes of b are freed.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::differenceNodes(AVLNode<Key, Value>* a, int ha, AVLNode<Key, Value>* b, int hb,
+                                                          WorkStealingPool& pool, int& h)
+{
+    if(a == nullptr || b == nullptr){
+        BinarySearchTree<Key, Value>::clHelper(b);
+        h = ha;
+        return a;
+    }
+    AVLNode<Key, Value>* bl = b->getLeft();
+    AVLNode<Key, Value>* br = b->getRight();
+    int hbl = childHeight(b, hb, true);
+    int hbr = childHeight(b, hb, false);
+    AVLNode<Key, Value>* al;
+    AVLNode<Key, Value>* am;
+    AVLNode<Key, Value>* ar;
+    int hal, har;
+    splitNodes(a, ha, b->getKey(), al, hal, am, ar, har);
+    delete b;
+    delete am;
+
+    AVLNode<Key, Value>* l;
+    AVLNode<Key, Value>* r;
+    int hl, hr;
+    auto left = [&]() { l = differenceNodes(al, hal, bl, hbl, pool, hl); };
+    auto right = [&]() { r = differenceNodes(ar, har, br, hbr, pool, hr); };
+    if(std::max(ha, hb) > parallelHeight_){
+        pool.invoke(left, right);
+    }
+    else{
+        left();
+        right();
+    }
+    return joinNodes(l, hl, r, hr, h);
+}
+
+/**
+* Replaces the contents of the tree with the items in [first, last), which
+* may be in any order. When a key appears more than once the item that
+* comes last wins, just as with repeated inserts. Every phase runs on the
+* pool: the input is copied in slices, sorted, and de-duplicated by
+* counting the kept items of each slice, prefix-summing the counts and
+* scattering their positions. The tree is then built top-down with
+* subtrees constructed concurrently, so no rebalancing happens at all.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void AVLTree<Key, Value>::build_parallel(InputIt first, InputIt last, WorkStealingPool& pool)
+{
+    typedef typename std::conditional<std::is_default_constructible<Key>::value
+                                      && std::is_default_constructible<Value>::value,
+                                      typename std::iterator_traits<InputIt>::iterator_category,
+                                      std::input_iterator_tag>::type CopyTag;
+    std::vector<std::pair<Key, Value> > items;
+    copyItems(first, last, items, pool, CopyTag());
+    pool.stableSort(items, KeyLess());
+
+    //keep the last item of every run of equal keys
+    size_t n = items.size();
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(4 * pool.size(), n / 8192));
+    std::vector<size_t> offsets(chunks + 1, 0);
+    auto isLast = [&items, n](size_t i) { return i + 1 == n || items[i].first < items[i + 1].first; };
+    pool.forChunks(n, chunks, [&](size_t c, size_t begin, size_t end) {
+        size_t count = 0;
+        for(size_t i = begin; i < end; ++i){
+            count += isLast(i);
+        }
+        offsets[c + 1] = count;
+    });
+    for(size_t c = 0; c < chunks; ++c){
+        offsets[c + 1] += offsets[c];
+    }
+
+    this->clear();
+    int h;
+    if(offsets[chunks] == n){
+        this->root_ = buildNodes(items, 0, n, nullptr, buildDepth(pool), pool, h);
+        return;
+    }
+    std::vector<size_t> kept(offsets[chunks]);
+    pool.forChunks(n, chunks, [&](size_t c, size_t begin, size_t end) {
+        size_t out = offsets[c];
+        for(size_t i = begin; i < end; ++i){
+            if(isLast(i)) kept[out++] = i;
+        }
+    });
+    KeptItems unique = { &items, &kept };
+    this->root_ = buildNodes(unique, 0, kept.size(), nullptr, buildDepth(pool), pool, h);
+}
+
+//random-access input with default-constructible items is copied in slices
+template<class Key, class Value>
+template<typename InputIt>
+void AVLTree<Key, Value>::copyItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items,
+                                    WorkStealingPool& pool, std::random_access_iterator_tag)
+{
+    size_t n = static_cast<size_t>(last - first);
+    items.resize(n);
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(4 * pool.size(), n / 8192));
+    pool.forChunks(n, chunks, [&](size_t, size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i){
+            items[i].first = first[i].first;
+            items[i].second = first[i].second;
+        }
+    });
+}
+
+template<class Key, class Value>
+template<typename InputIt, typename Tag>
+void AVLTree<Key, Value>::copyItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items,
+                                    WorkStealingPool&, Tag)
+{
+    for(; first != last; ++first){
+        items.push_back(std::pair<Key, Value>(first->first, first->second));
+    }
+}
+
+/**
+* Returns a read-only copy of the tree in a flat Eytzinger layout, for
+* trees that are built once and then only searched. Later changes to this
+* tree do not show up in the snapshot.
+*/
+template<class Key, class Value>
+FrozenTree<Key, Value> AVLTree<Key, Value>::freeze() const
+{
+    std::vector<std::pair<Key, Value> > items;
+    this->visit_inorder([&items](const std::pair<const Key, Value>& item) {
+        items.push_back(std::pair<Key, Value>(item.first, item.second));
+    });
+    return FrozenTree<Key, Value>(items);
+}
+
+/**
+* Writes the tree to path as a binary snapshot, replacing the file
+* atomically. Throws std::runtime_error on I/O errors.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::save(const std::string& path) const
+{
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    this->visit_inorder([&keys, &values](const std::pair<const Key, Value>& item) {
+        keys.push_back(item.first);
+        values.push_back(item.second);
+    });
+    SnapshotView<Key, Value>::write(path, keys, values);
+}
+
+/**
+* Replaces the contents of the tree with the snapshot at path. The file is
+* mapped and read ahead, and its sorted items are built into a perfectly
+* balanced tree top-down, like build_parallel, so the cost is one pass
+* over the file and one allocation per item. Throws std::runtime_error if
+* the file cannot be read or is not a snapshot for these types; the tree
+* is left unchanged then.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::load(const std::string& path, WorkStealingPool& pool)
+{
+    SnapshotView<Key, Value> view(path);
+    view.prefetch();
+    ArrayItems items = { view.keys(), view.values() };
+    this->clear();
+    int h;
+    this->root_ = buildNodes(items, 0, view.size(), nullptr, buildDepth(pool), pool, h);
+}
+
+/**
+* Builds a perfectly balanced subtree from the sorted, duplicate-free items
+* in [lo, hi). The left half is never smaller than the right one, so every
+* balance factor is 0 or -1 and can be set from the two subtree heights.
+*/
+template<class Key, class Value>
+template<typename Items>
+AVLNode<Key, Value>* AVLTree<Key, Value>::buildNodes(const Items& items,
+                                                     size_t lo, size_t hi, AVLNode<Key, Value>* parent,
+                                                     int depth, WorkStealingPool& pool, int& h)
+{
+    if(lo >= hi){
+        h = 0;
+        return nullptr;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    AVLNode<Key, Value>* n = new AVLNode<Key, Value>(items[mid].first, items[mid].second, parent);
+    AVLNode<Key, Value>* l;
+    AVLNode<Key, Value>* r;
+    int hl, hr;
+    auto left = [&]() { l = buildNodes(items, lo, mid, n, depth - 1, pool, hl); };
+    auto right = [&]() { r = buildNodes(items, mid + 1, hi, n, depth - 1, pool, hr); };
+    if(depth > 0 && hi - lo > 4096){
+        pool.invoke(left, right);
+    }
+    else{
+        left();
+        right();
+    }
+    n->setLeft(l);
+    n->setRight(r);
+    n->setBalance(static_cast<int8_t>(hr - hl));
+    h = std::max(hl, hr) + 1;
+    return n;
+}
+
+//levels of buildNodes that fork onto the pool
+template<class Key, class Value>
+int AVLTree<Key, Value>::buildDepth(const WorkStealingPool& pool)
+{
+    int depth = 2;
+    for(unsigned n = pool.size(); n > 1; n >>= 1){
+        depth += 2;
+    }
+    return depth;
 }
 
 
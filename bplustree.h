@@ -0,0 +1,795 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+* Searches the sorted keys of one B+tree node. countLess is the lower
+* bound (the number of keys < k) and countLessEqual the upper bound.
+*
+* The generic version is a branchless binary search: the loop always runs
+* log2(n) times and the comparison only picks an offset, so nothing is
+* left for the branch predictor to miss. With SSE2, int keys are compared
+* four at a time instead and the matches are counted from the mask, which
+* for the 32 keys of a node is eight independent compares.
+*/
+template <typename Key>
+struct BPlusNodeSearch
+{
+    static int countLess(const Key* keys, int n, const Key& k)
+    {
+        if(n == 0){
+            return 0;
+        }
+        const Key* base = keys;
+        while(n > 1){
+            int half = n / 2;
+            base += (base[half - 1] < k) ? half : 0;
+            n -= half;
+        }
+        return int(base - keys) + (*base < k);
+    }
+
+    static int countLessEqual(const Key* keys, int n, const Key& k)
+    {
+        if(n == 0){
+            return 0;
+        }
+        const Key* base = keys;
+        while(n > 1){
+            int half = n / 2;
+            base += !(k < base[half - 1]) ? half : 0;
+            n -= half;
+        }
+        return int(base - keys) + !(k < *base);
+    }
+};
+
+#ifdef __SSE2__
+template <>
+struct BPlusNodeSearch<int>
+{
+    static int countLess(const int* keys, int n, int k)
+    {
+        __m128i kv = _mm_set1_epi32(k);
+        int c = 0;
+        int i = 0;
+        for(; i + 4 <= n; i += 4){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            c += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, kv))));
+        }
+        for(; i < n; ++i){
+            c += keys[i] < k;
+        }
+        return c;
+    }
+
+    static int countLessEqual(const int* keys, int n, int k)
+    {
+        __m128i kv = _mm_set1_epi32(k);
+        int greater = 0;
+        int i = 0;
+        for(; i + 4 <= n; i += 4){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            greater += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, kv))));
+        }
+        for(; i < n; ++i){
+            greater += keys[i] > k;
+        }
+        return n - greater;
+    }
+};
+#endif
+
+/**
+* A B+tree: a cache-conscious alternative to AVLTree with the same insert,
+* remove, find, operator[] and iterator interface.
+*
+* A balanced binary tree takes one dependent cache miss per level, about
+* log2(n) of them. Here every node holds two cache lines of keys (32 ints),
+* so a lookup takes about log32(n) node visits. Each visit searches a few
+* adjacent lines that the hardware prefetcher streams in together. Nodes
+* are aligned to and sized in whole cache lines.
+*
+* Items live only in the leaves, which are linked left to right, so
+* iteration and visit_range walk the leaves sequentially without climbing
+* back up the tree. Inner nodes hold separator keys only:
+* keys[i] <= every key under children[i + 1] and > every key under
+* children[i], and after the tree splits, merges or redistributes nodes it
+* keeps every node except the root at least half full.
+*
+* Leaves keep a copy of each key next to the items so that the search
+* touches only the compact key array; the items are stored as
+* std::pair<const Key, Value> to hand out references like the other
+* trees. Key must be default-constructible and assignable.
+*/
+template <typename Key, typename Value>
+class BPlusTree
+{
+public:
+    BPlusTree();
+    ~BPlusTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    template<typename Fn>
+    void visit_range(const Key& low, const Key& high, Fn fn) const;
+
+private:
+    struct Leaf;
+public:
+    /**
+    * Walks the linked leaves in key order.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+
+    protected:
+        friend class BPlusTree<Key, Value>;
+        iterator(Leaf* leaf, int slot);
+        Leaf* leaf_;
+        int slot_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+private:
+    typedef std::pair<const Key, Value> Item;
+    typedef BPlusNodeSearch<Key> Search;
+
+    static const int cacheLine_ = 64;
+    static const int keyBytes_ = 2 * cacheLine_;
+    static const int capacity_ = (keyBytes_ / int(sizeof(Key)) < 8) ? 8 : keyBytes_ / int(sizeof(Key));
+    static const int minFill_ = capacity_ / 2;
+
+    struct NodeBase
+    {
+        int count;
+        bool leaf;
+    };
+
+    struct alignas(64) Inner : public NodeBase
+    {
+        Key keys[capacity_];
+        NodeBase* children[capacity_ + 1];
+    };
+
+    struct alignas(64) Leaf : public NodeBase
+    {
+        Key keys[capacity_];
+        Leaf* next;
+        typename std::aligned_storage<sizeof(Item), std::alignment_of<Item>::value>::type slots[capacity_];
+        Item* item(int i) { return reinterpret_cast<Item*>(&slots[i]); }
+    };
+
+    template<typename T>
+    static T* allocate();
+    static void destroy(NodeBase* n);
+    static void destroySubtree(NodeBase* n);
+
+    Leaf* findLeaf(const Key& key) const;
+    NodeBase* insertInto(NodeBase* node, const Item& item, Key& splitKey);
+    NodeBase* splitInner(Inner* node, int idx, const Key& key, NodeBase* child, Key& splitKey);
+    bool removeFrom(NodeBase* node, const Key& key);
+    void fixLeaf(Inner* parent, int idx);
+    void fixInner(Inner* parent, int idx);
+
+    static void insertItem(Leaf* leaf, int pos, const Item& item);
+    static void eraseItem(Leaf* leaf, int pos);
+    static void moveItems(Leaf* dst, int to, Leaf* src, int from, int count);
+    static void openGap(Leaf* leaf, int pos);
+
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+    NodeBase* root_;
+    Leaf* head_;
+    size_t size_;
+    int height_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+BPlusTree<Key, Value>::iterator::iterator() :
+    leaf_(nullptr),
+    slot_(0)
+{
+
+}
+
+template<class Key, class Value>
+BPlusTree<Key, Value>::iterator::iterator(Leaf* leaf, int slot) :
+    leaf_(leaf),
+    slot_(slot)
+{
+    if(leaf_ != nullptr && slot_ == leaf_->count){
+        leaf_ = leaf_->next;
+        slot_ = 0;
+    }
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>& BPlusTree<Key, Value>::iterator::operator*() const
+{
+    return *leaf_->item(slot_);
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>* BPlusTree<Key, Value>::iterator::operator->() const
+{
+    return leaf_->item(slot_);
+}
+
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && slot_ == rhs.slot_;
+}
+
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator& BPlusTree<Key, Value>::iterator::operator++()
+{
+    if(++slot_ == leaf_->count){
+        leaf_ = leaf_->next;
+        slot_ = 0;
+    }
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  Begin implementations for the BPlusTree class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+BPlusTree<Key, Value>::BPlusTree() :
+    root_(nullptr),
+    head_(nullptr),
+    size_(0),
+    height_(0)
+{
+
+}
+
+template<class Key, class Value>
+BPlusTree<Key, Value>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* A full leaf splits in two and the split can propagate up to the root.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(root_ == nullptr){
+        Leaf* leaf = allocate<Leaf>();
+        root_ = head_ = leaf;
+        height_ = 1;
+    }
+    Key splitKey;
+    NodeBase* sibling = insertInto(root_, keyValuePair, splitKey);
+    if(sibling != nullptr){
+        Inner* top = allocate<Inner>();
+        top->count = 1;
+        top->keys[0] = splitKey;
+        top->children[0] = root_;
+        top->children[1] = sibling;
+        root_ = top;
+        ++height_;
+    }
+}
+
+/**
+* Removes key if present. Underfull nodes borrow from a sibling or are
+* merged into one, and the root shrinks away once it has a single child.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::remove(const Key& key)
+{
+    if(root_ == nullptr || !removeFrom(root_, key)){
+        return;
+    }
+    if(root_->leaf){
+        if(root_->count == 0){
+            destroy(root_);
+            root_ = head_ = nullptr;
+            height_ = 0;
+        }
+    } else if(root_->count == 0){
+        NodeBase* old = root_;
+        root_ = static_cast<Inner*>(old)->children[0];
+        destroy(old);
+        --height_;
+    }
+}
+
+template<class Key, class Value>
+void BPlusTree<Key, Value>::clear()
+{
+    destroySubtree(root_);
+    root_ = head_ = nullptr;
+    size_ = 0;
+    height_ = 0;
+}
+
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value>
+size_t BPlusTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+/**
+* The number of node levels; every leaf is at the same depth.
+*/
+template<class Key, class Value>
+int BPlusTree<Key, Value>::height() const
+{
+    return height_;
+}
+
+/**
+* Calls fn(item) with a std::pair<const Key, Value>& for every key in
+* [low, high], in key order: one descent to the first leaf, then a
+* sequential walk along the leaf chain.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void BPlusTree<Key, Value>::visit_range(const Key& low, const Key& high, Fn fn) const
+{
+    if(root_ == nullptr || high < low){
+        return;
+    }
+    Leaf* leaf = findLeaf(low);
+    int slot = Search::countLess(leaf->keys, leaf->count, low);
+    while(leaf != nullptr){
+        for(; slot < leaf->count; ++slot){
+            if(high < leaf->keys[slot]){
+                return;
+            }
+            fn(*leaf->item(slot));
+        }
+        leaf = leaf->next;
+        slot = 0;
+    }
+}
+
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator BPlusTree<Key, Value>::begin() const
+{
+    return iterator(head_, 0);
+}
+
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator BPlusTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator BPlusTree<Key, Value>::find(const Key& key) const
+{
+    if(root_ == nullptr){
+        return end();
+    }
+    Leaf* leaf = findLeaf(key);
+    int pos = Search::countLess(leaf->keys, leaf->count, key);
+    if(pos == leaf->count || key < leaf->keys[pos]){
+        return end();
+    }
+    return iterator(leaf, pos);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::iterator BPlusTree<Key, Value>::lower_bound(const Key& key) const
+{
+    if(root_ == nullptr){
+        return end();
+    }
+    Leaf* leaf = findLeaf(key);
+    return iterator(leaf, Search::countLess(leaf->keys, leaf->count, key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BPlusTree<Key, Value>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value>
+Value const & BPlusTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+//allocates a zeroed node on a cache-line boundary
+template<class Key, class Value>
+template<typename T>
+T* BPlusTree<Key, Value>::allocate()
+{
+    void* p = nullptr;
+    if(posix_memalign(&p, cacheLine_, sizeof(T)) != 0){
+        throw std::bad_alloc();
+    }
+    T* n = new(p) T();
+    n->count = 0;
+    n->leaf = std::is_same<T, Leaf>::value;
+    return n;
+}
+
+//destroys the items of a leaf and frees the node
+template<class Key, class Value>
+void BPlusTree<Key, Value>::destroy(NodeBase* n)
+{
+    if(n->leaf){
+        Leaf* leaf = static_cast<Leaf*>(n);
+        for(int i = 0; i < leaf->count; ++i){
+            leaf->item(i)->~Item();
+        }
+        leaf->~Leaf();
+    } else {
+        static_cast<Inner*>(n)->~Inner();
+    }
+    free(n);
+}
+
+template<class Key, class Value>
+void BPlusTree<Key, Value>::destroySubtree(NodeBase* n)
+{
+    if(n == nullptr){
+        return;
+    }
+    if(!n->leaf){
+        Inner* inner = static_cast<Inner*>(n);
+        for(int i = 0; i <= inner->count; ++i){
+            destroySubtree(inner->children[i]);
+        }
+    }
+    destroy(n);
+}
+
+//descends to the leaf whose key range holds key
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::Leaf* BPlusTree<Key, Value>::findLeaf(const Key& key) const
+{
+    NodeBase* n = root_;
+    while(!n->leaf){
+        Inner* inner = static_cast<Inner*>(n);
+        n = inner->children[Search::countLessEqual(inner->keys, inner->count, key)];
+    }
+    return static_cast<Leaf*>(n);
+}
+
+/**
+* Inserts item into the subtree at node. If node had to split, returns the
+* new right sibling and sets splitKey to the separator that belongs
+* between the two in the parent; otherwise returns NULL.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::NodeBase*
+BPlusTree<Key, Value>::insertInto(NodeBase* node, const Item& item, Key& splitKey)
+{
+    if(!node->leaf){
+        Inner* inner = static_cast<Inner*>(node);
+        int idx = Search::countLessEqual(inner->keys, inner->count, item.first);
+        Key childKey;
+        NodeBase* sibling = insertInto(inner->children[idx], item, childKey);
+        if(sibling == nullptr){
+            return nullptr;
+        }
+        if(inner->count < capacity_){
+            for(int i = inner->count; i > idx; --i){
+                inner->keys[i] = inner->keys[i - 1];
+                inner->children[i + 1] = inner->children[i];
+            }
+            inner->keys[idx] = childKey;
+            inner->children[idx + 1] = sibling;
+            ++inner->count;
+            return nullptr;
+        }
+        return splitInner(inner, idx, childKey, sibling, splitKey);
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = Search::countLess(leaf->keys, leaf->count, item.first);
+    if(pos < leaf->count && !(item.first < leaf->keys[pos])){
+        leaf->item(pos)->second = item.second;
+        return nullptr;
+    }
+    ++size_;
+    if(leaf->count < capacity_){
+        insertItem(leaf, pos, item);
+        return nullptr;
+    }
+    // split the full leaf in half, then insert into the half that owns pos
+    Leaf* right = allocate<Leaf>();
+    int keep = capacity_ / 2;
+    moveItems(right, 0, leaf, keep, capacity_ - keep);
+    right->count = capacity_ - keep;
+    leaf->count = keep;
+    right->next = leaf->next;
+    leaf->next = right;
+    if(pos <= keep){
+        insertItem(leaf, pos, item);
+    } else {
+        insertItem(right, pos - keep, item);
+    }
+    splitKey = right->keys[0];
+    return right;
+}
+
+/**
+* Splits a full inner node while adding key and child at idx. The middle
+* separator moves up to the parent through splitKey.
+*/
+template<class Key, class Value>
+typename BPlusTree<Key, Value>::NodeBase*
+BPlusTree<Key, Value>::splitInner(Inner* node, int idx, const Key& key, NodeBase* child, Key& splitKey)
+{
+    Key keys[capacity_ + 1];
+    NodeBase* children[capacity_ + 2];
+    children[0] = node->children[0];
+    for(int i = 0, j = 0; i <= capacity_; ++i){
+        if(i == idx){
+            keys[i] = key;
+            children[i + 1] = child;
+        } else {
+            keys[i] = node->keys[j];
+            children[i + 1] = node->children[j + 1];
+            ++j;
+        }
+    }
+    int mid = (capacity_ + 1) / 2;
+    Inner* right = allocate<Inner>();
+    node->count = mid;
+    for(int i = 0; i < mid; ++i){
+        node->keys[i] = keys[i];
+        node->children[i + 1] = children[i + 1];
+    }
+    right->count = capacity_ - mid;
+    right->children[0] = children[mid + 1];
+    for(int i = 0; i < right->count; ++i){
+        right->keys[i] = keys[mid + 1 + i];
+        right->children[i + 1] = children[mid + 2 + i];
+    }
+    splitKey = keys[mid];
+    return right;
+}
+
+/**
+* Removes key from the subtree at node and returns whether it was there.
+* A child left less than half full is repaired on the way back up, so node
+* itself may be left underfull for its own parent to fix.
+*/
+template<class Key, class Value>
+bool BPlusTree<Key, Value>::removeFrom(NodeBase* node, const Key& key)
+{
+    if(node->leaf){
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = Search::countLess(leaf->keys, leaf->count, key);
+        if(pos == leaf->count || key < leaf->keys[pos]){
+            return false;
+        }
+        eraseItem(leaf, pos);
+        --size_;
+        return true;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    int idx = Search::countLessEqual(inner->keys, inner->count, key);
+    NodeBase* child = inner->children[idx];
+    if(!removeFrom(child, key)){
+        return false;
+    }
+    if(child->count < minFill_){
+        if(child->leaf){
+            fixLeaf(inner, idx);
+        } else {
+            fixInner(inner, idx);
+        }
+    }
+    return true;
+}
+
+/**
+* Refills the underfull leaf parent->children[idx] with an item from a
+* sibling that can spare one, or merges it with a sibling.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::fixLeaf(Inner* parent, int idx)
+{
+    Leaf* leaf = static_cast<Leaf*>(parent->children[idx]);
+    Leaf* left = (idx > 0) ? static_cast<Leaf*>(parent->children[idx - 1]) : nullptr;
+    Leaf* right = (idx < parent->count) ? static_cast<Leaf*>(parent->children[idx + 1]) : nullptr;
+    if(left != nullptr && left->count > minFill_){
+        openGap(leaf, 0);
+        --left->count;
+        moveItems(leaf, 0, left, left->count, 1);
+        ++leaf->count;
+        parent->keys[idx - 1] = leaf->keys[0];
+        return;
+    }
+    if(right != nullptr && right->count > minFill_){
+        moveItems(leaf, leaf->count, right, 0, 1);
+        ++leaf->count;
+        moveItems(right, 0, right, 1, right->count - 1);
+        --right->count;
+        parent->keys[idx] = right->keys[0];
+        return;
+    }
+    // merge the right one of the pair into the left one
+    if(left == nullptr){
+        left = leaf;
+        leaf = right;
+        ++idx;
+    }
+    moveItems(left, left->count, leaf, 0, leaf->count);
+    left->count += leaf->count;
+    leaf->count = 0;
+    left->next = leaf->next;
+    for(int i = idx; i < parent->count; ++i){
+        parent->keys[i - 1] = parent->keys[i];
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->count;
+    destroy(leaf);
+}
+
+/**
+* Like fixLeaf for an inner child. Separators rotate through the parent
+* when borrowing, and the parent's separator joins the two halves of a
+* merge.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::fixInner(Inner* parent, int idx)
+{
+    Inner* node = static_cast<Inner*>(parent->children[idx]);
+    Inner* left = (idx > 0) ? static_cast<Inner*>(parent->children[idx - 1]) : nullptr;
+    Inner* right = (idx < parent->count) ? static_cast<Inner*>(parent->children[idx + 1]) : nullptr;
+    if(left != nullptr && left->count > minFill_){
+        node->children[node->count + 1] = node->children[node->count];
+        for(int i = node->count; i > 0; --i){
+            node->keys[i] = node->keys[i - 1];
+            node->children[i] = node->children[i - 1];
+        }
+        node->keys[0] = parent->keys[idx - 1];
+        node->children[0] = left->children[left->count];
+        ++node->count;
+        parent->keys[idx - 1] = left->keys[left->count - 1];
+        --left->count;
+        return;
+    }
+    if(right != nullptr && right->count > minFill_){
+        node->keys[node->count] = parent->keys[idx];
+        node->children[node->count + 1] = right->children[0];
+        ++node->count;
+        parent->keys[idx] = right->keys[0];
+        for(int i = 0; i < right->count - 1; ++i){
+            right->keys[i] = right->keys[i + 1];
+            right->children[i] = right->children[i + 1];
+        }
+        right->children[right->count - 1] = right->children[right->count];
+        --right->count;
+        return;
+    }
+    if(left == nullptr){
+        left = node;
+        node = right;
+        ++idx;
+    }
+    left->keys[left->count] = parent->keys[idx - 1];
+    left->children[left->count + 1] = node->children[0];
+    for(int i = 0; i < node->count; ++i){
+        left->keys[left->count + 1 + i] = node->keys[i];
+        left->children[left->count + 2 + i] = node->children[i + 1];
+    }
+    left->count += node->count + 1;
+    for(int i = idx; i < parent->count; ++i){
+        parent->keys[i - 1] = parent->keys[i];
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->count;
+    destroy(node);
+}
+
+//adds item at pos in a leaf that has room, shifting the rest right
+template<class Key, class Value>
+void BPlusTree<Key, Value>::insertItem(Leaf* leaf, int pos, const Item& item)
+{
+    openGap(leaf, pos);
+    new(leaf->item(pos)) Item(item);
+    leaf->keys[pos] = item.first;
+    ++leaf->count;
+}
+
+template<class Key, class Value>
+void BPlusTree<Key, Value>::eraseItem(Leaf* leaf, int pos)
+{
+    leaf->item(pos)->~Item();
+    moveItems(leaf, pos, leaf, pos + 1, leaf->count - pos - 1);
+    --leaf->count;
+}
+
+/**
+* Moves count items and their keys from src[from] to dst[to], leaving the
+* source slots unconstructed. Within one leaf only moves to the left are
+* allowed; openGap moves to the right. Counts are left to the caller.
+*/
+template<class Key, class Value>
+void BPlusTree<Key, Value>::moveItems(Leaf* dst, int to, Leaf* src, int from, int count)
+{
+    for(int i = 0; i < count; ++i){
+        new(dst->item(to + i)) Item(std::move(*src->item(from + i)));
+        src->item(from + i)->~Item();
+        dst->keys[to + i] = src->keys[from + i];
+    }
+}
+
+//shifts the items at pos and after one slot to the right
+template<class Key, class Value>
+void BPlusTree<Key, Value>::openGap(Leaf* leaf, int pos)
+{
+    for(int i = leaf->count; i > pos; --i){
+        new(leaf->item(i)) Item(std::move(*leaf->item(i - 1)));
+        leaf->item(i - 1)->~Item();
+        leaf->keys[i] = leaf->keys[i - 1];
+    }
+}
+
+#endif
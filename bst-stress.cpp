@@ -0,0 +1,722 @@
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <algorithm>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "concurrentavl.h"
+#include "sharedavl.h"
+#include "durableavl.h"
+#include "pagedbtree.h"
+
+using namespace std;
+
+/**
+* Builds worst-case shapes directly, one O(1) link per node, since inserting
+* n sorted keys through insert() would take O(n^2) time.
+*/
+class ChainBuilder : public BinarySearchTree<int, int>
+{
+public:
+    // keys 0..n-1 as a right-leaning chain (what sorted inserts produce)
+    void rightChain(int n)
+    {
+        clear();
+        Node<int, int>* tail = NULL;
+        for(int i = 0; i < n; ++i) {
+            Node<int, int>* node = new Node<int, int>(i, i, tail);
+            if(tail == NULL) root_ = node;
+            else tail->setRight(node);
+            tail = node;
+        }
+    }
+
+    // keys n-1..0 as a left-leaning chain
+    void leftChain(int n)
+    {
+        clear();
+        Node<int, int>* tail = NULL;
+        for(int i = n - 1; i >= 0; --i) {
+            Node<int, int>* node = new Node<int, int>(i, i, tail);
+            if(tail == NULL) root_ = node;
+            else tail->setLeft(node);
+            tail = node;
+        }
+    }
+
+    // a zig-zag path: 0, n-1, 1, n-2, ... alternating left and right links
+    void zigZag(int n)
+    {
+        clear();
+        Node<int, int>* tail = NULL;
+        int low = 0, high = n - 1;
+        for(int i = 0; i < n; ++i) {
+            int key = (i % 2 == 0) ? low++ : high--;
+            Node<int, int>* node = new Node<int, int>(key, key, tail);
+            if(tail == NULL) root_ = node;
+            else if(key < tail->getKey()) tail->setLeft(node);
+            else tail->setRight(node);
+            tail = node;
+        }
+    }
+
+    int treeHeight() const
+    {
+        return height(root_);
+    }
+};
+
+/**
+* A RedBlackTree whose structure can be checked against the red-black
+* invariants.
+*/
+class RBChecker : public RedBlackTree<int, int>
+{
+public:
+    // the number of black nodes on every root-to-leaf path, or -1 if the
+    // root is red, a red node has a red child, two paths differ, or keys
+    // or parent links are out of place
+    int blackHeight() const
+    {
+        RBNode<int, int>* root = static_cast<RBNode<int, int>*>(root_);
+        if(root != NULL && root->isRed()) return -1;
+        return blackHeight(root, NULL, NULL, NULL);
+    }
+
+private:
+    static int blackHeight(RBNode<int, int>* n, RBNode<int, int>* parent, const int* low, const int* high)
+    {
+        if(n == NULL) return 0;
+        if(n->getParent() != parent) return -1;
+        if((low != NULL && !(*low < n->getKey())) || (high != NULL && !(n->getKey() < *high))) return -1;
+        RBNode<int, int>* left = n->getLeft();
+        RBNode<int, int>* right = n->getRight();
+        if(n->isRed() && ((left != NULL && left->isRed()) || (right != NULL && right->isRed()))) return -1;
+        int hl = blackHeight(left, n, low, &n->getKey());
+        int hr = blackHeight(right, n, &n->getKey(), high);
+        if(hl < 0 || hl != hr) return -1;
+        return hl + (n->isRed() ? 0 : 1);
+    }
+};
+
+static double secondsSince(clock_t start)
+{
+    return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static bool checkShape(const char* name, ChainBuilder& tree, int n)
+{
+    clock_t start = clock();
+    int h = tree.treeHeight();
+    bool balanced = tree.isBalanced();
+    int count = 0;
+    tree.visit_inorder([&count](std::pair<const int, int>&) { ++count; });
+    bool ok = (h == n) && (balanced == (n <= 2)) && (count == n);
+    cout << name << ": height " << h << ", " << (balanced ? "balanced" : "unbalanced")
+         << ", " << count << " items (" << secondsSince(start) << "s)";
+    start = clock();
+    tree.clear();
+    cout << ", cleared in " << secondsSince(start) << "s" << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+/**
+* The final contents must be in key order and match expected, and the
+* height must be within the AVL bound of 1.44 log2(n + 2).
+*/
+static bool checkConcurrentTree(ConcurrentAVLTree<int, int>& tree, const std::vector<int>& expected)
+{
+    bool ok = true;
+    size_t count = 0;
+    int last = -1;
+    tree.for_each([&](const std::pair<const int&, const int&>& item) {
+        if(item.first <= last || item.first >= (int)expected.size()
+           || expected[item.first] != item.second) {
+            ok = false;
+        }
+        last = item.first;
+        ++count;
+    });
+    size_t live = 0;
+    for(size_t i = 0; i < expected.size(); ++i) {
+        if(expected[i] >= 0) ++live;
+    }
+    int h = tree.height();
+    ok = ok && count == live && h <= 1.44 * log2(live + 2.0);
+    cout << ", " << count << " items, height " << h;
+    return ok;
+}
+
+/**
+* Every thread inserts, overwrites and removes keys only it owns, checking
+* each result against its own record, so any lost or phantom update shows.
+*/
+static bool concurrentOwnership(int threads, int n)
+{
+    ConcurrentAVLTree<int, int> tree;
+    std::vector<int> expected(n, -1);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> workers;
+    clock_t start = clock();
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            std::mt19937 rng(7 + t);
+            for(int i = 0; i < 4 * n; ++i) {
+                int key = (rng() % (n / threads)) * threads + t;
+                int op = rng() % 4;
+                int value = 0;
+                if(op == 0) {
+                    if(tree.remove(key) != (expected[key] >= 0)) ok = false;
+                    expected[key] = -1;
+                } else if(op == 1) {
+                    bool found = tree.find(key, value);
+                    if(found != (expected[key] >= 0) || (found && value != expected[key])) ok = false;
+                } else {
+                    tree.insert(std::make_pair(key, i));
+                    expected[key] = i;
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    cout << "disjoint updates, " << threads << " threads (" << secondsSince(start) << "s)";
+    bool good = checkConcurrentTree(tree, expected) && ok;
+    cout << (good ? "" : "  FAILED") << endl;
+    return good;
+}
+
+/**
+* All threads race insertIfAbsent on the same keys. Exactly one must win
+* each key, and the value stored must be the winner's.
+*/
+static bool concurrentInsertRace(int threads, int n)
+{
+    ConcurrentAVLTree<int, int> tree;
+    std::vector<std::atomic<int> > wins(n);
+    std::vector<int> expected(n, -1);
+    for(int i = 0; i < n; ++i) {
+        wins[i] = 0;
+    }
+    std::vector<std::thread> workers;
+    clock_t start = clock();
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            for(int i = 0; i < n; ++i) {
+                int key = (t % 2 == 0) ? i : n - 1 - i;
+                if(tree.insertIfAbsent(std::make_pair(key, t))) {
+                    wins[key]++;
+                    expected[key] = t;
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    bool ok = true;
+    for(int i = 0; i < n; ++i) {
+        if(wins[i] != 1) ok = false;
+    }
+    cout << "insertIfAbsent race, " << threads << " threads (" << secondsSince(start) << "s)";
+    ok = checkConcurrentTree(tree, expected) && ok;
+    cout << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+/**
+* One writer raises the value of every key in rounds while readers check
+* that no value they read ever goes down, and that no key goes missing
+* while rotations move it around.
+*/
+static bool concurrentMonotonic(int readers, int n)
+{
+    ConcurrentAVLTree<int, int> tree;
+    for(int i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(i, 0));
+    }
+    const int rounds = 4;
+    std::atomic<bool> done(false);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> workers;
+    clock_t start = clock();
+    for(int t = 0; t < readers; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            std::vector<int> seen(n, 0);
+            std::mt19937 rng(11 + t);
+            while(!done) {
+                int key = rng() % n;
+                int value = 0;
+                if(!tree.find(key, value) || value < seen[key]) ok = false;
+                seen[key] = value;
+            }
+        }));
+    }
+    for(int r = 1; r <= rounds; ++r) {
+        for(int i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(i, r));
+            // churn neighbouring keys so that the tree keeps rotating
+            tree.insert(std::make_pair(n + i, r));
+            if(i > 0) tree.remove(n + i - 1);
+        }
+    }
+    done = true;
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    tree.remove(2 * n - 1);
+    cout << "monotonic reads, 1 writer, " << readers << " readers (" << secondsSince(start) << "s)";
+    std::vector<int> expected(n, rounds);
+    bool good = checkConcurrentTree(tree, expected) && ok;
+    cout << (good ? "" : "  FAILED") << endl;
+    return good;
+}
+
+/**
+* The concurrentMonotonic check across processes: forked readers map the
+* writer's shared tree by name and must never see a value go down or a
+* key go missing. A small anonymous shared mapping carries the stop flag
+* and the failure count.
+*/
+static bool sharedMonotonic(int readers, int n)
+{
+    const std::string name = "/bst-stress-" + std::to_string(getpid());
+    SharedAVLTree<int, int>::unlink(name);
+    SharedAVLTree<int, int> tree(name, 2 * n);
+    for(int i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(i, 0));
+    }
+    void* flags = mmap(NULL, 2 * sizeof(std::atomic<int>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    std::atomic<int>* done = new (flags) std::atomic<int>(0);
+    std::atomic<int>* failures = new (done + 1) std::atomic<int>(0);
+    const int rounds = 4;
+    clock_t start = clock();
+    std::vector<pid_t> children;
+    for(int t = 0; t < readers; ++t) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            bool good = true;
+            {
+                SharedAVLTree<int, int> view(name);
+                std::vector<int> seen(n, 0);
+                std::mt19937 rng(11 + t);
+                while(!*done) {
+                    int key = rng() % n;
+                    int value = 0;
+                    if(!view.find(key, value) || value < seen[key] || value > rounds) good = false;
+                    seen[key] = value;
+                }
+            }
+            if(!good) ++*failures;
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for(int r = 1; r <= rounds; ++r) {
+        for(int i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(i, r));
+            tree.insert(std::make_pair(n + i, r));
+            if(i > 0) tree.remove(n + i - 1);
+        }
+    }
+    *done = 1;
+    bool ok = true;
+    for(size_t t = 0; t < children.size(); ++t) {
+        int status = 0;
+        if(waitpid(children[t], &status, 0) != children[t] || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+    ok = ok && *failures == 0;
+    tree.remove(2 * n - 1);
+    size_t count = 0;
+    int last = -1;
+    tree.for_each([&](const std::pair<int, int>& item) {
+        if(item.first <= last || item.first >= n || item.second != rounds) ok = false;
+        last = item.first;
+        ++count;
+    });
+    ok = ok && count == (size_t)n && tree.size() == (size_t)n;
+    munmap(flags, 2 * sizeof(std::atomic<int>));
+    SharedAVLTree<int, int>::unlink(name);
+    cout << "shared monotonic reads, 1 writer, " << readers << " reader processes (" << secondsSince(start)
+         << "s), " << count << " items" << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+//update i of the crash test: an insert, or every fifth one a remove
+static bool durableOp(long i, int& key, long& value)
+{
+    key = static_cast<int>((i * 7919) % 1000);
+    value = i;
+    return i % 5 != 4;
+}
+
+static void removeDurableDir(const std::string& dir)
+{
+    remove((dir + "/wal.log").c_str());
+    remove((dir + "/wal.log.tmp").c_str());
+    remove((dir + "/checkpoint.snap").c_str());
+    remove((dir + "/checkpoint.snap.tmp").c_str());
+    rmdir(dir.c_str());
+}
+
+/**
+* A child process makes numbered updates to a DurableAVLTree, recording in
+* shared memory the last one that returned, until it is killed at a random
+* moment. The reopened tree must hold exactly the first m updates, where m
+* counts every acknowledged update and at most the one in flight. Small
+* automatic checkpoints make the kills land in checkpoints as well.
+*/
+static bool durableCrash(int crashes)
+{
+    const std::string dir = "bst-stress.wal";
+    removeDurableDir(dir);
+    volatile long* acked = static_cast<volatile long*>(mmap(NULL, sizeof(long), PROT_READ | PROT_WRITE,
+                                                            MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    std::mt19937 rng(17);
+    long done = 0;
+    size_t replayed = 0;
+    bool ok = true;
+    clock_t start = clock();
+    for(int c = 0; c < crashes && ok; ++c) {
+        *acked = done - 1;
+        pid_t pid = fork();
+        if(pid == 0) {
+            DurableAVLTree<int, long> tree(dir, true, 4096);
+            for(long i = done; ; ++i) {
+                int key;
+                long value;
+                if(durableOp(i, key, value)) tree.insert(std::make_pair(key, value));
+                else tree.remove(key);
+                *acked = i;
+            }
+        }
+        usleep(50000 + rng() % 150000);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+
+        DurableAVLTree<int, long> tree(dir);
+        replayed += tree.replayed();
+        std::vector<std::pair<int, long> > items;
+        tree.for_each([&items](const std::pair<const int, long>& item) { items.push_back(item); });
+        bool matched = false;
+        for(long m = *acked + 1; m <= *acked + 2 && !matched; ++m) {
+            std::map<int, long> expected;
+            for(long i = 0; i < m; ++i) {
+                int key;
+                long value;
+                if(durableOp(i, key, value)) expected[key] = value;
+                else expected.erase(key);
+            }
+            std::vector<std::pair<int, long> > want(expected.begin(), expected.end());
+            if(items == want) {
+                matched = true;
+                done = m;
+            }
+        }
+        ok = matched;
+    }
+    munmap(const_cast<long*>(acked), sizeof(long));
+    removeDurableDir(dir);
+    cout << "durable tree, " << crashes << " crashes, " << done << " updates, " << replayed
+         << " records replayed (" << secondsSince(start) << "s)" << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+/**
+* A child process overwrites or removes, without waiting for commits,
+* every key it had synced before, then checkpoints and is killed between
+* saving the checkpoint and replacing the log. A directory in the way of
+* the new log makes the second step fail at that point. The reopened tree
+* must hold the child's last updates, not the older ones in the log.
+*/
+static bool durableCheckpointCrash(int keys)
+{
+    const std::string dir = "bst-stress.wal";
+    removeDurableDir(dir);
+    clock_t start = clock();
+    pid_t pid = fork();
+    if(pid == 0) {
+        DurableAVLTree<int, long> tree(dir, false, 0);
+        for(int k = 0; k < keys; ++k) tree.insert(std::make_pair(k, 1L));
+        tree.sync();
+        mkdir((dir + "/wal.log.tmp").c_str(), 0755);
+        for(int k = 0; k < keys; ++k) {
+            if(k % 2 == 0) tree.remove(k);
+            else tree.insert(std::make_pair(k, 2L));
+        }
+        try {
+            tree.checkpoint();
+        } catch(const std::runtime_error&) {
+            kill(getpid(), SIGKILL);
+        }
+        _exit(1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bool ok = WIFSIGNALED(status) && access((dir + "/checkpoint.snap").c_str(), F_OK) == 0;
+    rmdir((dir + "/wal.log.tmp").c_str());
+    size_t replayed = 0;
+    if(ok) {
+        DurableAVLTree<int, long> tree(dir);
+        replayed = tree.replayed();
+        std::vector<std::pair<int, long> > items;
+        tree.for_each([&items](const std::pair<const int, long>& item) { items.push_back(item); });
+        std::vector<std::pair<int, long> > want;
+        for(int k = 1; k < keys; k += 2) want.push_back(std::make_pair(k, 2L));
+        ok = items == want;
+    }
+    removeDurableDir(dir);
+    cout << "durable tree, killed between checkpoint and log reset, " << replayed
+         << " records replayed on top (" << secondsSince(start) << "s)" << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+/**
+* Random inserts and removes on a PagedBPlusTree with the smallest pool,
+* so nearly every step evicts pages, checked against std::map with full
+* scans and lookups. The tree is closed and reopened from its file every
+* so often, and it is emptied at the end, which must shrink it to no
+* levels. Runs alternate between growing and shrinking to exercise splits
+* and merges at every level.
+*/
+static bool pagedAgainstMap(int keys, int ops)
+{
+    const std::string path = "bst-stress.pages";
+    remove(path.c_str());
+    std::map<int, long> expected;
+    std::mt19937 rng(23);
+    bool ok = true;
+    int maxHeight = 0;
+    clock_t start = clock();
+    PagedBPlusTree<int, long>* tree = new PagedBPlusTree<int, long>(path, 16);
+    for(int i = 0; i < ops && ok; ++i) {
+        int key = static_cast<int>(rng() % keys);
+        bool growing = (i / (ops / 8)) % 2 == 0;
+        if(rng() % 10 < (growing ? 7u : 3u)) {
+            tree->insert(std::make_pair(key, long(i)));
+            expected[key] = i;
+        } else {
+            tree->remove(key);
+            expected.erase(key);
+        }
+        maxHeight = std::max(maxHeight, tree->height());
+        if(i % 20000 == 19999) {
+            std::vector<std::pair<int, long> > items;
+            tree->visit_range(0, keys, [&items](const std::pair<const int, long>& item) { items.push_back(item); });
+            ok = tree->size() == expected.size()
+                && items == std::vector<std::pair<int, long> >(expected.begin(), expected.end());
+            for(int j = 0; j < 100 && ok; ++j) {
+                long value = -1;
+                int probe = static_cast<int>(rng() % keys);
+                std::map<int, long>::iterator it = expected.find(probe);
+                ok = tree->find(probe, value) == (it != expected.end()) && (it == expected.end() || it->second == value);
+            }
+        }
+        if(i % 100000 == 99999) {
+            delete tree;
+            tree = new PagedBPlusTree<int, long>(path, 16 + rng() % 16);
+        }
+    }
+    for(std::map<int, long>::iterator it = expected.begin(); it != expected.end() && ok; ++it) {
+        tree->remove(it->first);
+    }
+    ok = ok && tree->empty() && tree->height() == 0;
+    cout << "paged B+tree, " << ops << " updates on " << keys << " keys, " << maxHeight << " levels, "
+         << tree->pages() << " pages through 16 frames (" << secondsSince(start) << "s)"
+         << (ok ? "" : "  FAILED") << endl;
+    delete tree;
+    remove(path.c_str());
+    return ok;
+}
+
+/**
+* Random inserts and removes on a RedBlackTree, in phases that grow and
+* shrink it, checked every few hundred steps for the red-black invariants,
+* the 2 log2(n + 1) height bound and the same items as std::map.
+*/
+static bool redBlackInvariants(int keys, int ops)
+{
+    RBChecker tree;
+    std::map<int, int> expected;
+    std::mt19937 rng(29);
+    bool ok = true;
+    int checks = 0;
+    clock_t start = clock();
+    for(int i = 0; i < ops && ok; ++i) {
+        int key = static_cast<int>(rng() % keys);
+        bool growing = (i / (ops / 6)) % 2 == 0;
+        if(rng() % 10 < (growing ? 7u : 3u)) {
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        } else {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        if(i % 500 == 499 || i == ops - 1) {
+            ++checks;
+            std::vector<std::pair<int, int> > items;
+            tree.visit_inorder([&items](std::pair<const int, int>& item) { items.push_back(item); });
+            ok = tree.blackHeight() >= 0
+                && tree.stats().height <= 2 * log2(expected.size() + 1.0)
+                && items == std::vector<std::pair<int, int> >(expected.begin(), expected.end());
+        }
+    }
+    cout << "red-black tree, " << ops << " updates on " << keys << " keys, invariants held at " << checks
+         << " checks, black height " << tree.blackHeight() << " (" << secondsSince(start) << "s)"
+         << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+/**
+* Whether tree holds exactly the items of expected, in order, is an AVL
+* tree unless it is relaxed, and agrees with it on probes lookups of keys in [0, keys), present
+* or not.
+*/
+static bool avlMatches(AVLTree<int, int>& tree, const std::map<int, int>& expected,
+                       int keys, int probes, std::mt19937& rng)
+{
+    std::vector<std::pair<int, int> > items;
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        items.push_back(*it);
+    }
+    if(items != std::vector<std::pair<int, int> >(expected.begin(), expected.end())
+       || !(tree.isRelaxed() || tree.isBalanced())) {
+        return false;
+    }
+    for(int j = 0; j < probes; ++j) {
+        int key = static_cast<int>(rng() % keys);
+        std::map<int, int>::const_iterator it = expected.find(key);
+        AVLTree<int, int>::iterator found = tree.find(key);
+        if((found != tree.end()) != (it != expected.end()) || (found != tree.end() && found->second != it->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Random inserts, overwrites, removes and lookups on an AVLTree with one of
+* its lookup side structures turned on by setup, checked against std::map
+* after every lookup and in full every few hundred steps. Every so often the
+* tree is split and joined back, copied (and the source changed behind the
+* copy's back), moved, cleared or switched into and out of relaxed mode, so
+* each path that replaces nodes in bulk must leave the side structure in
+* step with the tree.
+*/
+template<typename Setup>
+static bool avlAgainstMap(const char* feature, Setup setup, int keys, int ops)
+{
+    AVLTree<int, int> tree;
+    setup(tree);
+    std::map<int, int> expected;
+    std::mt19937 rng(31);
+    bool ok = true;
+    clock_t start = clock();
+    for(int i = 0; i < ops && ok; ++i) {
+        int key = static_cast<int>(rng() % keys);
+        unsigned kind = rng() % 10;
+        if(kind < 4) {
+            tree.insert(std::make_pair(key, i));
+            expected[key] = i;
+        } else if(kind < 6) {
+            tree.remove(key);
+            expected.erase(key);
+        } else {
+            std::map<int, int>::iterator it = expected.find(key);
+            AVLTree<int, int>::iterator found = tree.find(key);
+            ok = (found != tree.end()) == (it != expected.end())
+                && (found == tree.end() || (found->second == it->second && tree[key] == it->second));
+        }
+        if(i % 997 == 996) {
+            AVLTree<int, int> left, right;
+            setup(left);
+            setup(right);
+            int pivot = static_cast<int>(rng() % keys);
+            tree.split(pivot, left, right);
+            ok = ok && tree.empty()
+                && avlMatches(left, std::map<int, int>(expected.begin(), expected.lower_bound(pivot)), keys, 100, rng)
+                && avlMatches(right, std::map<int, int>(expected.lower_bound(pivot), expected.end()), keys, 100, rng);
+            tree.join(left, right);
+        }
+        if(i % 2503 == 2502) {
+            AVLTree<int, int> copy(tree);
+            for(int j = 0; j < 50; ++j) {
+                tree.remove(static_cast<int>(rng() % keys));
+            }
+            ok = ok && avlMatches(copy, expected, keys, 200, rng);
+            tree = std::move(copy);
+        }
+        if(i % 9973 == 9972) {
+            tree.setRelaxed(!tree.isRelaxed(), 16);
+        }
+        if(i % 49999 == 49998) {
+            tree.clear();
+            expected.clear();
+        }
+        if(i % 500 == 499) {
+            ok = ok && avlMatches(tree, expected, keys, 200, rng);
+        }
+    }
+    ok = ok && avlMatches(tree, expected, keys, 1000, rng);
+    cout << "AVL tree with " << feature << ", " << ops << " updates and lookups on " << keys
+         << " keys (" << secondsSince(start) << "s)" << (ok ? "" : "  FAILED") << endl;
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    int n = 10000000;
+    if(argc > 1) {
+        n = atoi(argv[1]);
+    }
+    cout << "Degenerate trees of " << n << " nodes" << endl;
+
+    bool ok = true;
+    ChainBuilder tree;
+    tree.rightChain(n);
+    ok = checkShape("right chain", tree, n) && ok;
+    tree.leftChain(n);
+    ok = checkShape("left chain ", tree, n) && ok;
+    tree.zigZag(n);
+    ok = checkShape("zig-zag    ", tree, n) && ok;
+
+    // the destructor must cope with a chain as well
+    {
+        ChainBuilder doomed;
+        doomed.rightChain(n);
+    }
+    cout << "destroyed a " << n << " node chain" << endl;
+
+    ok = redBlackInvariants(5000, 300000) && ok;
+    ok = avlAgainstMap("lookup cache", [](AVLTree<int, int>& t) { t.setLookupCache(256); }, 20000, 300000) && ok;
+    ok = avlAgainstMap("hash index", [](AVLTree<int, int>& t) { t.setHashIndex(true); }, 20000, 300000) && ok;
+    ok = avlAgainstMap("membership filter", [](AVLTree<int, int>& t) { t.setMembershipFilter(1000); }, 20000, 300000) && ok;
+
+    int threads = std::max(4u, std::thread::hardware_concurrency());
+    int keys = std::max(threads, std::min(n, 50000));
+    cout << "Concurrent AVL tree, " << keys << " keys" << endl;
+    ok = concurrentOwnership(threads, keys) && ok;
+    ok = concurrentInsertRace(threads, keys) && ok;
+    ok = concurrentMonotonic(threads - 1, keys) && ok;
+    ok = sharedMonotonic(threads - 1, keys) && ok;
+    ok = durableCrash(5) && ok;
+    ok = durableCheckpointCrash(2000) && ok;
+    ok = pagedAgainstMap(std::max(keys, 200000), 400000) && ok;
+
+    cout << (ok ? "PASSED" : "FAILED") << endl;
+    return ok ? 0 : 1;
+}
@@ -1,10 +1,47 @@
 #include <iostream>
 #include <map>
+#include <cstdio>
+#include <vector>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "bst.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "persistentbst.h"
+#include "shardedmap.h"
+#include "concurrentavl.h"
+#include "sharedavl.h"
+#include "durableavl.h"
+#include "pagedbtree.h"
+#include "bplustree.h"
+#include <thread>
 
 using namespace std;
 
+// a value that counts its live instances and whose copies start throwing
+// once copiesLeft runs out, for the copy demo
+struct Fragile
+{
+    static int live;
+    static int copiesLeft;
+    int v;
+    Fragile(int x = 0) : v(x) { ++live; }
+    Fragile(const Fragile& other) : v(other.v)
+    {
+        if(copiesLeft-- == 0) throw std::runtime_error("copy failed");
+        ++live;
+    }
+    ~Fragile() { --live; }
+};
+int Fragile::live = 0;
+int Fragile::copiesLeft = -1;
+
+ostream& operator<<(ostream& out, const Fragile& f)
+{
+    return out << f.v;
+}
 
 int main(int argc, char *argv[])
 {
@@ -43,5 +80,374 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // AVL split/join tests
+    AVLTree<int,int> whole, low, high;
+    for(int i = 0; i < 10; ++i) {
+        whole.insert(std::make_pair(i, i*i));
+    }
+    whole.split(5, low, high);
+    cout << "\nSplit at 5:" << endl;
+    cout << "low  (" << (low.isBalanced() ? "balanced" : "unbalanced") << "):";
+    for(AVLTree<int,int>::iterator it = low.begin(); it != low.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << "\nhigh (" << (high.isBalanced() ? "balanced" : "unbalanced") << "):";
+    for(AVLTree<int,int>::iterator it = high.begin(); it != high.end(); ++it) {
+        cout << " " << it->first;
+    }
+    whole.join(low, high);
+    cout << "\nJoined back:";
+    for(AVLTree<int,int>::iterator it = whole.begin(); it != whole.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    try {
+        whole.split(5, low, low);
+    } catch(const std::invalid_argument&) {
+        cout << "split into one tree twice: rejected, " << (whole.find(9) != whole.end() ? "tree intact" : "items lost") << endl;
+    }
+
+    // AVL set operation tests
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i < 20; i += 2) evens.insert(std::make_pair(i, 1));
+    for(int i = 0; i < 20; i += 3) threes.insert(std::make_pair(i, 10));
+    AVLTree<int,int> both, onlyEvens, copyOfThrees;
+    for(AVLTree<int,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        both.insert(*it);
+        onlyEvens.insert(*it);
+    }
+    for(AVLTree<int,int>::iterator it = threes.begin(); it != threes.end(); ++it) {
+        copyOfThrees.insert(*it);
+    }
+    evens.unionWith(threes, [](const int& a, const int& b) { return a + b; });
+    cout << "\nUnion (summed values):";
+    for(AVLTree<int,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    both.intersectWith(copyOfThrees);
+    cout << "\nIntersection:";
+    for(AVLTree<int,int>::iterator it = both.begin(); it != both.end(); ++it) {
+        cout << " " << it->first;
+    }
+    AVLTree<int,int> multiplesOfThree;
+    for(int i = 0; i < 20; i += 3) multiplesOfThree.insert(std::make_pair(i, 0));
+    onlyEvens.differenceWith(multiplesOfThree);
+    cout << "\nDifference:";
+    for(AVLTree<int,int>::iterator it = onlyEvens.begin(); it != onlyEvens.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Parallel traversal tests
+    long long total = onlyEvens.parallel_reduce(0LL,
+        [](const std::pair<const int,int>& item) { return (long long)item.first; },
+        [](long long a, long long b) { return a + b; });
+    cout << "\nSum of keys left after difference: " << total << endl;
+    onlyEvens.parallel_for_each([](std::pair<const int,int>& item) { item.second = item.first * 2; });
+    cout << "Values after parallel_for_each:";
+    for(AVLTree<int,int>::iterator it = onlyEvens.begin(); it != onlyEvens.end(); ++it) {
+        cout << " " << it->second;
+    }
+    cout << endl;
+
+    // Bulk construction tests
+    std::vector<std::pair<int,int> > dump;
+    for(int i = 0; i < 10; ++i) {
+        dump.push_back(std::make_pair((i * 7) % 5, i));
+    }
+    AVLTree<int,int> bulk;
+    bulk.build_parallel(dump.begin(), dump.end());
+    cout << "\nBulk built (" << (bulk.isBalanced() ? "balanced" : "unbalanced") << "):";
+    for(AVLTree<int,int>::iterator it = bulk.begin(); it != bulk.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << endl;
+
+    // Internal traversal tests
+    cout << "\nvisit_range(1, 3):";
+    bulk.visit_range(1, 3, [](std::pair<const int,int>& item) { cout << " " << item.first; });
+    int visited = 0;
+    bulk.visit_inorder([&visited](std::pair<const int,int>&) { ++visited; });
+    cout << "\nvisit_inorder saw " << visited << " items" << endl;
+
+    // Structural diagnostics tests
+    TreeStats st = whole.stats();
+    cout << "\nstats: height " << st.height << ", " << st.nodeCount << " nodes, average depth "
+         << st.averageDepth << ", max depth " << st.maxDepth
+         << (st.balanced ? ", balanced" : ", unbalanced")
+         << (st.storedBalanceValid ? ", balance factors ok" : ", balance factors wrong") << endl;
+    cout << "balance histogram:";
+    for(std::map<int, size_t>::iterator it = st.balanceHistogram.begin(); it != st.balanceHistogram.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << endl;
+
+    // Self-healing BST tests
+    BinarySearchTree<int,int> plain, healing;
+    healing.setSelfHealing(2.0);
+    for(int i = 0; i < 1000; ++i) {
+        plain.insert(std::make_pair(i, i));
+        healing.insert(std::make_pair(i, i));
+    }
+    cout << "\nSorted inserts: plain height " << plain.stats().height
+         << ", self-healing height " << healing.stats().height << endl;
+
+    // Red-black tree tests
+    RedBlackTree<int,int> rb;
+    for(int i = 0; i < 100; ++i) {
+        rb.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 100; i += 3) {
+        rb.remove(i);
+    }
+    cout << "\nRedBlackTree after 100 inserts and 34 removes: height " << rb.stats().height
+         << ", first key " << rb.begin()->first << endl;
+
+    // Splay tree tests
+    SplayTree<int,int> splay;
+    for(int i = 0; i < 100; ++i) {
+        splay.insert(std::make_pair(i, i));
+    }
+    splay.find(42);
+    splay.remove(10);
+    cout << "\nSplayTree: 42 " << (splay.find(42) != splay.end() ? "found" : "missing")
+         << ", 10 " << (splay.find(10) != splay.end() ? "found" : "missing")
+         << ", height " << splay.stats().height << endl;
+
+    // Relaxed AVL tests
+    AVLTree<int,int> relaxed;
+    relaxed.setRelaxed(true, 1000);
+    for(int i = 0; i < 1000; ++i) {
+        relaxed.insert(std::make_pair(i, i));
+    }
+    cout << "\nRelaxed AVL after 1000 sorted inserts: height " << relaxed.stats().height
+         << ", " << relaxed.pendingRebalance() << " pending";
+    relaxed.rebalance();
+    cout << "; after rebalance(): height " << relaxed.stats().height
+         << (relaxed.isBalanced() ? ", balanced" : ", unbalanced") << endl;
+
+    // Persistent AVL tests
+    PersistentAVLTree<int,int> current;
+    for(int i = 0; i < 10; ++i) {
+        current.insert(std::make_pair(i, i));
+    }
+    PersistentAVLTree<int,int> before = current.snapshot();
+    current.remove(3);
+    current.insert(std::make_pair(5, 50));
+    cout << "\nPersistent snapshot:";
+    for(PersistentAVLTree<int,int>::iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << "\nPersistent current: ";
+    for(PersistentAVLTree<int,int>::iterator it = current.begin(); it != current.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << endl;
+
+    // Sharded map tests
+    std::vector<int> sample;
+    for(int i = 0; i < 100; ++i) {
+        sample.push_back(i);
+    }
+    ShardedAVLMap<int,int> sharded(ShardedAVLMap<int,int>::pickSplitters(sample.begin(), sample.end(), 4));
+    for(int i = 0; i < 100; i += 7) {
+        sharded.insert(std::make_pair(i, i * i));
+    }
+    sharded.update(49, [](int& v) { v = -1; });
+    int found49 = 0;
+    sharded.find(49, found49);
+    cout << "\nShardedAVLMap (" << sharded.shardCount() << " shards), 49 -> " << found49 << ", keys in [20, 60]:";
+    sharded.visit_range(20, 60, [](const std::pair<const int,int>& item) { cout << " " << item.first; });
+    cout << endl;
+
+    // Concurrent AVL tests
+    ConcurrentAVLTree<int,int> shared;
+    std::vector<std::thread> writers;
+    for(int t = 0; t < 4; ++t) {
+        writers.push_back(std::thread([&shared, t]() {
+            for(int i = t; i < 1000; i += 4) {
+                shared.insert(std::make_pair(i, t));
+            }
+            for(int i = t; i < 1000; i += 8) {
+                shared.remove(i);
+            }
+        }));
+    }
+    for(size_t t = 0; t < writers.size(); ++t) {
+        writers[t].join();
+    }
+    int count = 0;
+    shared.for_each([&count](const std::pair<const int&, const int&>&) { ++count; });
+    cout << "ConcurrentAVLTree after 4 writers: " << count << " keys, height " << shared.height()
+         << ", insertIfAbsent(0) " << (shared.insertIfAbsent(std::make_pair(0, 0)) ? "added" : "kept")
+         << ", insertIfAbsent(4) " << (shared.insertIfAbsent(std::make_pair(4, 0)) ? "added" : "kept") << endl;
+
+    // B+tree tests
+    BPlusTree<int,int> bplus;
+    for(int i = 0; i < 200; ++i) {
+        bplus.insert(std::make_pair((i * 37) % 200, i));
+    }
+    for(int i = 0; i < 200; i += 3) {
+        bplus.remove(i);
+    }
+    int inOrder = 0, lastKey = -1;
+    for(BPlusTree<int,int>::iterator it = bplus.begin(); it != bplus.end(); ++it) {
+        if(it->first > lastKey) ++inOrder;
+        lastKey = it->first;
+    }
+    cout << "BPlusTree: " << bplus.size() << " keys (" << inOrder << " in order), " << bplus.height()
+         << " levels, bplus[100] = " << bplus[100] << ", keys in [50, 60]:";
+    bplus.visit_range(50, 60, [](std::pair<const int,int>& item) { cout << " " << item.first; });
+    cout << endl;
+
+    // Frozen snapshot tests
+    AVLTree<int,int> source;
+    for(int i = 0; i < 20; ++i) {
+        source.insert(std::make_pair(i * 5, i));
+    }
+    FrozenTree<int,int> frozen = source.freeze();
+    source.remove(50);
+    cout << "FrozenTree (" << frozen.size() << " keys): frozen[50] = " << frozen[50]
+         << ", lower_bound(42) -> " << frozen.lower_bound(42)->first << ", in order:";
+    for(FrozenTree<int,int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Batched lookup tests
+    std::vector<int> wanted;
+    wanted.push_back(35);
+    wanted.push_back(3);
+    wanted.push_back(90);
+    wanted.push_back(-1);
+    std::vector<AVLTree<int,int>::iterator> hits;
+    source.find_batch(wanted, hits);
+    cout << "find_batch:";
+    for(size_t i = 0; i < wanted.size(); ++i) {
+        cout << " " << wanted[i] << (hits[i] == source.end() ? "(missing)" : "(found)");
+    }
+    cout << endl;
+
+    // Hot-key lookup cache
+    source.setLookupCache(64);
+    for(int round = 0; round < 3; ++round) {
+        source.find(10);
+        source.find(45);
+    }
+    source.remove(45);
+    cout << "cached find after remove(45): " << (source.find(45) == source.end() ? "missing" : "found") << endl;
+    cout << "cache hits " << source.cacheHits() << ", misses " << source.cacheMisses() << endl;
+
+    // Hash side-index
+    source.setHashIndex(true);
+    source.insert(std::make_pair(12, 120));
+    source.remove(15);
+    source[12] += 1;
+    cout << "hash index: 12 -> " << source[12] << ", 15 " << (source.find(15) == source.end() ? "missing" : "found")
+         << ", in order:";
+    for(AVLTree<int,int>::iterator it = source.begin(); it != source.end() && it->first <= 20; ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Membership filter
+    source.setMembershipFilter(100);
+    size_t present = 0;
+    for(int k = 0; k < 100; ++k) {
+        if(source.find(k) != source.end()) ++present;
+    }
+    cout << "filter: " << present << " of 100 keys present, " << source.filterRejects()
+         << " lookups rejected by the filter" << endl;
+
+    // Copy and move
+    AVLTree<int,int> copy(source);
+    copy.insert(std::make_pair(1, 1));
+    AVLTree<int,int> moved(std::move(copy));
+    cout << "copy: source has 1 " << (source.find(1) == source.end() ? "no" : "yes")
+         << ", moved copy has 1 " << (moved.find(1) == moved.end() ? "no" : "yes")
+         << ", moved-from is " << (copy.empty() ? "empty" : "not empty") << endl;
+    {
+        AVLTree<int,Fragile> fragile;
+        for(int k = 0; k < 50; ++k) fragile.insert(std::make_pair(k, Fragile(k)));
+        int before = Fragile::live;
+        Fragile::copiesLeft = 20;
+        try {
+            AVLTree<int,Fragile> partial(fragile);
+            cout << "throwing copy: not thrown" << endl;
+        } catch(const std::runtime_error&) {
+            cout << "throwing copy: rejected, " << Fragile::live - before << " values leaked" << endl;
+        }
+        Fragile::copiesLeft = -1;
+    }
+
+    // Binary snapshots
+    moved.save("bst-test.snap");
+    AVLTree<int,int> restored;
+    restored.load("bst-test.snap");
+    SnapshotView<int,int> view("bst-test.snap");
+    cout << "snapshot: " << view.size() << " items, restored[1] = " << restored[1]
+         << ", view[20] = " << view[20] << ", balanced " << restored.isBalanced() << endl;
+    std::remove("bst-test.snap");
+    mkdir("bst-test.snap", 0755); //a directory in the way makes the rename fail
+    try {
+        moved.save("bst-test.snap");
+        cout << "snapshot over a directory: not rejected" << endl;
+    } catch(const std::runtime_error&) {
+        cout << "snapshot over a directory: rejected, temporary file "
+             << (access("bst-test.snap.tmp", F_OK) == 0 ? "left behind" : "removed") << endl;
+    }
+    std::remove("bst-test.snap.tmp");
+    rmdir("bst-test.snap");
+
+    // Shared-memory tree; a second mapping stands in for another process
+    SharedAVLTree<int,int>::unlink("/bst-test");
+    SharedAVLTree<int,int> segment("/bst-test", 64);
+    moved.visit_inorder([&segment](const std::pair<const int,int>& item) { segment.insert(item); });
+    segment.remove(1);
+    SharedAVLTree<int,int> attached("/bst-test");
+    int sharedValue = 0;
+    attached.find(20, sharedValue);
+    cout << "shared: " << attached.size() << " items, 20 -> " << sharedValue << ", 1 "
+         << (attached.contains(1) ? "found" : "missing") << endl;
+    SharedAVLTree<int,int>::unlink("/bst-test");
+
+    // Write-ahead log: updates survive closing the tree without a checkpoint
+    {
+        DurableAVLTree<int,int> durable("bst-test.wal");
+        durable.insert(std::make_pair(7, 70));
+        durable.insert(std::make_pair(8, 80));
+        durable.remove(7);
+    }
+    {
+        DurableAVLTree<int,int> reopened("bst-test.wal");
+        int durableValue = 0;
+        reopened.find(8, durableValue);
+        cout << "durable: replayed " << reopened.replayed() << " records, 8 -> " << durableValue << ", 7 "
+             << (reopened.contains(7) ? "found" : "missing") << endl;
+    }
+    std::remove("bst-test.wal/wal.log");
+    rmdir("bst-test.wal");
+
+    // Paged B+tree: the smallest pool allowed, reopened from its file
+    {
+        PagedBPlusTree<int,int> paged("bst-test.pages", 16);
+        for(int i = 0; i < 5000; ++i) {
+            paged.insert(std::make_pair((i * 37) % 5000, i));
+        }
+        for(int i = 0; i < 5000; i += 2) {
+            paged.remove(i);
+        }
+    }
+    {
+        PagedBPlusTree<int,int> paged("bst-test.pages", 16);
+        int pagedValue = 0;
+        paged.find(101, pagedValue);
+        cout << "paged: " << paged.size() << " keys, " << paged.height() << " levels, " << paged.pages()
+             << " pages, 101 -> " << pagedValue << ", keys in [90, 100]:";
+        paged.visit_range(90, 100, [](const std::pair<const int,int>& item) { cout << " " << item.first; });
+        cout << endl;
+    }
+    std::remove("bst-test.pages");
+
     return 0;
 }
@@ -5,6 +5,11 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "workpool.h"
 
 /**
  * A templated class for a Node in a search tree.
@@ -35,6 +40,10 @@ public:
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+    // A new node with the same item (and the same per-node data in derived
+    // node types) under parent, without children.
+    virtual Node<Key, Value>* clone(Node<Key, Value>* parent) const;
+
 protected:
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
@@ -180,12 +189,43 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* Copies this node's item under parent; the copy has no children.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::clone(Node<Key, Value>* parent) const
+{
+    return new Node<Key, Value>(item_.first, item_.second, parent);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* Structural summary of a tree, as returned by BinarySearchTree::stats().
+* Depths count edges from the root (the root has depth 0); the height counts
+* nodes, so a single node has height 1 and an empty tree height 0.
+*/
+struct TreeStats
+{
+    int height;
+    size_t nodeCount;
+    double averageDepth;
+    int maxDepth;
+    // right subtree height - left subtree height -> number of nodes, with
+    // at most five keys: -2 counts every balance of -2 or less, 2 every
+    // balance of 2 or more
+    std::map<int, size_t> balanceHistogram;
+    // every node's subtrees differ in height by at most one
+    bool balanced;
+    // every stored balance factor matches the real one (always true for
+    // trees that do not store balance factors)
+    bool storedBalanceValid;
+};
+
 /**
 * A templated unbalanced binary search tree.
 */
@@ -194,14 +234,36 @@ class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    BinarySearchTree(const BinarySearchTree<Key, Value>& other);
+    BinarySearchTree(BinarySearchTree<Key, Value>&& other) noexcept;
+    BinarySearchTree<Key, Value>& operator=(BinarySearchTree<Key, Value> other);
+    void swap(BinarySearchTree<Key, Value>& other);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
+    virtual void clear(); //TODO
     bool isBalanced() const; //TODO
+    TreeStats stats() const;
+    void setSelfHealing(double factor);
     void print() const;
     bool empty() const;
 
+    // Internal in-order traversal. fn(item) receives a
+    // std::pair<const Key, Value>& and is called in key order; visit_range
+    // visits only keys in [low, high]. Uses O(1) extra space.
+    template<typename Fn>
+    void visit_inorder(Fn fn) const;
+    template<typename Fn>
+    void visit_range(const Key& low, const Key& high, Fn fn) const;
+
+    // Parallel traversals. Top levels of the tree are split into tasks on the
+    // pool; fn, map and combine may run on several threads at once.
+    template<typename Fn>
+    void parallel_for_each(Fn fn, WorkStealingPool& pool = WorkStealingPool::global()) const;
+    template<typename Result, typename Map, typename Combine>
+    Result parallel_reduce(Result identity, Map map, Combine combine,
+                           WorkStealingPool& pool = WorkStealingPool::global()) const;
+
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
@@ -231,12 +293,13 @@ public:
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    void find_batch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    virtual Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
@@ -248,14 +311,41 @@ protected:
 
     // Add helper functions here
     static Node<Key, Value>* successor(Node<Key, Value>* current);
-    void clHelper(Node<Key, Value>* current);
+    static void clHelper(Node<Key, Value>* current);
     int height(Node<Key, Value>* node) const;
-    bool balanceHelper(Node<Key,Value>* root) const;
+    virtual bool storedBalanceMatches(Node<Key, Value>* node, int actual) const;
+    static int leaveSubtree(Node<Key, Value>* node, std::vector<int>& heights);
+    void healAfterInsert(Node<Key, Value>* inserted);
+    void rebuildSubtree(Node<Key, Value>* top, size_t size);
+    static size_t subtreeSize(Node<Key, Value>* n);
+    static void compress(Node<Key, Value>*& sub, size_t count);
+    template<typename Fn>
+    static void postorderWalk(Node<Key, Value>* n, Fn& fn);
+    static Node<Key, Value>* nextInorder(Node<Key, Value>* n);
+    static Node<Key, Value>* cloneTree(const Node<Key, Value>* root);
+    static iterator iteratorAt(Node<Key, Value>* n);
+    Node<Key, Value>* lowerBoundNode(const Key& key) const;
+    void findSortedBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+    void findInterleaved(const std::vector<Key>& keys, size_t first, std::vector<iterator>& out) const;
+    static int forkDepth(const WorkStealingPool& pool);
+    template<typename Fn>
+    static void walkSubtree(Node<Key, Value>* n, Fn& fn);
+    template<typename Fn>
+    static void forEachNodes(Node<Key, Value>* n, int depth, Fn& fn, WorkStealingPool& pool);
+    template<typename Result, typename Map, typename Combine>
+    static Result reduceNodes(Node<Key, Value>* n, int depth, const Result& identity,
+                              Map& map, Combine& combine, WorkStealingPool& pool);
 
 
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+
+    // Self-healing state (see setSelfHealing). The counts are only kept
+    // up to date by BinarySearchTree's own insert and remove.
+    double healFactor_;
+    size_t healCount_;
+    size_t healMax_;
 };
 
 /*
@@ -389,6 +479,58 @@ BinarySearchTree<Key, Value>::BinarySearchTree()
 {
     // TODO
     root_=nullptr;
+    healFactor_=0;
+    healCount_=0;
+    healMax_=0;
+}
+
+/**
+* Copies other's structure node for node in one O(n) pass, so the copy has
+* the same shape and, for derived trees, the same per-node data.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(const BinarySearchTree<Key, Value>& other) :
+    root_(cloneTree(other.root_)),
+    healFactor_(other.healFactor_),
+    healCount_(other.healCount_),
+    healMax_(other.healMax_)
+{
+
+}
+
+/**
+* Takes over other's nodes in O(1), leaving other empty.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree(BinarySearchTree<Key, Value>&& other) noexcept :
+    root_(other.root_),
+    healFactor_(other.healFactor_),
+    healCount_(other.healCount_),
+    healMax_(other.healMax_)
+{
+    other.root_ = nullptr;
+    other.healCount_ = 0;
+    other.healMax_ = 0;
+}
+
+/**
+* Copy and move assignment in one: other is already a copy of, or was
+* moved from, the right-hand side, and is swapped in.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>& BinarySearchTree<Key, Value>::operator=(BinarySearchTree<Key, Value> other)
+{
+    swap(other);
+    return *this;
+}
+
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::swap(BinarySearchTree<Key, Value>& other)
+{
+    std::swap(root_, other.root_);
+    std::swap(healFactor_, other.healFactor_);
+    std::swap(healCount_, other.healCount_);
+    std::swap(healMax_, other.healMax_);
 }
 
 template<typename Key, typename Value>
@@ -438,6 +580,17 @@ BinarySearchTree<Key, Value>::end() const
     return end;
 }
 
+/**
+* An iterator at n, for derived trees that found the node themselves and
+* cannot reach the iterator's protected constructor.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iteratorAt(Node<Key, Value>* n)
+{
+    return iterator(n);
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
@@ -484,10 +637,13 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
     {
         Node<Key,Value>* temp =new Node<Key,Value>(keyValuePair.first,keyValuePair.second,nullptr);
         root_=temp;
+        ++healCount_;
         return;
     }
     
     Node<Key,Value>* temp=root_;
+    Node<Key,Value>* newNode=nullptr;
+    int depth=1; //depth of the new node, counted in edges
     
     while(temp!=nullptr)
     {
@@ -495,7 +651,7 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
         {
             if(temp->getRight()==nullptr)
             {
-                Node<Key, Value>* newNode =new Node<Key,Value>(keyValuePair.first,keyValuePair.second,temp);
+                newNode =new Node<Key,Value>(keyValuePair.first,keyValuePair.second,temp);
                 temp->setRight(newNode);
                 break;
             }
@@ -505,7 +661,7 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
         {
             if (temp->getLeft() == nullptr)
             {
-                Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, temp);
+                newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, temp);
                 temp->setLeft(newNode);
                 break;
             }
@@ -514,11 +670,18 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
         else //keyValuePair.first==temp->getKey() on target
         {
             temp->setValue(keyValuePair.second);
-            break;
+            return;
         }
+        ++depth;
     }
-}
 
+    ++healCount_;
+    if(healCount_>healMax_) healMax_=healCount_;
+    if(healFactor_>0 && depth>healFactor_*std::log2(double(healCount_)))
+    {
+        healAfterInsert(newNode);
+    }
+}
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
@@ -534,6 +697,8 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     if(removing==NULL) //is not in tree
         return;
     
+    if(healCount_>0) --healCount_;
+    
     if(removing->getRight()!=nullptr && removing->getLeft()!=nullptr)
     {
         Node<Key,Value>* pred=predecessor(removing);
@@ -608,6 +773,13 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             delete removing;
         }
     }
+
+    if(healFactor_>0 && healCount_<healMax_/2)
+    {
+        //scapegoat rule: rebuild everything once half the peak size is gone
+        healMax_=healCount_;
+        if(root_!=nullptr) rebuildSubtree(root_, healCount_);
+    }
 }
 
 
@@ -650,18 +822,35 @@ void BinarySearchTree<Key, Value>::clear()
     // TODO
     clHelper(root_);
     root_=nullptr;
+    healCount_=0;
+    healMax_=0;
 }
 
-//helper function for clear
+/**
+* Helper function for clear. Frees the subtree rooted at current without
+* recursion: while the current node has a left child it is rotated right,
+* which eventually turns the subtree into a right-leaning chain that is
+* freed front to back. O(n) time and O(1) extra space for any tree shape.
+*/
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clHelper(Node<Key, Value>* current)
 {
-    if (current==nullptr)
-        return;
-    
-    clHelper(current->getLeft());
-    clHelper(current->getRight());
-    delete current;
+    while(current!=nullptr)
+    {
+        Node<Key, Value>* left=current->getLeft();
+        if(left!=nullptr)
+        {
+            current->setLeft(left->getRight());
+            left->setRight(current);
+            current=left;
+        }
+        else
+        {
+            Node<Key, Value>* right=current->getRight();
+            delete current;
+            current=right;
+        }
+    }
 }
 
 /**
@@ -673,6 +862,10 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 {
     // TODO
     Node<Key, Value>* temp =root_;
+    if(temp==nullptr) //empty tree, begin() == end()
+    {
+        return NULL;
+    }
     while(temp->getLeft() !=nullptr)
     {
         temp=temp->getLeft();
@@ -715,48 +908,744 @@ template<typename Key, typename Value>
 bool BinarySearchTree<Key, Value>::isBalanced() const
 {
     // TODO
-    return balanceHelper(root_);
+    bool balanced=true;
+    std::vector<int> heights;
+    auto leave=[&](Node<Key, Value>* node, int)
+    {
+        if(abs(leaveSubtree(node, heights))>1)
+        {
+            balanced=false;
+        }
+    };
+    postorderWalk(root_, leave);
+    return balanced;
 }
 
-//helper for balanced
+/**
+* Gathers height, node count, depth statistics, a balance-factor histogram
+* and balance checks in a single post-order pass, O(n) time. The heights of
+* subtrees still waiting for their parent are kept on a heap-allocated
+* stack, so native stack use does not grow with the tree.
+*/
 template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balanceHelper(Node<Key,Value>* root) const
+TreeStats BinarySearchTree<Key, Value>::stats() const
 {
-    if (root==nullptr)
+    TreeStats result;
+    result.height=0;
+    result.nodeCount=0;
+    result.averageDepth=0;
+    result.maxDepth=0;
+    result.balanced=true;
+    result.storedBalanceValid=true;
+
+    std::vector<int> heights;
+    // balances -2 or less, -1, 0, 1, 2 or more
+    size_t histogram[5]={0, 0, 0, 0, 0};
+    double depthSum=0;
+    auto leave=[&](Node<Key, Value>* node, int depth)
     {
-        return true;
-    }
-    
-    if(abs(height(root->getLeft())-height(root->getRight()))<=1)
+        int balance=leaveSubtree(node, heights);
+        if(abs(balance)>1)
+        {
+            result.balanced=false;
+        }
+        if(result.storedBalanceValid && !storedBalanceMatches(node, balance))
+        {
+            result.storedBalanceValid=false;
+        }
+        ++histogram[std::min(std::max(balance, -2), 2)+2];
+        ++result.nodeCount;
+        depthSum+=depth-1;
+    };
+    postorderWalk(root_, leave);
+    for(int i=0; i<5; ++i)
     {
-        if(balanceHelper(root->getLeft())&&balanceHelper(root->getRight()))
+        if(histogram[i]!=0)
         {
-            return true;
+            result.balanceHistogram[i-2]=histogram[i];
         }
     }
-    return false;
+
+    if(!heights.empty())
+    {
+        result.height=heights.back();
+        result.maxDepth=result.height-1;
+        result.averageDepth=depthSum/result.nodeCount;
+    }
+    return result;
 }
 
-//to get height
+/**
+* Hook for stats(): trees that store a balance factor in their nodes
+* compare it with the real one here. A plain BST stores none.
+*/
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::storedBalanceMatches(Node<Key, Value>*, int) const
+{
+    return true;
+}
+
+/**
+* Post-order step shared by isBalanced and stats(): replaces the heights of
+* node's children on top of heights with the height of node's subtree and
+* returns node's balance, right height minus left height.
+*/
+template<typename Key, typename Value>
+int BinarySearchTree<Key, Value>::leaveSubtree(Node<Key, Value>* node, std::vector<int>& heights)
+{
+    int right_height=0;
+    int left_height=0;
+    if(node->Node<Key, Value>::getRight()!=nullptr)
+    {
+        right_height=heights.back();
+        heights.pop_back();
+    }
+    if(node->Node<Key, Value>::getLeft()!=nullptr)
+    {
+        left_height=heights.back();
+        heights.pop_back();
+    }
+    heights.push_back(std::max(left_height, right_height)+1);
+    return right_height-left_height;
+}
+
+/**
+* To get height. Tracks the depth during a post-order walk, so it needs no
+* recursion and O(1) extra space.
+*/
 template<typename Key, typename Value>
 int BinarySearchTree<Key, Value>::height(Node<Key, Value>* node) const
 {
-    if(node==nullptr) //base case empty tree
+    int best=0;
+    auto leave=[&](Node<Key, Value>*, int depth)
+    {
+        if(depth>best) best=depth;
+    };
+    postorderWalk(node, leave);
+    return best;
+}
+
+/**
+* Post-order walk of the subtree rooted at n that follows parent links
+* instead of recursing. fn(node, depth) is called once both subtrees of
+* node are done; n itself has depth 1. n may have a parent; the walk never
+* goes above it.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::postorderWalk(Node<Key, Value>* n, Fn& fn)
+{
+    Node<Key, Value>* cur=n;
+    Node<Key, Value>* prev=nullptr;
+    bool fromAbove=true;
+    int depth=1;
+    while(cur!=nullptr)
+    {
+        Node<Key, Value>* left=cur->Node<Key, Value>::getLeft();
+        Node<Key, Value>* right=cur->Node<Key, Value>::getRight();
+        Node<Key, Value>* next=nullptr;
+        if(fromAbove)
+        {
+            next=(left!=nullptr) ? left : right;
+        }
+        else if(prev==left)
+        {
+            next=right;
+        }
+        if(next!=nullptr)
+        {
+            cur=next;
+            ++depth;
+            fromAbove=true;
+            continue;
+        }
+        fn(cur, depth);
+        if(cur==n)
+        {
+            return;
+        }
+        prev=cur;
+        cur=cur->Node<Key, Value>::getParent();
+        --depth;
+        fromAbove=false;
+    }
+}
+
+/**
+* Calls fn(item) once for every item in the tree, where item is a
+* std::pair<const Key, Value>&. Calls for different items may run in
+* parallel and in any order, so fn must be safe to call concurrently.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::parallel_for_each(Fn fn, WorkStealingPool& pool) const
+{
+    forEachNodes(root_, forkDepth(pool), fn, pool);
+}
+
+/**
+* Folds the tree in key order: the result equals
+*   combine(...combine(combine(identity, map(item1)), map(item2))..., map(itemN))
+* for any associative combine with identity as its neutral element, even
+* though subtrees are reduced in parallel. map is called with a
+* const std::pair<const Key, Value>&.
+*/
+template<typename Key, typename Value>
+template<typename Result, typename Map, typename Combine>
+Result BinarySearchTree<Key, Value>::parallel_reduce(Result identity, Map map, Combine combine,
+                                                     WorkStealingPool& pool) const
+{
+    return reduceNodes(root_, forkDepth(pool), identity, map, combine, pool);
+}
+
+//number of tree levels to split into tasks: about 16 leaf tasks per worker
+template<typename Key, typename Value>
+int BinarySearchTree<Key, Value>::forkDepth(const WorkStealingPool& pool)
+{
+    if(pool.size() <= 1)
     {
         return 0;
     }
-    
-    int left_height =height(node->getLeft());
-    int right_height =height(node->getRight());
-    
-    if (left_height>=right_height)
+    int depth = 4;
+    for(unsigned n = pool.size(); n > 1; n >>= 1)
+    {
+        ++depth;
+    }
+    return depth;
+}
+
+/**
+* Calls fn(item) for every item in key order.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::visit_inorder(Fn fn) const
+{
+    walkSubtree(root_, fn);
+}
+
+/**
+* Calls fn(item) in key order for every item whose key k satisfies
+* low <= k <= high. Starts with one descent to the first such key and then
+* steps forward with nextInorder, so the cost is O(log n + items visited)
+* on a balanced tree.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::visit_range(const Key& low, const Key& high, Fn fn) const
+{
+    for(Node<Key, Value>* n = lowerBoundNode(low); n != nullptr; n = nextInorder(n))
+    {
+        if(high < n->getKey())
+        {
+            return;
+        }
+        fn(n->getItem());
+    }
+}
+
+/**
+* Looks up every key in keys and stores find(keys[i]) in out[i].
+*
+* A single find is a chain of dependent cache misses: the next node is
+* not known until the current one has arrived. find_batch keeps a group
+* of lookups in flight and advances them round-robin (findInterleaved),
+* so the misses of different lookups overlap. Keys that are already
+* sorted take findSortedBatch first, which shares the common top of
+* neighbouring search paths.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::find_batch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    out.assign(keys.size(), end());
+    if(std::is_sorted(keys.begin(), keys.end()))
+    {
+        findSortedBatch(keys, out);
+    }
+    else
+    {
+        findInterleaved(keys, 0, out);
+    }
+}
+
+/**
+* find_batch for sorted keys. The subtree of each node on the previous
+* search path holds the keys between that path's last left turn above it
+* and the previous key, so a larger key only has to climb back to the
+* deepest node whose bound still lies above it and descend from there.
+*
+* That pays off only when neighbouring keys are close. If the keys seen so
+* far needed more than a few new levels each, the descents are mostly
+* cache misses again and the rest of the batch is interleaved instead.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::findSortedBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    const size_t probe = 8;
+    const size_t maxSteps = 3;
+    // path[i] is a node on the current search path and bound[i] the
+    // nearest ancestor where the path turned left (NULL: no upper bound)
+    std::vector<Node<Key, Value>*> path;
+    std::vector<Node<Key, Value>*> bound;
+    size_t steps = 0;
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        if(i % probe == 0 && i > 0 && steps > maxSteps * (i - 1))
+        {
+            findInterleaved(keys, i, out);
+            return;
+        }
+        const Key& key = keys[i];
+        while(!path.empty() && bound.back() != nullptr && !(key < bound.back()->getKey()))
+        {
+            path.pop_back();
+            bound.pop_back();
+        }
+        Node<Key, Value>* n;
+        Node<Key, Value>* hi;
+        if(path.empty())
+        {
+            n = root_;
+            hi = nullptr;
+        }
+        else
+        {
+            n = path.back();
+            hi = bound.back();
+            path.pop_back();
+            bound.pop_back();
+        }
+        while(n != nullptr)
+        {
+            path.push_back(n);
+            bound.push_back(hi);
+            ++steps;
+            if(key < n->getKey())
+            {
+                hi = n;
+                n = n->Node<Key, Value>::getLeft();
+            }
+            else if(n->getKey() < key)
+            {
+                n = n->Node<Key, Value>::getRight();
+            }
+            else
+            {
+                out[i] = iterator(n);
+                break;
+            }
+        }
+        if(i == 0)
+        {
+            steps = 0; //the first descent always starts at the root
+        }
+    }
+}
+
+/**
+* Looks up keys[first..] sixteen at a time. Each turn advances one lookup
+* by one level and prefetches its next node; by the time that lookup's
+* turn comes again the node has usually arrived. A finished lookup hands
+* its slot to the next key right away.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::findInterleaved(const std::vector<Key>& keys, size_t first,
+                                                   std::vector<iterator>& out) const
+{
+    const size_t width = 16;
+    Node<Key, Value>* curr[width];
+    size_t which[width];
+    size_t slots = std::min(width, keys.size() - first);
+    size_t next = first + slots;
+    size_t active = slots;
+    for(size_t s = 0; s < slots; ++s)
     {
-        return left_height+1;
+        curr[s] = root_;
+        which[s] = first + s;
     }
-    return right_height+1;
-} 
+    while(active > 0)
+    {
+        for(size_t s = 0; s < slots; ++s)
+        {
+            Node<Key, Value>* n = curr[s];
+            if(which[s] == keys.size())
+            {
+                continue;
+            }
+            const Key& key = keys[which[s]];
+            if(n != nullptr && !(key < n->getKey()) && !(n->getKey() < key))
+            {
+                out[which[s]] = iterator(n);
+                n = nullptr;
+            }
+            else if(n != nullptr)
+            {
+                n = (key < n->getKey()) ? n->Node<Key, Value>::getLeft() : n->Node<Key, Value>::getRight();
+                if(n != nullptr)
+                {
+                    __builtin_prefetch(n);
+                    curr[s] = n;
+                    continue;
+                }
+            }
+            // this lookup is done; start the next key in its slot
+            if(next < keys.size())
+            {
+                curr[s] = root_;
+                which[s] = next++;
+            }
+            else
+            {
+                which[s] = keys.size();
+                --active;
+            }
+        }
+    }
+}
 
+/*
+ * The traversal helpers below call the getters qualified with Node<Key, Value>::
+ * to bypass virtual dispatch. Every node type stores its links in Node, and the
+ * overrides only cast the pointer, so the result is the same and the loops
+ * (and the callback) can be fully inlined.
+ */
 
+//in-order successor without virtual calls; same walk as successor()
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::nextInorder(Node<Key, Value>* n)
+{
+    Node<Key, Value>* r = n->Node<Key, Value>::getRight();
+    if(r != nullptr)
+    {
+        while(r->Node<Key, Value>::getLeft() != nullptr)
+        {
+            r = r->Node<Key, Value>::getLeft();
+        }
+        return r;
+    }
+    Node<Key, Value>* p = n->Node<Key, Value>::getParent();
+    while(p != nullptr && n == p->Node<Key, Value>::getRight())
+    {
+        n = p;
+        p = p->Node<Key, Value>::getParent();
+    }
+    return p;
+}
+
+/**
+* Copies the subtree at root with Node::clone, walking it in preorder
+* through the parent links: no recursion and no stack, so even a
+* degenerate unbalanced tree copies in O(n) time and O(1) extra space.
+* If a clone throws, the nodes copied so far are freed and the exception
+* is passed on.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::cloneTree(const Node<Key, Value>* root)
+{
+    if(root == nullptr)
+    {
+        return nullptr;
+    }
+    Node<Key, Value>* copy = root->clone(nullptr);
+    const Node<Key, Value>* s = root;
+    Node<Key, Value>* d = copy;
+    try
+    {
+        while(true)
+        {
+            const Node<Key, Value>* sl = s->Node<Key, Value>::getLeft();
+            const Node<Key, Value>* sr = s->Node<Key, Value>::getRight();
+            if(sl != nullptr && d->Node<Key, Value>::getLeft() == nullptr)
+            {
+                d->setLeft(sl->clone(d));
+                s = sl;
+                d = d->Node<Key, Value>::getLeft();
+            }
+            else if(sr != nullptr && d->Node<Key, Value>::getRight() == nullptr)
+            {
+                d->setRight(sr->clone(d));
+                s = sr;
+                d = d->Node<Key, Value>::getRight();
+            }
+            else if(s == root)
+            {
+                return copy;
+            }
+            else
+            {
+                s = s->Node<Key, Value>::getParent();
+                d = d->Node<Key, Value>::getParent();
+            }
+        }
+    }
+    catch(...)
+    {
+        //the walk reads a node's parent link after visiting it, so each
+        //node is freed one visit late
+        Node<Key, Value>* done = nullptr;
+        auto leave = [&done](Node<Key, Value>* n, int)
+        {
+            delete done;
+            done = n;
+        };
+        postorderWalk(copy, leave);
+        delete done;
+        throw;
+    }
+}
+
+//the node with the smallest key that is not less than key, or NULL
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::lowerBoundNode(const Key& key) const
+{
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* best = nullptr;
+    while(curr != nullptr)
+    {
+        if(curr->getKey() < key)
+        {
+            curr = curr->Node<Key, Value>::getRight();
+        }
+        else
+        {
+            best = curr;
+            curr = curr->Node<Key, Value>::getLeft();
+        }
+    }
+    return best;
+}
+
+//in-order walk of the subtree rooted at n using parent links instead of a stack
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::walkSubtree(Node<Key, Value>* n, Fn& fn)
+{
+    if(n == nullptr)
+    {
+        return;
+    }
+    Node<Key, Value>* cur = n;
+    while(cur->Node<Key, Value>::getLeft() != nullptr)
+    {
+        cur = cur->Node<Key, Value>::getLeft();
+    }
+    while(true)
+    {
+        fn(cur->getItem());
+        Node<Key, Value>* r = cur->Node<Key, Value>::getRight();
+        if(r != nullptr)
+        {
+            cur = r;
+            while(cur->Node<Key, Value>::getLeft() != nullptr)
+            {
+                cur = cur->Node<Key, Value>::getLeft();
+            }
+        }
+        else
+        {
+            while(cur != n && cur == cur->Node<Key, Value>::getParent()->Node<Key, Value>::getRight())
+            {
+                cur = cur->Node<Key, Value>::getParent();
+            }
+            if(cur == n)
+            {
+                return;
+            }
+            cur = cur->Node<Key, Value>::getParent();
+        }
+    }
+}
+
+template<typename Key, typename Value>
+template<typename Fn>
+void BinarySearchTree<Key, Value>::forEachNodes(Node<Key, Value>* n, int depth, Fn& fn, WorkStealingPool& pool)
+{
+    if(n == nullptr)
+    {
+        return;
+    }
+    if(depth <= 0)
+    {
+        walkSubtree(n, fn);
+        return;
+    }
+    pool.invoke([&]() { forEachNodes(n->getLeft(), depth - 1, fn, pool); },
+                [&]() { forEachNodes(n->getRight(), depth - 1, fn, pool); });
+    fn(n->getItem());
+}
+
+template<typename Key, typename Value>
+template<typename Result, typename Map, typename Combine>
+Result BinarySearchTree<Key, Value>::reduceNodes(Node<Key, Value>* n, int depth, const Result& identity,
+                                                 Map& map, Combine& combine, WorkStealingPool& pool)
+{
+    if(n == nullptr)
+    {
+        return identity;
+    }
+    if(depth <= 0)
+    {
+        Result acc = identity;
+        auto fold = [&](const std::pair<const Key, Value>& item) { acc = combine(acc, map(item)); };
+        walkSubtree(n, fold);
+        return acc;
+    }
+    Result left = identity;
+    Result right = identity;
+    pool.invoke([&]() { left = reduceNodes(n->getLeft(), depth - 1, identity, map, combine, pool); },
+                [&]() { right = reduceNodes(n->getRight(), depth - 1, identity, map, combine, pool); });
+    const std::pair<const Key, Value>& item = n->getItem();
+    return combine(combine(left, map(item)), right);
+}
+
+/**
+* Turns on self-healing when factor > 0, and turns it off when factor is 0.
+* While it is on, an insert whose new node lands deeper than
+* factor * log2(n) rebuilds the subtree of its scapegoat, the lowest
+* ancestor whose subtree is out of weight balance. A remove that brings the
+* tree under half of its peak size rebuilds the whole tree. Rebuilds take
+* O(size) time and O(1) extra memory, and operations stay O(log n)
+* amortized. factor should be at least 1; 2 is a reasonable choice.
+* Only BinarySearchTree's own insert/remove heal, so this has no effect on
+* derived trees that balance themselves.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setSelfHealing(double factor)
+{
+    healFactor_=(factor>0) ? std::max(factor, 1.0) : 0;
+    healCount_=subtreeSize(root_);
+    healMax_=healCount_;
+}
+
+/**
+* Finds the scapegoat above a node that was inserted too deep, which is the
+* lowest ancestor p with size(child) > alpha * size(p) for
+* alpha = 2^(-1/factor). Such an ancestor always exists once the depth
+* exceeds factor * log2(n). Each step only counts the sibling subtree, so
+* the search costs O(size of the scapegoat's subtree).
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::healAfterInsert(Node<Key, Value>* inserted)
+{
+    double alpha=std::pow(2.0, -1.0/healFactor_);
+    Node<Key, Value>* child=inserted;
+    size_t childSize=1;
+    Node<Key, Value>* parent=child->getParent();
+    while(parent!=nullptr)
+    {
+        Node<Key, Value>* sibling=(parent->getLeft()==child) ? parent->getRight() : parent->getLeft();
+        size_t parentSize=childSize+1+subtreeSize(sibling);
+        if(childSize>alpha*parentSize)
+        {
+            rebuildSubtree(parent, parentSize);
+            return;
+        }
+        child=parent;
+        childSize=parentSize;
+        parent=parent->getParent();
+    }
+}
+
+//number of nodes in the subtree rooted at n
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::subtreeSize(Node<Key, Value>* n)
+{
+    size_t count=0;
+    auto leave=[&count](Node<Key, Value>*, int) { ++count; };
+    if(n!=nullptr) postorderWalk(n, leave);
+    return count;
+}
+
+/**
+* Rebuilds the subtree rooted at top, which holds size nodes, into a
+* complete tree in place with the Day-Stout-Warren algorithm: right
+* rotations flatten it into a sorted right-leaning vine, and rounds of left
+* rotations along the vine fold it back into a tree of minimal height.
+* O(size) time, O(1) extra memory.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildSubtree(Node<Key, Value>* top, size_t size)
+{
+    Node<Key, Value>* above=top->getParent();
+    bool wasLeft=(above!=nullptr && above->getLeft()==top);
+
+    //tree to vine
+    Node<Key, Value>* sub=top;
+    Node<Key, Value>* tail=nullptr;
+    Node<Key, Value>* rest=top;
+    while(rest!=nullptr)
+    {
+        Node<Key, Value>* left=rest->getLeft();
+        if(left!=nullptr)
+        {
+            rest->setLeft(left->getRight());
+            if(left->getRight()!=nullptr) left->getRight()->setParent(rest);
+            left->setRight(rest);
+            rest->setParent(left);
+            if(tail!=nullptr)
+            {
+                tail->setRight(left);
+                left->setParent(tail);
+            }
+            else
+            {
+                sub=left;
+            }
+            rest=left;
+        }
+        else
+        {
+            tail=rest;
+            rest=rest->getRight();
+        }
+    }
+
+    //vine to tree
+    size_t full=1;
+    while(full*2<=size+1)
+    {
+        full*=2;
+    }
+    full-=1; //largest 2^k - 1 <= size
+    compress(sub, size-full);
+    while(full>1)
+    {
+        full/=2;
+        compress(sub, full);
+    }
+
+    sub->setParent(above);
+    if(above==nullptr) root_=sub;
+    else if(wasLeft) above->setLeft(sub);
+    else above->setRight(sub);
+}
+
+//one DSW pass: left-rotate every other node along the right spine, count times
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compress(Node<Key, Value>*& sub, size_t count)
+{
+    Node<Key, Value>* tail=nullptr;
+    Node<Key, Value>* scanner=sub;
+    for(size_t i=0; i<count; ++i)
+    {
+        Node<Key, Value>* child=scanner->getRight();
+        scanner->setRight(child->getLeft());
+        if(child->getLeft()!=nullptr) child->getLeft()->setParent(scanner);
+        child->setLeft(scanner);
+        scanner->setParent(child);
+        if(tail!=nullptr)
+        {
+            tail->setRight(child);
+            child->setParent(tail);
+        }
+        else
+        {
+            sub=child;
+        }
+        tail=child;
+        scanner=child->getRight();
+    }
+}
 
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
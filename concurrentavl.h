@@ -0,0 +1,886 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+
+/**
+* A concurrent AVL tree with optimistic, lock-free reads, after Bronson,
+* Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search Tree"
+* (PPoPP 2010).
+*
+* Every node carries a version number. A rotation that moves keys out of a
+* node's subtree marks the node as shrinking while it relinks and bumps the
+* version when it is done. Readers take no locks: they descend
+* hand-over-hand, validating after each step that the version of the node
+* they came from is unchanged, and back up one level when it is not.
+*
+* Writers lock only the nodes whose links they change: the parent when a
+* leaf is added or a node is spliced out, the node itself for a value
+* update, and the two or three nodes of a rotation, always parent before
+* child. Removing a node with two children just clears its value. The
+* node stays as a routing node and is spliced out later, once it has at
+* most one child. Heights are repaired bottom-up after each update, so
+* balance is restored as soon as updates stop, not inside every update.
+*
+* Unlinked nodes and replaced values are freed through EpochReclaimer, so
+* a reader may still be looking at them. Every public operation pins the
+* calling thread for its duration.
+*
+* for_each and height walk the tree without validation and are only
+* meaningful when no update is running.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    bool insertIfAbsent(const std::pair<const Key, Value>& new_item);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+
+    template<typename Fn>
+    void for_each(Fn fn) const;
+    int height() const;
+
+private:
+    struct Node;
+
+    // A word-sized lock; waiters spin briefly and then yield.
+    struct SpinLock
+    {
+        SpinLock() : held(false) { }
+        void lock();
+        void unlock() { held.store(false, std::memory_order_release); }
+        std::atomic<bool> held;
+    };
+
+    // The links, height, version and lock of a node. The root holder is a
+    // bare Links whose right child is the root, so that the root can be
+    // replaced the same way as any other child.
+    struct Links
+    {
+        explicit Links(Links* p) : left(nullptr), right(nullptr), parent(p), height(0), version(0) { }
+        Node* child(int dir) const
+        {
+            return (dir < 0 ? left : right).load(std::memory_order_acquire);
+        }
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<Links*> parent;
+        std::atomic<int> height;
+        std::atomic<uint64_t> version;
+        SpinLock lock;
+    };
+
+    // A NULL value marks a routing node, whose key was removed.
+    struct Node : public Links
+    {
+        Node(const Key& k, Value* v, Links* p) : Links(p), key(k), value(v) { this->height.store(1); }
+        const Key key;
+        std::atomic<Value*> value;
+    };
+
+    typedef std::lock_guard<SpinLock> Locker;
+
+    // version bits: unlinked, shrinking, then a change counter
+    static const uint64_t unlinked_ = 1;
+    static const uint64_t shrinking_ = 2;
+    static const uint64_t changeIncr_ = 4;
+
+    // results of the attempt* helpers
+    enum Outcome { Retry, Absent, Present };
+    enum Mode { Put, PutIfAbsent, Remove };
+
+    // nodeCondition results other than a new height
+    static const int unlinkRequired_ = -1;
+    static const int rebalanceRequired_ = -2;
+    static const int nothingRequired_ = -3;
+
+    Outcome attemptGet(const Key& key, Links* node, int dir, uint64_t nodeV, Value& value) const;
+    Outcome update(const Key& key, Mode mode, const Value* newValue);
+    Outcome attemptUpdate(const Key& key, Mode mode, const Value* newValue,
+                          Links* node, int dir, uint64_t nodeV);
+    Outcome attemptNodeUpdate(Mode mode, const Value* newValue, Links* parent, Node* n);
+    bool attemptUnlink_nl(Links* parent, Node* n);
+
+    static int compare(const Key& a, const Key& b);
+    static int heightOf(Node* n);
+    static void setChild(Links* parent, Node* old, Node* n);
+    static void waitUntilNotChanging(Links* n);
+    static void pause(unsigned& spins);
+
+    int nodeCondition(Node* n) const;
+    void fixHeightAndRebalance(Links* node);
+    Links* fixHeight_nl(Links* node);
+    Links* rebalance_nl(Links* nParent, Node* n);
+    Links* rebalanceToRight_nl(Links* nParent, Node* n, Node* nL, int hR0);
+    Links* rebalanceToLeft_nl(Links* nParent, Node* n, Node* nR, int hL0);
+    Links* rotateRight_nl(Links* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR);
+    Links* rotateLeft_nl(Links* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR);
+    Links* rotateRightOverLeft_nl(Links* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL);
+    Links* rotateLeftOverRight_nl(Links* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR);
+
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    mutable Links holder_;
+};
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::SpinLock::lock()
+{
+    unsigned spins = 0;
+    while(held.exchange(true, std::memory_order_acquire)){
+        while(held.load(std::memory_order_relaxed)){
+            pause(spins);
+        }
+    }
+}
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    holder_(nullptr)
+{
+
+}
+
+/**
+* Frees every node still in the tree. No other thread may be using it.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    std::vector<Node*> stack;
+    if(holder_.right.load() != nullptr) stack.push_back(holder_.right.load());
+    while(!stack.empty()){
+        Node* n = stack.back();
+        stack.pop_back();
+        if(n->left.load() != nullptr) stack.push_back(n->left.load());
+        if(n->right.load() != nullptr) stack.push_back(n->right.load());
+        delete n->value.load();
+        delete n;
+    }
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* Safe to call from any number of threads at once.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    update(new_item.first, Put, &new_item.second);
+}
+
+/**
+* Inserts the item only if its key is missing. Returns true if it did.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::insertIfAbsent(const std::pair<const Key, Value>& new_item)
+{
+    return update(new_item.first, PutIfAbsent, &new_item.second) == Absent;
+}
+
+/**
+* Removes key and returns true, or returns false if it was not present.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    return update(key, Remove, nullptr) == Present;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns
+* false if the key is missing.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochReclaimer::Guard guard;
+    while(true){
+        Outcome r = attemptGet(key, &holder_, 1, holder_.version.load(std::memory_order_acquire), value);
+        if(r != Retry){
+            return r == Present;
+        }
+    }
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    Value ignored;
+    return find(key, ignored);
+}
+
+/**
+* True if no key is present. Routing nodes left behind by removes do not
+* count.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    bool any = false;
+    for_each([&any](const std::pair<const Key&, const Value&>&) { any = true; });
+    return !any;
+}
+
+/**
+* Calls fn with a std::pair<const Key&, const Value&> for every key, in
+* order. Only valid while no updates are running.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void ConcurrentAVLTree<Key, Value>::for_each(Fn fn) const
+{
+    std::vector<Node*> stack;
+    Node* n = holder_.right.load(std::memory_order_acquire);
+    while(n != nullptr || !stack.empty()){
+        for(; n != nullptr; n = n->left.load(std::memory_order_acquire)){
+            stack.push_back(n);
+        }
+        n = stack.back();
+        stack.pop_back();
+        Value* v = n->value.load(std::memory_order_acquire);
+        if(v != nullptr){
+            fn(std::pair<const Key&, const Value&>(n->key, *v));
+        }
+        n = n->right.load(std::memory_order_acquire);
+    }
+}
+
+/**
+* The stored height of the root. Only valid while no updates are running.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::height() const
+{
+    return heightOf(holder_.right.load(std::memory_order_acquire));
+}
+
+/**
+* Searches the subtree of node's child in direction dir, where nodeV is the
+* version of node that the caller validated. Returns Retry when node
+* changed underneath, so that the caller re-reads its own child.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, Links* node, int dir, uint64_t nodeV, Value& value) const
+{
+    while(true){
+        Node* child = node->child(dir);
+        if(node->version.load(std::memory_order_acquire) != nodeV){
+            return Retry;
+        }
+        if(child == nullptr){
+            return Absent;
+        }
+        int nextD = compare(key, child->key);
+        if(nextD == 0){
+            Value* v = child->value.load(std::memory_order_acquire);
+            if(v == nullptr){
+                return Absent;
+            }
+            value = *v;
+            return Present;
+        }
+        uint64_t chV = child->version.load(std::memory_order_acquire);
+        if((chV & shrinking_) != 0){
+            waitUntilNotChanging(child);
+        } else if((chV & unlinked_) == 0 && child == node->child(dir)){
+            if(node->version.load(std::memory_order_acquire) != nodeV){
+                return Retry;
+            }
+            Outcome r = attemptGet(key, child, nextD, chV, value);
+            if(r != Retry){
+                return r;
+            }
+        }
+    }
+}
+
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::update(const Key& key, Mode mode, const Value* newValue)
+{
+    EpochReclaimer::Guard guard;
+    while(true){
+        Outcome r = attemptUpdate(key, mode, newValue, &holder_, 1,
+                                  holder_.version.load(std::memory_order_acquire));
+        if(r != Retry){
+            return r;
+        }
+    }
+}
+
+/**
+* The update counterpart of attemptGet. A missing key is inserted as a new
+* leaf under node, with node locked; an existing one is handed to
+* attemptNodeUpdate. Returns whether the key was present before.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptUpdate(const Key& key, Mode mode, const Value* newValue,
+                                              Links* node, int dir, uint64_t nodeV)
+{
+    while(true){
+        Node* child = node->child(dir);
+        if(node->version.load(std::memory_order_acquire) != nodeV){
+            return Retry;
+        }
+        if(child == nullptr){
+            if(mode == Remove){
+                return Absent;
+            }
+            Links* damaged;
+            {
+                Locker lock(node->lock);
+                if(node->version.load(std::memory_order_relaxed) != nodeV){
+                    return Retry;
+                }
+                if(node->child(dir) != nullptr){
+                    continue; //lost a race with another insert
+                }
+                Node* n = new Node(key, new Value(*newValue), node);
+                if(dir < 0) node->left.store(n, std::memory_order_release);
+                else node->right.store(n, std::memory_order_release);
+                damaged = fixHeight_nl(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return Absent;
+        }
+        int nextD = compare(key, child->key);
+        if(nextD == 0){
+            Outcome r = attemptNodeUpdate(mode, newValue, node, child);
+            if(r != Retry){
+                return r;
+            }
+            continue;
+        }
+        uint64_t chV = child->version.load(std::memory_order_acquire);
+        if((chV & shrinking_) != 0){
+            waitUntilNotChanging(child);
+        } else if((chV & unlinked_) == 0 && child == node->child(dir)){
+            if(node->version.load(std::memory_order_acquire) != nodeV){
+                return Retry;
+            }
+            Outcome r = attemptUpdate(key, mode, newValue, child, nextD, chV);
+            if(r != Retry){
+                return r;
+            }
+        }
+    }
+}
+
+/**
+* Applies an update to n, the node holding the key, whose parent is parent.
+* A remove splices n out when it has at most one child (locking parent,
+* then n) and otherwise turns it into a routing node; puts replace the
+* value under n's lock.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptNodeUpdate(Mode mode, const Value* newValue, Links* parent, Node* n)
+{
+    if(mode == Remove){
+        if(n->value.load(std::memory_order_acquire) == nullptr){
+            return Absent;
+        }
+        if(n->left.load(std::memory_order_acquire) == nullptr || n->right.load(std::memory_order_acquire) == nullptr){
+            Links* damaged;
+            Value* prev;
+            {
+                Locker lockParent(parent->lock);
+                if((parent->version.load(std::memory_order_relaxed) & unlinked_) != 0 ||
+                   n->parent.load(std::memory_order_relaxed) != parent){
+                    return Retry;
+                }
+                Locker lockNode(n->lock);
+                prev = n->value.load(std::memory_order_relaxed);
+                if(prev == nullptr){
+                    return Absent;
+                }
+                if(!attemptUnlink_nl(parent, n)){
+                    return Retry;
+                }
+                damaged = fixHeight_nl(parent);
+            }
+            EpochReclaimer::global().retire(prev);
+            EpochReclaimer::global().retire(n);
+            fixHeightAndRebalance(damaged);
+            return Present;
+        }
+    }
+
+    Locker lock(n->lock);
+    if((n->version.load(std::memory_order_relaxed) & unlinked_) != 0){
+        return Retry;
+    }
+    Value* prev = n->value.load(std::memory_order_relaxed);
+    if(mode == Remove){
+        if(prev == nullptr){
+            return Absent;
+        }
+        if(n->left.load(std::memory_order_relaxed) == nullptr || n->right.load(std::memory_order_relaxed) == nullptr){
+            return Retry; //can be spliced out after all
+        }
+        n->value.store(nullptr, std::memory_order_release);
+        EpochReclaimer::global().retire(prev);
+        return Present;
+    }
+    if(mode == PutIfAbsent && prev != nullptr){
+        return Present;
+    }
+    n->value.store(new Value(*newValue), std::memory_order_release);
+    if(prev != nullptr){
+        EpochReclaimer::global().retire(prev);
+        return Present;
+    }
+    return Absent;
+}
+
+//splices n (at most one child) out from under parent; both are locked
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink_nl(Links* parent, Node* n)
+{
+    Node* parentL = parent->left.load(std::memory_order_relaxed);
+    Node* parentR = parent->right.load(std::memory_order_relaxed);
+    if(parentL != n && parentR != n){
+        return false;
+    }
+    Node* l = n->left.load(std::memory_order_relaxed);
+    Node* r = n->right.load(std::memory_order_relaxed);
+    if(l != nullptr && r != nullptr){
+        return false;
+    }
+    Node* splice = (l != nullptr) ? l : r;
+    setChild(parent, n, splice);
+    if(splice != nullptr){
+        splice->parent.store(parent, std::memory_order_release);
+    }
+    n->version.store(unlinked_, std::memory_order_release);
+    n->value.store(nullptr, std::memory_order_release);
+    return true;
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& a, const Key& b)
+{
+    if(a < b) return -1;
+    if(b < a) return 1;
+    return 0;
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::heightOf(Node* n)
+{
+    return (n == nullptr) ? 0 : n->height.load(std::memory_order_relaxed);
+}
+
+//replaces parent's child old with n
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::setChild(Links* parent, Node* old, Node* n)
+{
+    if(parent->left.load(std::memory_order_relaxed) == old){
+        parent->left.store(n, std::memory_order_release);
+    } else {
+        parent->right.store(n, std::memory_order_release);
+    }
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilNotChanging(Links* n)
+{
+    uint64_t v = n->version.load(std::memory_order_acquire);
+    unsigned spins = 0;
+    while((v & shrinking_) != 0 && n->version.load(std::memory_order_acquire) == v){
+        pause(spins);
+    }
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::pause(unsigned& spins)
+{
+    if(++spins > 64){
+        std::this_thread::yield();
+    }
+}
+
+/**
+* What n needs: unlinking (a routing node with at most one child), a
+* rotation (children's heights differ by more than one), a new height
+* (returned as a non-negative number), or nothing.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(Node* n) const
+{
+    Node* nL = n->left.load(std::memory_order_acquire);
+    Node* nR = n->right.load(std::memory_order_acquire);
+    if((nL == nullptr || nR == nullptr) && n->value.load(std::memory_order_acquire) == nullptr){
+        return unlinkRequired_;
+    }
+    int hN = n->height.load(std::memory_order_relaxed);
+    int hL0 = heightOf(nL);
+    int hR0 = heightOf(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1){
+        return rebalanceRequired_;
+    }
+    return (hN != hNRepl) ? hNRepl : nothingRequired_;
+}
+
+/**
+* Walks up from node repairing heights, rotating and unlinking routing
+* nodes until nothing is left to do. Each step locks only the node (for a
+* height change) or the node and its parent (for structural changes).
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(Links* node)
+{
+    while(node != nullptr && node->parent.load(std::memory_order_acquire) != nullptr){
+        Node* n = static_cast<Node*>(node);
+        int condition = nodeCondition(n);
+        if(condition == nothingRequired_ || (n->version.load(std::memory_order_acquire) & unlinked_) != 0){
+            return;
+        }
+        if(condition != unlinkRequired_ && condition != rebalanceRequired_){
+            Locker lock(n->lock);
+            node = fixHeight_nl(n);
+        } else {
+            Links* nParent = n->parent.load(std::memory_order_acquire);
+            Locker lockParent(nParent->lock);
+            if((nParent->version.load(std::memory_order_relaxed) & unlinked_) == 0 &&
+               n->parent.load(std::memory_order_relaxed) == nParent){
+                Locker lockNode(n->lock);
+                node = rebalance_nl(nParent, n);
+            }
+        }
+    }
+}
+
+/**
+* Stores node's new height if that is all it needs and returns the next
+* node to look at: its parent after a height change, node itself if it
+* needs more than that, or NULL if it needs nothing.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links* ConcurrentAVLTree<Key, Value>::fixHeight_nl(Links* node)
+{
+    if(node->parent.load(std::memory_order_relaxed) == nullptr){
+        return nullptr; //the root holder
+    }
+    Node* n = static_cast<Node*>(node);
+    int c = nodeCondition(n);
+    if(c == rebalanceRequired_ || c == unlinkRequired_){
+        return n;
+    }
+    if(c == nothingRequired_){
+        return nullptr;
+    }
+    n->height.store(c, std::memory_order_relaxed);
+    return n->parent.load(std::memory_order_relaxed);
+}
+
+//with nParent and n locked: unlinks, rotates or fixes the height of n
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links* ConcurrentAVLTree<Key, Value>::rebalance_nl(Links* nParent, Node* n)
+{
+    Node* nL = n->left.load(std::memory_order_relaxed);
+    Node* nR = n->right.load(std::memory_order_relaxed);
+    if((nL == nullptr || nR == nullptr) && n->value.load(std::memory_order_relaxed) == nullptr){
+        if(attemptUnlink_nl(nParent, n)){
+            EpochReclaimer::global().retire(n);
+            return fixHeight_nl(nParent);
+        }
+        return n;
+    }
+    int hN = n->height.load(std::memory_order_relaxed);
+    int hL0 = heightOf(nL);
+    int hR0 = heightOf(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1){
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    }
+    if(bal < -1){
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    }
+    if(hNRepl != hN){
+        n->height.store(hNRepl, std::memory_order_relaxed);
+        return fixHeight_nl(nParent);
+    }
+    return nullptr;
+}
+
+/**
+* n is left-heavy. Locks its left child nL (and nL's right child for a
+* double rotation) and rotates right. If the double rotation would leave
+* nL unbalanced, nL is rotated left first and n is left for the next step.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(Links* nParent, Node* n, Node* nL, int hR0)
+{
+    Locker lockLeft(nL->lock);
+    int hL = nL->height.load(std::memory_order_relaxed);
+    if(hL - hR0 <= 1){
+        return n; //retry
+    }
+    Node* nLR = nL->right.load(std::memory_order_relaxed);
+    int hLL0 = heightOf(nL->left.load(std::memory_order_relaxed));
+    int hLR0 = heightOf(nLR);
+    if(hLL0 >= hLR0){
+        return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+    }
+    {
+        Locker lockLR(nLR->lock);
+        int hLR = nLR->height.load(std::memory_order_relaxed);
+        if(hLL0 >= hLR){
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        }
+        int hLRL = heightOf(nLR->left.load(std::memory_order_relaxed));
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1){
+            return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+        }
+    }
+    return rebalanceToLeft_nl(n, nL, nLR, hLL0);
+}
+
+//mirror image of rebalanceToRight_nl
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(Links* nParent, Node* n, Node* nR, int hL0)
+{
+    Locker lockRight(nR->lock);
+    int hR = nR->height.load(std::memory_order_relaxed);
+    if(hL0 - hR >= -1){
+        return n; //retry
+    }
+    Node* nRL = nR->left.load(std::memory_order_relaxed);
+    int hRL0 = heightOf(nRL);
+    int hRR0 = heightOf(nR->right.load(std::memory_order_relaxed));
+    if(hRR0 >= hRL0){
+        return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+    }
+    {
+        Locker lockRL(nRL->lock);
+        int hRL = nRL->height.load(std::memory_order_relaxed);
+        if(hRR0 >= hRL){
+            return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL, hRR0);
+        }
+        int hRLR = heightOf(nRL->right.load(std::memory_order_relaxed));
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1){
+            return rotateLeftOverRight_nl(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+        }
+    }
+    return rebalanceToRight_nl(n, nR, nRL, hRR0);
+}
+
+/**
+* Rotates n's left child nL above n. Only n loses keys from its subtree, so
+* only n's version is marked while the links change. Returns the next node
+* that needs attention, as fixHeight_nl does.
+*
+* When n itself still needs work, nL keeps n's old height for now. nParent
+* was computed from that height, and the fixHeight_nl(nL) that follows the
+* repair of n then notices the difference and carries it upwards;
+* otherwise the change in height would never reach nParent.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rotateRight_nl(Links* nParent, Node* n, Node* nL, int hR, int hLL,
+                                               Node* nLR, int hLR)
+{
+    uint64_t nodeOVL = n->version.load(std::memory_order_relaxed);
+    int hOld = n->height.load(std::memory_order_relaxed);
+    n->version.store(nodeOVL | shrinking_, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    n->left.store(nLR, std::memory_order_release);
+    if(nLR != nullptr) nLR->parent.store(n, std::memory_order_release);
+    nL->right.store(n, std::memory_order_release);
+    n->parent.store(nL, std::memory_order_release);
+    setChild(nParent, n, nL);
+    nL->parent.store(nParent, std::memory_order_release);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height.store(hNRepl, std::memory_order_relaxed);
+    nL->height.store(1 + std::max(hLL, hNRepl), std::memory_order_relaxed);
+    n->version.store(nodeOVL + changeIncr_, std::memory_order_release);
+
+    int balN = hLR - hR;
+    if((balN < -1 || balN > 1) ||
+       ((nLR == nullptr || hR == 0) && n->value.load(std::memory_order_relaxed) == nullptr)){
+        nL->height.store(hOld, std::memory_order_relaxed);
+        return n;
+    }
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1) return nL;
+    if(hLL == 0 && nL->value.load(std::memory_order_relaxed) == nullptr) return nL;
+    return fixHeight_nl(nParent);
+}
+
+//mirror image of rotateRight_nl
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rotateLeft_nl(Links* nParent, Node* n, int hL, Node* nR, Node* nRL,
+                                              int hRL, int hRR)
+{
+    uint64_t nodeOVL = n->version.load(std::memory_order_relaxed);
+    int hOld = n->height.load(std::memory_order_relaxed);
+    n->version.store(nodeOVL | shrinking_, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    n->right.store(nRL, std::memory_order_release);
+    if(nRL != nullptr) nRL->parent.store(n, std::memory_order_release);
+    nR->left.store(n, std::memory_order_release);
+    n->parent.store(nR, std::memory_order_release);
+    setChild(nParent, n, nR);
+    nR->parent.store(nParent, std::memory_order_release);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height.store(hNRepl, std::memory_order_relaxed);
+    nR->height.store(1 + std::max(hNRepl, hRR), std::memory_order_relaxed);
+    n->version.store(nodeOVL + changeIncr_, std::memory_order_release);
+
+    int balN = hRL - hL;
+    if((balN < -1 || balN > 1) ||
+       ((nRL == nullptr || hL == 0) && n->value.load(std::memory_order_relaxed) == nullptr)){
+        nR->height.store(hOld, std::memory_order_relaxed);
+        return n;
+    }
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1) return nR;
+    if(hRR == 0 && nR->value.load(std::memory_order_relaxed) == nullptr) return nR;
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Double rotation that lifts nLR, the right child of n's left child nL,
+* above both. n and nL both lose keys and are marked while relinking.
+* A routing nL that is left with a single child is spliced out on the
+* spot, while it is still locked, since n may need the repair that
+* follows.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(Links* nParent, Node* n, Node* nL, int hR, int hLL,
+                                                       Node* nLR, int hLRL)
+{
+    uint64_t nodeOVL = n->version.load(std::memory_order_relaxed);
+    uint64_t leftOVL = nL->version.load(std::memory_order_relaxed);
+    int hOld = n->height.load(std::memory_order_relaxed);
+    Node* nLRL = nLR->left.load(std::memory_order_relaxed);
+    Node* nLRR = nLR->right.load(std::memory_order_relaxed);
+    int hLRR = heightOf(nLRR);
+
+    n->version.store(nodeOVL | shrinking_, std::memory_order_relaxed);
+    nL->version.store(leftOVL | shrinking_, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    n->left.store(nLRR, std::memory_order_release);
+    if(nLRR != nullptr) nLRR->parent.store(n, std::memory_order_release);
+    nL->right.store(nLRL, std::memory_order_release);
+    if(nLRL != nullptr) nLRL->parent.store(nL, std::memory_order_release);
+    nLR->left.store(nL, std::memory_order_release);
+    nL->parent.store(nLR, std::memory_order_release);
+    nLR->right.store(n, std::memory_order_release);
+    n->parent.store(nLR, std::memory_order_release);
+    setChild(nParent, n, nLR);
+    nLR->parent.store(nParent, std::memory_order_release);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height.store(hNRepl, std::memory_order_relaxed);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    if((hLL == 0 || hLRL == 0) && nL->value.load(std::memory_order_relaxed) == nullptr){
+        attemptUnlink_nl(nLR, nL);
+        EpochReclaimer::global().retire(nL);
+        hLRepl = std::max(hLL, hLRL);
+    } else {
+        nL->height.store(hLRepl, std::memory_order_relaxed);
+        nL->version.store(leftOVL + changeIncr_, std::memory_order_release);
+    }
+    nLR->height.store(1 + std::max(hLRepl, hNRepl), std::memory_order_relaxed);
+    n->version.store(nodeOVL + changeIncr_, std::memory_order_release);
+
+    int balN = hLRR - hR;
+    if((balN < -1 || balN > 1) ||
+       ((nLRR == nullptr || hR == 0) && n->value.load(std::memory_order_relaxed) == nullptr)){
+        nLR->height.store(hOld, std::memory_order_relaxed);
+        return n;
+    }
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1) return nLR;
+    return fixHeight_nl(nParent);
+}
+
+//mirror image of rotateRightOverLeft_nl
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Links*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(Links* nParent, Node* n, int hL, Node* nR, Node* nRL,
+                                                       int hRR, int hRLR)
+{
+    uint64_t nodeOVL = n->version.load(std::memory_order_relaxed);
+    uint64_t rightOVL = nR->version.load(std::memory_order_relaxed);
+    int hOld = n->height.load(std::memory_order_relaxed);
+    Node* nRLL = nRL->left.load(std::memory_order_relaxed);
+    Node* nRLR = nRL->right.load(std::memory_order_relaxed);
+    int hRLL = heightOf(nRLL);
+
+    n->version.store(nodeOVL | shrinking_, std::memory_order_relaxed);
+    nR->version.store(rightOVL | shrinking_, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    n->right.store(nRLL, std::memory_order_release);
+    if(nRLL != nullptr) nRLL->parent.store(n, std::memory_order_release);
+    nR->left.store(nRLR, std::memory_order_release);
+    if(nRLR != nullptr) nRLR->parent.store(nR, std::memory_order_release);
+    nRL->right.store(nR, std::memory_order_release);
+    nR->parent.store(nRL, std::memory_order_release);
+    nRL->left.store(n, std::memory_order_release);
+    n->parent.store(nRL, std::memory_order_release);
+    setChild(nParent, n, nRL);
+    nRL->parent.store(nParent, std::memory_order_release);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height.store(hNRepl, std::memory_order_relaxed);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    if((hRLR == 0 || hRR == 0) && nR->value.load(std::memory_order_relaxed) == nullptr){
+        attemptUnlink_nl(nRL, nR);
+        EpochReclaimer::global().retire(nR);
+        hRRepl = std::max(hRLR, hRR);
+    } else {
+        nR->height.store(hRRepl, std::memory_order_relaxed);
+        nR->version.store(rightOVL + changeIncr_, std::memory_order_release);
+    }
+    nRL->height.store(1 + std::max(hNRepl, hRRepl), std::memory_order_relaxed);
+    n->version.store(nodeOVL + changeIncr_, std::memory_order_release);
+
+    int balN = hRLL - hL;
+    if((balN < -1 || balN > 1) ||
+       ((nRLL == nullptr || hL == 0) && n->value.load(std::memory_order_relaxed) == nullptr)){
+        nRL->height.store(hOld, std::memory_order_relaxed);
+        return n;
+    }
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1) return nRL;
+    return fixHeight_nl(nParent);
+}
+
+
+#endif
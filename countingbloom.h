@@ -0,0 +1,202 @@
+#ifndef COUNTINGBLOOM_H
+#define COUNTINGBLOOM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+* A counting Bloom filter: an approximate set that never reports a key it
+* holds as missing, and reports a missing key as present with a small,
+* configurable probability. Each position is a 4-bit counter instead of a
+* bit, so keys can be removed as well as added. A counter that reaches 15
+* sticks there, which can only cost a false positive, never a false
+* negative.
+*
+* The filter is blocked: all the counters of a key lie in one 64-byte
+* block of 128 counters, so a query costs a single cache miss. This costs
+* a little accuracy against an unblocked filter of the same size.
+*
+* Hash is the hash function object for keys, std::hash by default.
+*/
+template <typename Key, typename Hash = std::hash<Key> >
+class CountingBloomFilter
+{
+public:
+    CountingBloomFilter();
+    CountingBloomFilter(size_t expectedKeys, double falsePositiveRate);
+
+    void add(const Key& key);
+    void remove(const Key& key);
+    bool mayContain(const Key& key) const;
+    void clear();
+
+    size_t size() const;
+    size_t bytes() const;
+    unsigned hashes() const;
+
+private:
+    static const size_t wordsPerBlock_ = 8;
+    static const unsigned maxHashes_ = 8;
+
+    static uint64_t hash(const Key& key);
+    uint64_t* block(uint64_t h);
+    const uint64_t* block(uint64_t h) const;
+
+    // blockCount_ blocks plus slack for aligning the first one
+    std::vector<uint64_t> words_;
+    size_t blockCount_;
+    unsigned hashes_;
+    size_t size_;
+};
+
+/**
+* An unsized filter, which allocates nothing. It must be replaced by a
+* sized one before keys are added or queried.
+*/
+template<typename Key, typename Hash>
+CountingBloomFilter<Key, Hash>::CountingBloomFilter() :
+    blockCount_(0),
+    hashes_(0),
+    size_(0)
+{
+
+}
+
+/**
+* Sizes the filter for expectedKeys keys at the given false positive
+* rate, using the usual optimum of -n ln p / (ln 2)^2 counters and
+* (counters / n) ln 2 hash functions, capped at eight.
+*/
+template<typename Key, typename Hash>
+CountingBloomFilter<Key, Hash>::CountingBloomFilter(size_t expectedKeys, double falsePositiveRate) :
+    size_(0)
+{
+    double n = expectedKeys > 0 ? double(expectedKeys) : 1.0;
+    double p = (falsePositiveRate > 0 && falsePositiveRate < 1) ? falsePositiveRate : 0.01;
+    double ln2 = std::log(2.0);
+    double counters = std::ceil(-n * std::log(p) / (ln2 * ln2));
+    blockCount_ = static_cast<size_t>(std::ceil(counters / 128));
+    if(blockCount_ == 0)
+    {
+        blockCount_ = 1;
+    }
+    double k = std::floor(counters / n * ln2 + 0.5);
+    hashes_ = k < 1 ? 1 : (k > maxHashes_ ? maxHashes_ : static_cast<unsigned>(k));
+    words_.assign((blockCount_ + 1) * wordsPerBlock_, 0);
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::add(const Key& key)
+{
+    uint64_t h = hash(key);
+    uint64_t* b = block(h);
+    uint64_t g = h * 0xFF51AFD7ED558CCDull;
+    for(unsigned i = 0; i < hashes_; ++i)
+    {
+        unsigned pos = static_cast<unsigned>(g >> (57 - 7 * i)) & 127;
+        uint64_t& w = b[pos >> 4];
+        unsigned shift = (pos & 15) * 4;
+        if(((w >> shift) & 15) != 15)
+        {
+            w += uint64_t(1) << shift;
+        }
+    }
+    ++size_;
+}
+
+/**
+* Removes one copy of key, which must have been added and not removed
+* since. Saturated counters are left alone.
+*/
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::remove(const Key& key)
+{
+    uint64_t h = hash(key);
+    uint64_t* b = block(h);
+    uint64_t g = h * 0xFF51AFD7ED558CCDull;
+    for(unsigned i = 0; i < hashes_; ++i)
+    {
+        unsigned pos = static_cast<unsigned>(g >> (57 - 7 * i)) & 127;
+        uint64_t& w = b[pos >> 4];
+        unsigned shift = (pos & 15) * 4;
+        uint64_t c = (w >> shift) & 15;
+        if(c != 15 && c != 0)
+        {
+            w -= uint64_t(1) << shift;
+        }
+    }
+    --size_;
+}
+
+template<typename Key, typename Hash>
+bool CountingBloomFilter<Key, Hash>::mayContain(const Key& key) const
+{
+    uint64_t h = hash(key);
+    const uint64_t* b = block(h);
+    uint64_t g = h * 0xFF51AFD7ED558CCDull;
+    for(unsigned i = 0; i < hashes_; ++i)
+    {
+        unsigned pos = static_cast<unsigned>(g >> (57 - 7 * i)) & 127;
+        if(((b[pos >> 4] >> ((pos & 15) * 4)) & 15) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Key, typename Hash>
+void CountingBloomFilter<Key, Hash>::clear()
+{
+    std::fill(words_.begin(), words_.end(), 0);
+    size_ = 0;
+}
+
+//number of keys added and not removed
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Hash>
+size_t CountingBloomFilter<Key, Hash>::bytes() const
+{
+    return words_.size() * sizeof(uint64_t);
+}
+
+template<typename Key, typename Hash>
+unsigned CountingBloomFilter<Key, Hash>::hashes() const
+{
+    return hashes_;
+}
+
+template<typename Key, typename Hash>
+uint64_t CountingBloomFilter<Key, Hash>::hash(const Key& key)
+{
+    uint64_t h = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 31);
+}
+
+//the cache-aligned block picked by the high half of h
+template<typename Key, typename Hash>
+uint64_t* CountingBloomFilter<Key, Hash>::block(uint64_t h)
+{
+    return const_cast<uint64_t*>(static_cast<const CountingBloomFilter<Key, Hash>*>(this)->block(h));
+}
+
+template<typename Key, typename Hash>
+const uint64_t* CountingBloomFilter<Key, Hash>::block(uint64_t h) const
+{
+    const uint64_t* base = words_.data();
+    size_t skew = (reinterpret_cast<uintptr_t>(base) / sizeof(uint64_t)) % wordsPerBlock_;
+    base += (wordsPerBlock_ - skew) % wordsPerBlock_;
+    size_t i = static_cast<size_t>(((h >> 32) * blockCount_) >> 32);
+    return base + i * wordsPerBlock_;
+}
+
+
+#endif
@@ -0,0 +1,778 @@
+#ifndef DURABLEAVL_H
+#define DURABLEAVL_H
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avlbst.h"
+
+/**
+* An append-only log file of CRC-checked records, the byte level of
+* DurableAVLTree. The file starts with a 32-byte header naming the key
+* and value sizes. Each record is framed as
+*
+*   crc32 (4 bytes) | payload length (4 bytes) | payload
+*
+* where the CRC covers the length and the payload. A crash can leave a
+* torn record at the end; replay stops at the first record whose frame or
+* CRC is bad and cuts the file back to the records before it.
+*
+* Not thread-safe; DurableAVLTree serializes the calls.
+*/
+class WriteAheadLog
+{
+public:
+    WriteAheadLog(const std::string& path, uint32_t keySize, uint32_t valueSize);
+    ~WriteAheadLog();
+
+    template<typename Fn>
+    size_t replay(Fn fn);
+    static void frame(std::vector<char>& out, const void* payload, uint32_t length);
+    void append(const std::vector<char>& records);
+    void sync();
+    void reset();
+    size_t bytes() const;
+
+    static uint32_t crc32(const void* data, size_t length);
+    static void syncDirectory(const std::string& path);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint64_t reserved;
+    };
+
+    static const uint32_t version_ = 1;
+    // a record longer than this is taken for garbage
+    static const uint32_t maxRecord_ = 1u << 20;
+
+    void writeAll(int fd, const char* data, size_t length, const std::string& what);
+    void fail(const std::string& what) const;
+
+    WriteAheadLog(const WriteAheadLog&);
+    WriteAheadLog& operator=(const WriteAheadLog&);
+
+    std::string path_;
+    Header header_;
+    int fd_;
+    size_t bytes_;
+};
+
+/**
+* Opens the log at path, creating an empty one if there is none. Throws
+* std::runtime_error if it cannot, or if the file is not a log for keys
+* and values of these sizes.
+*/
+inline WriteAheadLog::WriteAheadLog(const std::string& path, uint32_t keySize, uint32_t valueSize) :
+    path_(path),
+    fd_(-1),
+    bytes_(0)
+{
+    std::memset(&header_, 0, sizeof(header_));
+    std::memcpy(header_.magic, "BSTWAL", 7);
+    header_.version = version_;
+    header_.byteOrder = 0x01020304;
+    header_.keySize = keySize;
+    header_.valueSize = valueSize;
+    fd_ = ::open(path_.c_str(), O_RDWR);
+    if(fd_ < 0 && errno == ENOENT)
+    {
+        reset();
+        return;
+    }
+    if(fd_ < 0)
+    {
+        fail("cannot open");
+    }
+    Header h;
+    ssize_t n = ::pread(fd_, &h, sizeof(h), 0);
+    std::string problem;
+    if(n != static_cast<ssize_t>(sizeof(h)) || std::memcmp(h.magic, "BSTWAL", 7) != 0)
+    {
+        problem = "is not a write-ahead log";
+    }
+    else if(h.byteOrder != header_.byteOrder)
+    {
+        problem = "was written with another byte order";
+    }
+    else if(h.version != version_)
+    {
+        problem = "has unsupported version " + std::to_string(h.version);
+    }
+    else if(h.keySize != keySize || h.valueSize != valueSize)
+    {
+        problem = "holds keys or values of another size";
+    }
+    if(!problem.empty())
+    {
+        ::close(fd_);
+        fd_ = -1;
+        throw std::runtime_error("write-ahead log " + path_ + " " + problem);
+    }
+    struct stat st;
+    if(::fstat(fd_, &st) != 0)
+    {
+        fail("cannot stat");
+    }
+    bytes_ = static_cast<size_t>(st.st_size);
+}
+
+inline WriteAheadLog::~WriteAheadLog()
+{
+    if(fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+/**
+* Calls fn(payload, length) for every intact record in order and returns
+* how many there were. A torn or corrupt tail is cut off, so that new
+* records follow the last good one. The file is read in one pass.
+*/
+template<typename Fn>
+size_t WriteAheadLog::replay(Fn fn)
+{
+    std::vector<char> data(bytes_);
+    size_t got = 0;
+    while(got < data.size())
+    {
+        ssize_t n = ::pread(fd_, data.data() + got, data.size() - got, static_cast<off_t>(got));
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            fail("cannot read");
+        }
+        got += static_cast<size_t>(n);
+    }
+    size_t pos = sizeof(Header);
+    size_t records = 0;
+    while(data.size() - pos >= 8)
+    {
+        uint32_t crc, length;
+        std::memcpy(&crc, data.data() + pos, 4);
+        std::memcpy(&length, data.data() + pos + 4, 4);
+        if(length > maxRecord_ || length > data.size() - pos - 8
+           || crc32(data.data() + pos + 4, length + 4) != crc)
+        {
+            break;
+        }
+        fn(data.data() + pos + 8, length);
+        pos += 8 + length;
+        ++records;
+    }
+    if(pos != bytes_)
+    {
+        if(::ftruncate(fd_, static_cast<off_t>(pos)) != 0 || ::fsync(fd_) != 0)
+        {
+            fail("cannot truncate");
+        }
+        bytes_ = pos;
+    }
+    return records;
+}
+
+//appends the framed payload to out
+inline void WriteAheadLog::frame(std::vector<char>& out, const void* payload, uint32_t length)
+{
+    size_t at = out.size();
+    out.resize(at + 8 + length);
+    char* p = out.data() + at;
+    std::memcpy(p + 4, &length, 4);
+    std::memcpy(p + 8, payload, length);
+    uint32_t crc = crc32(p + 4, length + 4);
+    std::memcpy(p, &crc, 4);
+}
+
+//writes framed records at the end of the file; sync() makes them durable
+inline void WriteAheadLog::append(const std::vector<char>& records)
+{
+    if(::lseek(fd_, static_cast<off_t>(bytes_), SEEK_SET) < 0)
+    {
+        fail("cannot seek");
+    }
+    writeAll(fd_, records.data(), records.size(), path_);
+    bytes_ += records.size();
+}
+
+inline void WriteAheadLog::sync()
+{
+    if(::fdatasync(fd_) != 0)
+    {
+        fail("cannot sync");
+    }
+}
+
+/**
+* Replaces the log with an empty one. The new file is written and synced
+* under a temporary name and renamed over the old one, so a crash leaves
+* one or the other.
+*/
+inline void WriteAheadLog::reset()
+{
+    std::string tmp = path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        fail("cannot create");
+    }
+    try
+    {
+        writeAll(fd, reinterpret_cast<const char*>(&header_), sizeof(header_), tmp);
+    }
+    catch(...)
+    {
+        ::close(fd);
+        throw;
+    }
+    if(::fsync(fd) != 0 || ::rename(tmp.c_str(), path_.c_str()) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        fail("cannot replace");
+    }
+    if(fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+    fd_ = fd;
+    bytes_ = sizeof(header_);
+    syncDirectory(path_);
+}
+
+//the size of the file, header included
+inline size_t WriteAheadLog::bytes() const
+{
+    return bytes_;
+}
+
+/**
+* The CRC-32 of IEEE 802.3 (the one zlib computes), a byte at a time from
+* a table built on first use.
+*/
+inline uint32_t WriteAheadLog::crc32(const void* data, size_t length)
+{
+    struct Table
+    {
+        Table()
+        {
+            for(uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for(int k = 0; k < 8; ++k)
+                {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+        uint32_t entries[256];
+    };
+    static const Table table;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < length; ++i)
+    {
+        crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+* Syncs the directory holding path, which makes a rename or a new file in
+* it durable.
+*/
+inline void WriteAheadLog::syncDirectory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if(fd < 0 || ::fsync(fd) != 0)
+    {
+        int err = errno;
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        errno = err;
+        throw std::runtime_error("write-ahead log: cannot sync directory " + dir + ": " + std::strerror(errno));
+    }
+    ::close(fd);
+}
+
+inline void WriteAheadLog::writeAll(int fd, const char* data, size_t length, const std::string& what)
+{
+    while(length > 0)
+    {
+        ssize_t n = ::write(fd, data, length);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            if(n == 0)
+            {
+                errno = EIO;
+            }
+            throw std::runtime_error("write-ahead log: cannot write " + what + ": " + std::strerror(errno));
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+}
+
+inline void WriteAheadLog::fail(const std::string& what) const
+{
+    throw std::runtime_error("write-ahead log: " + what + " " + path_ + ": " + std::strerror(errno));
+}
+
+/**
+* An AVLTree whose contents survive crashes. It lives in a directory that
+* holds a checkpoint, a binary snapshot written by AVLTree::save, and a
+* WriteAheadLog of the updates made since. Opening the directory loads
+* the checkpoint and replays the log.
+*
+* Every insert and remove is applied to the tree and appended to an
+* in-memory batch under one lock. A flusher thread writes the batch out
+* and syncs it, and while it waits on the disk the next batch fills up,
+* so updates from many threads share one fsync (group commit). With
+* waitForCommit, an update returns only once its record is durable;
+* without it, updates return at once and sync() waits for all of them.
+* A batch nobody waits for is held back for up to 2 ms or 1 MB so that
+* it costs fewer fsyncs; a crash loses at most the updates of the last
+* few milliseconds. Lookups see updates
+* as soon as they are applied, before they are durable.
+*
+* checkpoint() saves the tree and starts an empty log, which bounds the
+* replay time. It also runs on its own once the log outgrows
+* checkpointBytes. The pending batch is written and synced to the old
+* log first, so that the old log holds every update the checkpoint does.
+* A crash between saving and starting the new log leaves the new
+* checkpoint with that old log, and replaying all of it on top of the
+* checkpoint ends in the same state: inserts and removes only overwrite,
+* and the last record for each key is the one the checkpoint holds.
+*
+* Keys and values must be trivially copyable, as for snapshots.
+*/
+template <typename Key, typename Value>
+class DurableAVLTree
+{
+public:
+    explicit DurableAVLTree(const std::string& dir, bool waitForCommit = true,
+                            size_t checkpointBytes = 64u << 20);
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+
+    template<typename Fn>
+    void for_each(Fn fn) const;
+
+    void sync();
+    void checkpoint();
+    size_t logBytes() const;
+    size_t commits() const;
+    size_t replayed() const;
+
+private:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "durable trees need trivially copyable keys and values");
+
+    enum Op { Insert = 1, Remove = 2 };
+
+    // how long and how far a batch nobody waits for may grow
+    static const unsigned commitDelayMs_ = 2;
+    static const size_t batchLimit_ = 1u << 20;
+
+    void append(Op op, const Key& key, const Value* value);
+    void waitFor(std::unique_lock<std::mutex>& lock, uint64_t lsn);
+    void checkpointLocked(std::unique_lock<std::mutex>& lock);
+    void flushLoop();
+    void apply(const char* payload, size_t length);
+    static const std::string& makeDirectory(const std::string& dir);
+
+    DurableAVLTree(const DurableAVLTree&);
+    DurableAVLTree& operator=(const DurableAVLTree&);
+
+    std::string checkpointPath_;
+    bool waitForCommit_;
+    size_t checkpointBytes_;
+    AVLTree<Key, Value> tree_;
+    WriteAheadLog log_;
+
+    mutable std::mutex lock_;
+    // wakes the flusher
+    std::condition_variable work_;
+    // wakes updates waiting for their records, and checkpoint()
+    std::condition_variable committed_;
+    // records appended to batch_ so far, and those known to be durable
+    uint64_t appended_;
+    uint64_t durable_;
+    std::vector<char> batch_;
+    size_t batchBytes_;
+    // callers blocked in waitFor
+    size_t waiting_;
+    bool flushing_;
+    bool checkpointing_;
+    bool stop_;
+    // set by the flusher on an I/O error; every later update throws it
+    std::string error_;
+    size_t commits_;
+    size_t replayed_;
+    std::thread flusher_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the DurableAVLTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Opens the tree in dir, creating the directory if needed, and starts the
+* flusher. checkpointBytes of 0 turns automatic checkpoints off. Throws
+* std::runtime_error if the directory, the checkpoint or the log cannot
+* be used.
+*/
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::DurableAVLTree(const std::string& dir, bool waitForCommit, size_t checkpointBytes) :
+    checkpointPath_(makeDirectory(dir) + "/checkpoint.snap"),
+    waitForCommit_(waitForCommit),
+    checkpointBytes_(checkpointBytes),
+    log_(dir + "/wal.log", sizeof(Key), sizeof(Value)),
+    appended_(0),
+    durable_(0),
+    batchBytes_(0),
+    waiting_(0),
+    flushing_(false),
+    checkpointing_(false),
+    stop_(false),
+    commits_(0),
+    replayed_(0)
+{
+    if(::access(checkpointPath_.c_str(), F_OK) == 0)
+    {
+        tree_.load(checkpointPath_);
+    }
+    replayed_ = log_.replay([this](const char* payload, size_t length) { apply(payload, length); });
+    flusher_ = std::thread(&DurableAVLTree<Key, Value>::flushLoop, this);
+}
+
+/**
+* Waits for every update to be durable and stops the flusher.
+*/
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::~DurableAVLTree()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    work_.notify_one();
+    flusher_.join();
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    append(Insert, new_item.first, &new_item.second);
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::remove(const Key& key)
+{
+    append(Remove, key, nullptr);
+}
+
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if(it == tree_.end())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::contains(const Key& key) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return tree_.find(key) != tree_.end();
+}
+
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::empty() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return tree_.empty();
+}
+
+/**
+* Calls fn(item) with a const std::pair<const Key, Value>& for every item,
+* in key order, holding the lock throughout.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void DurableAVLTree<Key, Value>::for_each(Fn fn) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    tree_.visit_inorder([&fn](const std::pair<const Key, Value>& item) { fn(item); });
+}
+
+/**
+* Waits until every update made so far is durable.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::sync()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    waitFor(lock, appended_);
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpoint()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    checkpointLocked(lock);
+}
+
+//the size of the log, including records not yet written out
+template<class Key, class Value>
+size_t DurableAVLTree<Key, Value>::logBytes() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return log_.bytes() + batchBytes_;
+}
+
+//how many batches the flusher has synced
+template<class Key, class Value>
+size_t DurableAVLTree<Key, Value>::commits() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return commits_;
+}
+
+//how many log records were replayed when the tree was opened
+template<class Key, class Value>
+size_t DurableAVLTree<Key, Value>::replayed() const
+{
+    return replayed_;
+}
+
+/**
+* Applies the update and adds its record to the batch in one critical
+* section, so the log holds the updates in the order they were applied.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::append(Op op, const Key& key, const Value* value)
+{
+    char payload[1 + sizeof(Key) + sizeof(Value)];
+    payload[0] = static_cast<char>(op);
+    std::memcpy(payload + 1, &key, sizeof(Key));
+    uint32_t length = 1 + sizeof(Key);
+    if(value != nullptr)
+    {
+        std::memcpy(payload + length, value, sizeof(Value));
+        length += sizeof(Value);
+    }
+    std::unique_lock<std::mutex> lock(lock_);
+    if(!error_.empty())
+    {
+        throw std::runtime_error(error_);
+    }
+    if(op == Insert)
+    {
+        tree_.insert(std::make_pair(key, *value));
+    }
+    else
+    {
+        tree_.remove(key);
+    }
+    size_t before = batch_.size();
+    WriteAheadLog::frame(batch_, payload, length);
+    batchBytes_ += batch_.size() - before;
+    uint64_t lsn = ++appended_;
+    // the flusher sleeps on an empty batch, or lets a small one grow
+    if(before == 0 || (batchBytes_ >= batchLimit_ && batchBytes_ - (batch_.size() - before) < batchLimit_))
+    {
+        work_.notify_one();
+    }
+    if(checkpointBytes_ != 0 && log_.bytes() + batchBytes_ > checkpointBytes_)
+    {
+        checkpointLocked(lock);
+    }
+    if(waitForCommit_)
+    {
+        waitFor(lock, lsn);
+    }
+}
+
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::waitFor(std::unique_lock<std::mutex>& lock, uint64_t lsn)
+{
+    ++waiting_;
+    work_.notify_one();
+    committed_.wait(lock, [this, lsn]() { return durable_ >= lsn || !error_.empty(); });
+    --waiting_;
+    if(durable_ < lsn)
+    {
+        throw std::runtime_error(error_);
+    }
+}
+
+/**
+* Saves the tree and empties the log, while the flusher is kept idle. The
+* batch goes into the old log before the save; see the class comment.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpointLocked(std::unique_lock<std::mutex>& lock)
+{
+    if(checkpointing_)
+    {
+        // the running one saves the tree after this update
+        committed_.wait(lock, [this]() { return !checkpointing_; });
+        return;
+    }
+    checkpointing_ = true;
+    committed_.wait(lock, [this]() { return !flushing_; });
+    try
+    {
+        if(!batch_.empty())
+        {
+            log_.append(batch_);
+            log_.sync();
+            batch_.clear();
+            batchBytes_ = 0;
+            durable_ = appended_;
+        }
+        tree_.save(checkpointPath_);
+        log_.reset();
+    }
+    catch(...)
+    {
+        checkpointing_ = false;
+        work_.notify_one();
+        committed_.notify_all();
+        throw;
+    }
+    checkpointing_ = false;
+    committed_.notify_all();
+}
+
+/**
+* Writes and syncs whatever has been appended, one batch at a time, until
+* stopped with nothing left to write.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::flushLoop()
+{
+    std::vector<char> writing;
+    std::unique_lock<std::mutex> lock(lock_);
+    while(true)
+    {
+        work_.wait(lock, [this]() { return (stop_ || !batch_.empty()) && !checkpointing_; });
+        if(waiting_ == 0 && !stop_)
+        {
+            // nobody waits for this batch yet, so let it grow
+            work_.wait_for(lock, std::chrono::milliseconds(static_cast<int>(commitDelayMs_)), [this]() {
+                return stop_ || waiting_ > 0 || batchBytes_ >= batchLimit_;
+            });
+            if(checkpointing_ || batch_.empty())
+            {
+                continue;
+            }
+        }
+        if(batch_.empty() || !error_.empty())
+        {
+            break;
+        }
+        writing.swap(batch_);
+        batchBytes_ = 0;
+        uint64_t upTo = appended_;
+        flushing_ = true;
+        lock.unlock();
+        std::string error;
+        try
+        {
+            log_.append(writing);
+            log_.sync();
+        }
+        catch(const std::exception& e)
+        {
+            error = e.what();
+        }
+        writing.clear();
+        lock.lock();
+        flushing_ = false;
+        if(error.empty())
+        {
+            durable_ = upTo;
+            ++commits_;
+        }
+        else
+        {
+            error_ = error;
+        }
+        committed_.notify_all();
+    }
+}
+
+template<class Key, class Value>
+const std::string& DurableAVLTree<Key, Value>::makeDirectory(const std::string& dir)
+{
+    if(::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("durable tree: cannot create " + dir + ": " + std::strerror(errno));
+    }
+    return dir;
+}
+
+//replays one log record
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::apply(const char* payload, size_t length)
+{
+    Key key;
+    std::memcpy(&key, payload + 1, sizeof(Key));
+    if(payload[0] == Insert && length == 1 + sizeof(Key) + sizeof(Value))
+    {
+        Value value;
+        std::memcpy(&value, payload + 1 + sizeof(Key), sizeof(Value));
+        tree_.insert(std::make_pair(key, value));
+    }
+    else if(payload[0] == Remove && length == 1 + sizeof(Key))
+    {
+        tree_.remove(key);
+    }
+}
+
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* Epoch-based memory reclamation for lock-free readers.
+*
+* A thread pins itself (with a Guard) before it reads shared nodes and
+* unpins when it is done. Memory unlinked from a shared structure is
+* handed to retire() instead of being deleted; it is freed only after the
+* global epoch has advanced twice past the epoch in which it was retired,
+* and the epoch can only advance once every pinned thread has observed the
+* current one. By then no thread can still hold a pointer to it.
+*
+* Every thread gets a record on first use. Records of exited threads are
+* reused, and whatever garbage they still held is passed on to the
+* remaining threads. There is one process-wide instance, global().
+*/
+class EpochReclaimer
+{
+public:
+    static EpochReclaimer& global();
+
+    /**
+    * Pins the calling thread for its lifetime. Guards may be nested.
+    */
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+    };
+
+    template<typename T>
+    void retire(T* p);
+
+    ~EpochReclaimer();
+
+private:
+    struct Retired
+    {
+        void* ptr;
+        void (*free)(void*);
+        uint64_t epoch;
+    };
+
+    struct Record
+    {
+        // (epoch << 1) | 1 while pinned, 0 otherwise
+        std::atomic<uint64_t> state;
+        std::atomic<bool> taken;
+        unsigned depth;
+        std::vector<Retired> retired;
+        Record* next;
+    };
+
+    // Gives the record back when its thread exits.
+    struct ThreadSlot
+    {
+        ThreadSlot();
+        ~ThreadSlot();
+        Record* record;
+    };
+
+    EpochReclaimer();
+    EpochReclaimer(const EpochReclaimer&);
+    EpochReclaimer& operator=(const EpochReclaimer&);
+
+    template<typename T>
+    static void destroy(void* p);
+
+    Record* self();
+    Record* acquireRecord();
+    void releaseRecord(Record* r);
+    void pin();
+    void unpin();
+    bool tryAdvance();
+    void collect(Record* r);
+    static void freeOld(std::vector<Retired>& items, uint64_t safe);
+
+    static const size_t collectThreshold_ = 128;
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<Record*> records_;
+    std::mutex orphanLock_;
+    std::vector<Retired> orphans_;
+};
+
+inline EpochReclaimer::EpochReclaimer() :
+    epoch_(2),
+    records_(nullptr)
+{
+
+}
+
+/**
+* Frees everything still waiting. Runs at process exit, after the other
+* threads are gone.
+*/
+inline EpochReclaimer::~EpochReclaimer()
+{
+    freeOld(orphans_, UINT64_MAX);
+    Record* r = records_.load();
+    while(r != nullptr)
+    {
+        Record* next = r->next;
+        freeOld(r->retired, UINT64_MAX);
+        delete r;
+        r = next;
+    }
+}
+
+inline EpochReclaimer& EpochReclaimer::global()
+{
+    static EpochReclaimer reclaimer;
+    return reclaimer;
+}
+
+inline EpochReclaimer::Guard::Guard()
+{
+    EpochReclaimer::global().pin();
+}
+
+inline EpochReclaimer::Guard::~Guard()
+{
+    EpochReclaimer::global().unpin();
+}
+
+/**
+* Schedules p to be deleted once no pinned thread can be using it. p must
+* already be unreachable for threads that pin from now on.
+*/
+template<typename T>
+void EpochReclaimer::retire(T* p)
+{
+    Record* r = self();
+    Retired item = { p, &destroy<T>, epoch_.load(std::memory_order_acquire) };
+    r->retired.push_back(item);
+    if(r->retired.size() >= collectThreshold_)
+    {
+        collect(r);
+    }
+}
+
+template<typename T>
+void EpochReclaimer::destroy(void* p)
+{
+    delete static_cast<T*>(p);
+}
+
+inline EpochReclaimer::ThreadSlot::ThreadSlot() :
+    record(nullptr)
+{
+
+}
+
+inline EpochReclaimer::ThreadSlot::~ThreadSlot()
+{
+    if(record != nullptr)
+    {
+        EpochReclaimer::global().releaseRecord(record);
+    }
+}
+
+//the calling thread's record, claimed on first use
+inline EpochReclaimer::Record* EpochReclaimer::self()
+{
+    static thread_local ThreadSlot slot;
+    if(slot.record == nullptr)
+    {
+        slot.record = acquireRecord();
+    }
+    return slot.record;
+}
+
+//reuses the record of an exited thread, or adds a new one to the list
+inline EpochReclaimer::Record* EpochReclaimer::acquireRecord()
+{
+    for(Record* r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next)
+    {
+        bool expected = false;
+        if(!r->taken.load(std::memory_order_relaxed) && r->taken.compare_exchange_strong(expected, true))
+        {
+            return r;
+        }
+    }
+    Record* r = new Record;
+    r->state = 0;
+    r->taken = true;
+    r->depth = 0;
+    r->next = records_.load(std::memory_order_relaxed);
+    while(!records_.compare_exchange_weak(r->next, r, std::memory_order_release))
+    {
+    }
+    return r;
+}
+
+inline void EpochReclaimer::releaseRecord(Record* r)
+{
+    {
+        std::lock_guard<std::mutex> guard(orphanLock_);
+        orphans_.insert(orphans_.end(), r->retired.begin(), r->retired.end());
+    }
+    r->retired.clear();
+    r->depth = 0;
+    r->state.store(0, std::memory_order_release);
+    r->taken.store(false, std::memory_order_release);
+}
+
+/**
+* Publishes the current epoch in the thread's record. The epoch is read
+* again after the store is visible, so that a concurrent advance cannot
+* slip between the two and leave the record one epoch behind unnoticed.
+*/
+inline void EpochReclaimer::pin()
+{
+    Record* r = self();
+    if(r->depth++ > 0)
+    {
+        return;
+    }
+    uint64_t e = epoch_.load(std::memory_order_acquire);
+    while(true)
+    {
+        r->state.exchange((e << 1) | 1, std::memory_order_seq_cst);
+        uint64_t now = epoch_.load(std::memory_order_seq_cst);
+        if(now == e)
+        {
+            return;
+        }
+        e = now;
+    }
+}
+
+inline void EpochReclaimer::unpin()
+{
+    Record* r = self();
+    if(--r->depth == 0)
+    {
+        r->state.store(0, std::memory_order_release);
+    }
+}
+
+//moves the global epoch forward if every pinned thread has seen it
+inline bool EpochReclaimer::tryAdvance()
+{
+    uint64_t e = epoch_.load(std::memory_order_seq_cst);
+    for(Record* r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next)
+    {
+        uint64_t s = r->state.load(std::memory_order_seq_cst);
+        if((s & 1) != 0 && (s >> 1) != e)
+        {
+            return false;
+        }
+    }
+    return epoch_.compare_exchange_strong(e, e + 1);
+}
+
+/**
+* Frees the caller's retired memory that has become safe, after trying to
+* advance the epoch. Orphaned garbage from exited threads is collected too
+* when its lock is free.
+*/
+inline void EpochReclaimer::collect(Record* r)
+{
+    tryAdvance();
+    uint64_t safe = epoch_.load(std::memory_order_acquire) - 2;
+    freeOld(r->retired, safe);
+    std::unique_lock<std::mutex> guard(orphanLock_, std::try_to_lock);
+    if(guard.owns_lock())
+    {
+        freeOld(orphans_, safe);
+    }
+}
+
+//frees the items retired at or before epoch safe and keeps the rest
+inline void EpochReclaimer::freeOld(std::vector<Retired>& items, uint64_t safe)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < items.size(); ++i)
+    {
+        if(items[i].epoch <= safe)
+        {
+            items[i].free(items[i].ptr);
+        }
+        else
+        {
+            items[kept++] = items[i];
+        }
+    }
+    items.resize(kept);
+}
+
+#endif
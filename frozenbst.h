@@ -0,0 +1,273 @@
+#ifndef FROZENBST_H
+#define FROZENBST_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable snapshot of a search tree stored as two flat arrays in
+* Eytzinger (breadth-first) order: the root is at index 1 and the children
+* of index k are at 2k and 2k + 1. It is what AVLTree::freeze() returns.
+*
+* There are no pointers to chase and no per-node overhead, so a key costs
+* sizeof(Key) + sizeof(Value) bytes instead of a whole node. The search is
+* branchless: each step only picks the child index with a comparison, so
+* it never mispredicts. The descendants of k a few levels down are
+* consecutive: sixteen keys four levels down start at 16k, which for ints
+* is a cache line's worth. Each step prefetches that block, so the cache
+* misses of the descent overlap instead of following one another.
+*
+* The iterator walks the implicit tree in order. Dereferencing it yields a
+* std::pair of const references, since keys and values are stored apart.
+*/
+template <typename Key, typename Value>
+class FrozenTree
+{
+public:
+    FrozenTree();
+    explicit FrozenTree(const std::vector<std::pair<Key, Value> >& sorted);
+
+    /**
+    * An in-order iterator. operator-> goes through a small proxy that
+    * holds the pair of references.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, const Value&> reference;
+        struct pointer
+        {
+            reference item;
+            const reference* operator->() const { return &item; }
+        };
+
+        iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+
+    protected:
+        friend class FrozenTree<Key, Value>;
+        iterator(const FrozenTree<Key, Value>* tree, size_t k);
+        const FrozenTree<Key, Value>* tree_;
+        size_t k_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+
+    bool empty() const;
+    size_t size() const;
+
+private:
+    size_t fill(const std::vector<std::pair<Key, Value> >& sorted, size_t i, size_t k);
+    size_t search(const Key& key) const;
+
+    // the keys of one cache line, rounded down to a power of two
+    static const size_t prefetchStride_ = sizeof(Key) <= 4 ? 16 : (sizeof(Key) <= 8 ? 8 : (sizeof(Key) <= 16 ? 4 : 2));
+
+    // both hold a dummy entry at index 0 so that the root is at 1
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    size_t size_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the FrozenTree::iterator class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+FrozenTree<Key, Value>::iterator::iterator() :
+    tree_(nullptr),
+    k_(0)
+{
+
+}
+
+template<class Key, class Value>
+FrozenTree<Key, Value>::iterator::iterator(const FrozenTree<Key, Value>* tree, size_t k) :
+    tree_(tree),
+    k_(k)
+{
+
+}
+
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator::reference FrozenTree<Key, Value>::iterator::operator*() const
+{
+    return reference(tree_->keys_[k_], tree_->values_[k_]);
+}
+
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator::pointer FrozenTree<Key, Value>::iterator::operator->() const
+{
+    pointer p = { **this };
+    return p;
+}
+
+template<class Key, class Value>
+bool FrozenTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return k_ == rhs.k_;
+}
+
+template<class Key, class Value>
+bool FrozenTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return k_ != rhs.k_;
+}
+
+/**
+* The successor of k is the leftmost node of its right subtree if it has
+* one. Otherwise it is the parent of the nearest ancestor that is a left
+* child: strip the trailing 1 bits (right-child steps) and one more.
+* Index 0 is end().
+*/
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator& FrozenTree<Key, Value>::iterator::operator++()
+{
+    size_t n = tree_->size_;
+    if(2 * k_ + 1 <= n){
+        k_ = 2 * k_ + 1;
+        while(2 * k_ <= n){
+            k_ = 2 * k_;
+        }
+    } else {
+        k_ >>= __builtin_ctzll(~static_cast<unsigned long long>(k_)) + 1;
+    }
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  Begin implementations for the FrozenTree class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+FrozenTree<Key, Value>::FrozenTree() :
+    keys_(1),
+    values_(1),
+    size_(0)
+{
+
+}
+
+/**
+* Lays out sorted, which must be in strictly increasing key order, in
+* O(n) with an in-order walk of the implicit tree.
+*/
+template<class Key, class Value>
+FrozenTree<Key, Value>::FrozenTree(const std::vector<std::pair<Key, Value> >& sorted) :
+    keys_(sorted.size() + 1),
+    values_(sorted.size() + 1),
+    size_(sorted.size())
+{
+    fill(sorted, 0, 1);
+}
+
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::begin() const
+{
+    size_t k = (size_ == 0) ? 0 : 1;
+    while(k != 0 && 2 * k <= size_){
+        k = 2 * k;
+    }
+    return iterator(this, k);
+}
+
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::end() const
+{
+    return iterator(this, 0);
+}
+
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::find(const Key& key) const
+{
+    size_t k = search(key);
+    if(k == 0 || key < keys_[k]){
+        return end();
+    }
+    return iterator(this, k);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(this, search(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+const Value& FrozenTree<Key, Value>::operator[](const Key& key) const
+{
+    size_t k = search(key);
+    if(k == 0 || key < keys_[k]) throw std::out_of_range("Invalid key");
+    return values_[k];
+}
+
+template<class Key, class Value>
+bool FrozenTree<Key, Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value>
+size_t FrozenTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+//stores sorted[i..] in the subtree at k in order; returns the next unused i
+template<class Key, class Value>
+size_t FrozenTree<Key, Value>::fill(const std::vector<std::pair<Key, Value> >& sorted, size_t i, size_t k)
+{
+    if(k > size_){
+        return i;
+    }
+    i = fill(sorted, i, 2 * k);
+    keys_[k] = sorted[i].first;
+    values_[k] = sorted[i].second;
+    return fill(sorted, i + 1, 2 * k + 1);
+}
+
+/**
+* The index of the first key not less than key, or 0 if there is none.
+* The descent goes left on keys_[k] >= key and right otherwise; the last
+* left turn is the answer, and it is recovered at the end by dropping the
+* right turns (trailing 1 bits) taken after it.
+*/
+template<class Key, class Value>
+size_t FrozenTree<Key, Value>::search(const Key& key) const
+{
+    const Key* keys = keys_.data();
+    uintptr_t base = reinterpret_cast<uintptr_t>(keys);
+    size_t k = 1;
+    while(k <= size_){
+        // may point past the end; a prefetch never faults
+        __builtin_prefetch(reinterpret_cast<const void*>(base + prefetchStride_ * k * sizeof(Key)));
+        k = 2 * k + (keys[k] < key);
+    }
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+}
+
+
+#endif
@@ -0,0 +1,1039 @@
+#ifndef PAGEDBTREE_H
+#define PAGEDBTREE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* A fixed number of page frames caching the 4 KB pages of one file, with
+* CLOCK eviction: every frame has a reference bit that a hit sets, and
+* the clock hand sweeps the frames, clearing the bits it passes and
+* evicting the first unpinned frame whose bit is already clear. That
+* approximates LRU without reordering a list on every hit. Dirty pages
+* are written back when they are evicted or flushed.
+*
+* fetch and create return a Page, which pins its frame until it goes
+* away, so the data pointer stays valid while it is held.
+*/
+class BufferPool
+{
+public:
+    static const size_t pageSize = 4096;
+
+    class Page
+    {
+    public:
+        Page(Page&& other);
+        ~Page();
+        char* data() const;
+        template<typename T>
+        T* as() const { return reinterpret_cast<T*>(data()); }
+        void markDirty();
+
+    private:
+        friend class BufferPool;
+        Page(BufferPool* pool, size_t frame);
+        Page(const Page&);
+        Page& operator=(const Page&);
+
+        BufferPool* pool_;
+        size_t frame_;
+    };
+
+    BufferPool(int fd, size_t frames);
+    ~BufferPool();
+
+    Page fetch(uint32_t id);
+    Page create(uint32_t id);
+    void flush();
+
+    size_t frames() const;
+    size_t hits() const;
+    size_t reads() const;
+    size_t writes() const;
+
+private:
+    struct Frame
+    {
+        uint32_t page;
+        uint32_t pins;
+        bool used;
+        bool referenced;
+        bool dirty;
+    };
+
+    size_t claim(uint32_t id);
+    void writeBack(size_t frame);
+    void fail(const std::string& what) const;
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    int fd_;
+    char* memory_;
+    std::vector<Frame> frames_;
+    // page id to frame, for resident pages
+    std::unordered_map<uint32_t, size_t> table_;
+    size_t hand_;
+    size_t hits_;
+    size_t reads_;
+    size_t writes_;
+};
+
+inline BufferPool::Page::Page(BufferPool* pool, size_t frame) :
+    pool_(pool),
+    frame_(frame)
+{
+    ++pool_->frames_[frame_].pins;
+}
+
+inline BufferPool::Page::Page(Page&& other) :
+    pool_(other.pool_),
+    frame_(other.frame_)
+{
+    other.pool_ = nullptr;
+}
+
+inline BufferPool::Page::~Page()
+{
+    if(pool_ != nullptr){
+        --pool_->frames_[frame_].pins;
+    }
+}
+
+inline char* BufferPool::Page::data() const
+{
+    return pool_->memory_ + frame_ * pageSize;
+}
+
+inline void BufferPool::Page::markDirty()
+{
+    pool_->frames_[frame_].dirty = true;
+}
+
+/**
+* Caches pages of the open file fd, which the pool does not own, in
+* frames page-aligned frames.
+*/
+inline BufferPool::BufferPool(int fd, size_t frames) :
+    fd_(fd),
+    memory_(nullptr),
+    frames_(frames),
+    hand_(0),
+    hits_(0),
+    reads_(0),
+    writes_(0)
+{
+    void* p = nullptr;
+    if(frames == 0 || posix_memalign(&p, pageSize, frames * pageSize) != 0){
+        throw std::bad_alloc();
+    }
+    memory_ = static_cast<char*>(p);
+    for(size_t i = 0; i < frames; ++i){
+        Frame f = { 0, 0, false, false, false };
+        frames_[i] = f;
+    }
+    table_.reserve(frames);
+}
+
+/**
+* Frees the frames without writing anything back; the owner flushes.
+*/
+inline BufferPool::~BufferPool()
+{
+    free(memory_);
+}
+
+//the page read from the file, or its cached copy
+inline BufferPool::Page BufferPool::fetch(uint32_t id)
+{
+    std::unordered_map<uint32_t, size_t>::iterator it = table_.find(id);
+    if(it != table_.end()){
+        ++hits_;
+        frames_[it->second].referenced = true;
+        return Page(this, it->second);
+    }
+    size_t f = claim(id);
+    char* data = memory_ + f * pageSize;
+    size_t got = 0;
+    while(got < pageSize){
+        ssize_t n = ::pread(fd_, data + got, pageSize - got, static_cast<off_t>(id) * pageSize + got);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n < 0){
+            table_.erase(id);
+            frames_[f].used = false;
+            fail("cannot read page");
+        }
+        if(n == 0){
+            // never written back: the rest of the page is zero
+            std::memset(data + got, 0, pageSize - got);
+            break;
+        }
+        got += static_cast<size_t>(n);
+    }
+    ++reads_;
+    return Page(this, f);
+}
+
+/**
+* A zeroed, dirty page for id, which is new or being reused, without
+* reading the file.
+*/
+inline BufferPool::Page BufferPool::create(uint32_t id)
+{
+    std::unordered_map<uint32_t, size_t>::iterator it = table_.find(id);
+    size_t f = (it != table_.end()) ? it->second : claim(id);
+    std::memset(memory_ + f * pageSize, 0, pageSize);
+    frames_[f].dirty = true;
+    frames_[f].referenced = true;
+    return Page(this, f);
+}
+
+//writes back every dirty page; the caller syncs the file
+inline void BufferPool::flush()
+{
+    for(size_t i = 0; i < frames_.size(); ++i){
+        if(frames_[i].used && frames_[i].dirty){
+            writeBack(i);
+        }
+    }
+}
+
+inline size_t BufferPool::frames() const
+{
+    return frames_.size();
+}
+
+//fetches served from the pool
+inline size_t BufferPool::hits() const
+{
+    return hits_;
+}
+
+//pages read from the file
+inline size_t BufferPool::reads() const
+{
+    return reads_;
+}
+
+//pages written to the file
+inline size_t BufferPool::writes() const
+{
+    return writes_;
+}
+
+/**
+* A frame for id: a free one while there are any, then the CLOCK victim,
+* written back first if dirty. Throws std::runtime_error if every frame
+* is pinned.
+*/
+inline size_t BufferPool::claim(uint32_t id)
+{
+    size_t f = frames_.size();
+    for(size_t sweep = 0; sweep < 2 * frames_.size() && f == frames_.size(); ++sweep){
+        Frame& candidate = frames_[hand_];
+        if(!candidate.used || (candidate.pins == 0 && !candidate.referenced)){
+            f = hand_;
+        } else {
+            candidate.referenced = false;
+        }
+        hand_ = (hand_ + 1 == frames_.size()) ? 0 : hand_ + 1;
+    }
+    if(f == frames_.size()){
+        throw std::runtime_error("buffer pool: every frame is pinned");
+    }
+    Frame& frame = frames_[f];
+    if(frame.used){
+        if(frame.dirty){
+            writeBack(f);
+        }
+        table_.erase(frame.page);
+    }
+    frame.page = id;
+    frame.pins = 0;
+    frame.used = true;
+    frame.referenced = true;
+    frame.dirty = false;
+    table_[id] = f;
+    return f;
+}
+
+inline void BufferPool::writeBack(size_t frame)
+{
+    const char* data = memory_ + frame * pageSize;
+    off_t at = static_cast<off_t>(frames_[frame].page) * pageSize;
+    size_t done = 0;
+    while(done < pageSize){
+        ssize_t n = ::pwrite(fd_, data + done, pageSize - done, at + done);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            if(n == 0){
+                errno = EIO;
+            }
+            fail("cannot write page");
+        }
+        done += static_cast<size_t>(n);
+    }
+    frames_[frame].dirty = false;
+    ++writes_;
+}
+
+inline void BufferPool::fail(const std::string& what) const
+{
+    throw std::runtime_error("buffer pool: " + what + ": " + std::strerror(errno));
+}
+
+/**
+* A B+tree kept in a file of 4 KB pages and reached through a BufferPool,
+* for data sets larger than memory. Only the pool's frames are held in
+* memory, however large the file grows.
+*
+* Each node is one page, so the node's keys come off disk in a single
+* read. The keys of a page are kept in one sorted array apart from the
+* values or child ids, so a search within the page touches only key
+* bytes. With 4-byte keys a page holds about 500 of them, so a tree of a
+* billion keys is four levels deep. The inner levels are about 1/300 of
+* the pages; they stay in the pool under CLOCK because every lookup
+* passes through them, so a lookup costs about one page read, for its
+* leaf, even when the tree is many times the pool.
+*
+* The layout and the algorithms follow BPlusTree: separators in the inner
+* pages, items in the leaves, leaves chained left to right for range
+* scans, and nodes kept at least half full by borrowing and merging.
+* Pages freed by merges go on a free list and are reused. Keys and values
+* must be trivially copyable and default-constructible.
+*
+* Page 0 holds the tree's metadata. Changes reach the file when pages are
+* evicted and when flush() runs; the file is consistent only after
+* flush(), which the destructor calls. There is no log, so a crash
+* between flushes can leave a torn tree.
+*/
+template <typename Key, typename Value>
+class PagedBPlusTree
+{
+public:
+    PagedBPlusTree(const std::string& path, size_t poolPages);
+    ~PagedBPlusTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    template<typename Fn>
+    void visit_range(const Key& low, const Key& high, Fn fn) const;
+
+    void flush();
+    size_t pages() const;
+    const BufferPool& pool() const;
+
+private:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "paged trees need trivially copyable keys and values");
+
+    static const size_t pageSize_ = BufferPool::pageSize;
+    static const uint32_t version_ = 1;
+
+    struct Meta
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t pageSize;
+        uint32_t keySize;
+        uint32_t valueSize;
+        // page ids; 0 is null, since page 0 holds this
+        uint32_t root;
+        uint32_t pageCount;
+        uint32_t freeList;
+        uint32_t height;
+        uint64_t size;
+    };
+
+    // next links leaves left to right, and free pages into the free list
+    struct PageHeader
+    {
+        uint32_t count;
+        uint32_t leaf;
+        uint32_t next;
+        uint32_t reserved;
+    };
+
+    static const int leafCapacity_ = int((pageSize_ - sizeof(PageHeader) - alignof(Value))
+                                         / (sizeof(Key) + sizeof(Value)));
+    static const int innerCapacity_ = int((pageSize_ - sizeof(PageHeader) - 2 * sizeof(uint32_t))
+                                          / (sizeof(Key) + sizeof(uint32_t)));
+    static const int leafMin_ = leafCapacity_ / 2;
+    static const int innerMin_ = innerCapacity_ / 2;
+
+    struct Leaf
+    {
+        PageHeader h;
+        Key keys[leafCapacity_];
+        Value values[leafCapacity_];
+    };
+
+    struct Inner
+    {
+        PageHeader h;
+        Key keys[innerCapacity_];
+        uint32_t children[innerCapacity_ + 1];
+    };
+
+    static_assert(sizeof(Leaf) <= pageSize_ && sizeof(Inner) <= pageSize_, "nodes must fit a page");
+    static_assert(leafCapacity_ >= 4 && innerCapacity_ >= 4, "keys and values are too large for a page");
+
+    static int countLess(const Key* keys, int n, const Key& k);
+    static int countLessEqual(const Key* keys, int n, const Key& k);
+
+    uint32_t findLeaf(const Key& key) const;
+    uint32_t insertInto(uint32_t id, const Key& key, const Value& value, Key& splitKey);
+    static void insertAt(Leaf* leaf, int pos, const Key& key, const Value& value);
+    uint32_t splitInner(Inner* node, int idx, const Key& key, uint32_t child, Key& splitKey);
+    bool removeFrom(uint32_t id, const Key& key);
+    void fixLeaf(Inner* parent, int idx);
+    void fixInner(Inner* parent, int idx);
+
+    BufferPool::Page allocatePage(bool leaf, uint32_t& id);
+    void freePage(uint32_t id);
+    void writeMeta();
+    void fail(const std::string& what) const;
+
+    PagedBPlusTree(const PagedBPlusTree&);
+    PagedBPlusTree& operator=(const PagedBPlusTree&);
+
+    std::string path_;
+    int fd_;
+    Meta meta_;
+    // lookups fill and reorder the pool
+    mutable BufferPool* pool_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PagedBPlusTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Opens the tree in path, creating an empty one if the file is missing or
+* empty, with a pool of poolPages frames. The pool needs a few frames per
+* level to pin a path and its siblings; at least 16 are required. Throws
+* std::invalid_argument for a smaller pool and std::runtime_error if the
+* file cannot be used or holds a tree of other key or value types.
+*/
+template<class Key, class Value>
+PagedBPlusTree<Key, Value>::PagedBPlusTree(const std::string& path, size_t poolPages) :
+    path_(path),
+    fd_(-1),
+    pool_(nullptr)
+{
+    if(poolPages < 16){
+        throw std::invalid_argument("PagedBPlusTree: the pool needs at least 16 pages");
+    }
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd_ < 0){
+        fail("cannot open");
+    }
+    struct stat st;
+    if(::fstat(fd_, &st) != 0){
+        int err = errno;
+        ::close(fd_);
+        errno = err;
+        fail("cannot stat");
+    }
+    std::memset(&meta_, 0, sizeof(meta_));
+    std::string problem;
+    if(st.st_size == 0){
+        std::memcpy(meta_.magic, "BSTPAGE", 8);
+        meta_.version = version_;
+        meta_.pageSize = pageSize_;
+        meta_.keySize = sizeof(Key);
+        meta_.valueSize = sizeof(Value);
+        meta_.pageCount = 1;
+    } else if(::pread(fd_, &meta_, sizeof(meta_), 0) != static_cast<ssize_t>(sizeof(meta_))
+              || std::memcmp(meta_.magic, "BSTPAGE", 8) != 0){
+        problem = "is not a paged tree";
+    } else if(meta_.version != version_ || meta_.pageSize != pageSize_){
+        problem = "has an unsupported version or page size";
+    } else if(meta_.keySize != sizeof(Key) || meta_.valueSize != sizeof(Value)){
+        problem = "holds keys or values of another size";
+    } else if(meta_.root >= meta_.pageCount || meta_.freeList >= meta_.pageCount
+              || static_cast<uint64_t>(st.st_size) < uint64_t(meta_.pageCount) * pageSize_){
+        problem = "is truncated or corrupt";
+    }
+    if(!problem.empty()){
+        ::close(fd_);
+        throw std::runtime_error("paged tree " + path_ + " " + problem);
+    }
+    try {
+        pool_ = new BufferPool(fd_, poolPages);
+        if(st.st_size == 0){
+            flush();
+        }
+    } catch(...) {
+        delete pool_;
+        ::close(fd_);
+        throw;
+    }
+}
+
+/**
+* Flushes and closes the file. Errors are swallowed here; call flush()
+* first to see them.
+*/
+template<class Key, class Value>
+PagedBPlusTree<Key, Value>::~PagedBPlusTree()
+{
+    try {
+        flush();
+    } catch(const std::exception&) {
+    }
+    delete pool_;
+    ::close(fd_);
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* A full leaf splits in half, and the splits can carry up to a new root.
+* Throws std::length_error once the file is out of page ids; the size
+* counts the item only once it is in a leaf.
+*/
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(meta_.root == 0){
+        allocatePage(true, meta_.root);
+        meta_.height = 1;
+    }
+    Key splitKey;
+    uint32_t sibling = insertInto(meta_.root, keyValuePair.first, keyValuePair.second, splitKey);
+    if(sibling != 0){
+        uint32_t id;
+        BufferPool::Page page = allocatePage(false, id);
+        Inner* top = page.as<Inner>();
+        top->h.count = 1;
+        top->keys[0] = splitKey;
+        top->children[0] = meta_.root;
+        top->children[1] = sibling;
+        meta_.root = id;
+        ++meta_.height;
+    }
+}
+
+/**
+* Removes key if present. Underfull pages borrow from a sibling or are
+* merged into one, and the root shrinks away once it has a single child.
+*/
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::remove(const Key& key)
+{
+    if(meta_.root == 0 || !removeFrom(meta_.root, key)){
+        return;
+    }
+    uint32_t old = meta_.root;
+    BufferPool::Page page = pool_->fetch(old);
+    PageHeader* h = page.as<PageHeader>();
+    if(h->count != 0){
+        return;
+    }
+    meta_.root = h->leaf ? 0 : page.as<Inner>()->children[0];
+    --meta_.height;
+    freePage(old);
+}
+
+template<class Key, class Value>
+bool PagedBPlusTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    if(meta_.root == 0){
+        return false;
+    }
+    BufferPool::Page page = pool_->fetch(findLeaf(key));
+    const Leaf* leaf = page.as<Leaf>();
+    int pos = countLess(leaf->keys, leaf->h.count, key);
+    if(pos == int(leaf->h.count) || key < leaf->keys[pos]){
+        return false;
+    }
+    value = leaf->values[pos];
+    return true;
+}
+
+template<class Key, class Value>
+bool PagedBPlusTree<Key, Value>::contains(const Key& key) const
+{
+    Value value;
+    return find(key, value);
+}
+
+template<class Key, class Value>
+bool PagedBPlusTree<Key, Value>::empty() const
+{
+    return meta_.size == 0;
+}
+
+template<class Key, class Value>
+size_t PagedBPlusTree<Key, Value>::size() const
+{
+    return static_cast<size_t>(meta_.size);
+}
+
+/**
+* The number of page levels; every leaf is at the same depth.
+*/
+template<class Key, class Value>
+int PagedBPlusTree<Key, Value>::height() const
+{
+    return static_cast<int>(meta_.height);
+}
+
+/**
+* Calls fn(item) with a const std::pair<const Key, Value>& for every key
+* in [low, high], in key order: one descent to the first leaf, then a walk
+* along the leaf chain, one page at a time.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void PagedBPlusTree<Key, Value>::visit_range(const Key& low, const Key& high, Fn fn) const
+{
+    if(meta_.root == 0 || high < low){
+        return;
+    }
+    uint32_t id = findLeaf(low);
+    BufferPool::Page first = pool_->fetch(id);
+    int slot = countLess(first.as<Leaf>()->keys, first.as<Leaf>()->h.count, low);
+    while(id != 0){
+        BufferPool::Page page = pool_->fetch(id);
+        const Leaf* leaf = page.as<Leaf>();
+        for(; slot < int(leaf->h.count); ++slot){
+            if(high < leaf->keys[slot]){
+                return;
+            }
+            fn(std::pair<const Key, Value>(leaf->keys[slot], leaf->values[slot]));
+        }
+        id = leaf->h.next;
+        slot = 0;
+    }
+}
+
+/**
+* Writes every dirty page and the metadata and syncs the file. Throws
+* std::runtime_error on I/O errors.
+*/
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::flush()
+{
+    pool_->flush();
+    writeMeta();
+    if(::fdatasync(fd_) != 0){
+        fail("cannot sync");
+    }
+}
+
+//pages in the file, the metadata page and free pages included
+template<class Key, class Value>
+size_t PagedBPlusTree<Key, Value>::pages() const
+{
+    return meta_.pageCount;
+}
+
+template<class Key, class Value>
+const BufferPool& PagedBPlusTree<Key, Value>::pool() const
+{
+    return *pool_;
+}
+
+/**
+* A branchless binary search, as in BPlusNodeSearch: the number of keys
+* < k in the sorted keys[0, n). A page holds hundreds of keys, too many
+* for the linear SSE2 scan that suits BPlusTree's 32.
+*/
+template<class Key, class Value>
+int PagedBPlusTree<Key, Value>::countLess(const Key* keys, int n, const Key& k)
+{
+    if(n == 0){
+        return 0;
+    }
+    const Key* base = keys;
+    while(n > 1){
+        int half = n / 2;
+        base += (base[half - 1] < k) ? half : 0;
+        n -= half;
+    }
+    return int(base - keys) + (*base < k);
+}
+
+//the number of keys <= k
+template<class Key, class Value>
+int PagedBPlusTree<Key, Value>::countLessEqual(const Key* keys, int n, const Key& k)
+{
+    if(n == 0){
+        return 0;
+    }
+    const Key* base = keys;
+    while(n > 1){
+        int half = n / 2;
+        base += !(k < base[half - 1]) ? half : 0;
+        n -= half;
+    }
+    return int(base - keys) + !(k < *base);
+}
+
+//descends to the leaf whose key range holds key, pinning one page at a time
+template<class Key, class Value>
+uint32_t PagedBPlusTree<Key, Value>::findLeaf(const Key& key) const
+{
+    uint32_t id = meta_.root;
+    for(uint32_t level = 1; level < meta_.height; ++level){
+        BufferPool::Page page = pool_->fetch(id);
+        const Inner* inner = page.as<Inner>();
+        id = inner->children[countLessEqual(inner->keys, inner->h.count, key)];
+    }
+    return id;
+}
+
+/**
+* Inserts into the subtree at page id. If the page had to split, returns
+* the new right sibling and sets splitKey to the separator that belongs
+* between the two in the parent; otherwise returns 0. The pages on the
+* path stay pinned until the recursion returns through them.
+*/
+template<class Key, class Value>
+uint32_t PagedBPlusTree<Key, Value>::insertInto(uint32_t id, const Key& key, const Value& value, Key& splitKey)
+{
+    BufferPool::Page page = pool_->fetch(id);
+    if(!page.as<PageHeader>()->leaf){
+        Inner* inner = page.as<Inner>();
+        int count = inner->h.count;
+        int idx = countLessEqual(inner->keys, count, key);
+        Key childKey;
+        uint32_t sibling = insertInto(inner->children[idx], key, value, childKey);
+        if(sibling == 0){
+            return 0;
+        }
+        page.markDirty();
+        if(count < innerCapacity_){
+            std::memmove(&inner->keys[idx + 1], &inner->keys[idx], (count - idx) * sizeof(Key));
+            std::memmove(&inner->children[idx + 2], &inner->children[idx + 1], (count - idx) * sizeof(uint32_t));
+            inner->keys[idx] = childKey;
+            inner->children[idx + 1] = sibling;
+            ++inner->h.count;
+            return 0;
+        }
+        return splitInner(inner, idx, childKey, sibling, splitKey);
+    }
+
+    Leaf* leaf = page.as<Leaf>();
+    int count = leaf->h.count;
+    int pos = countLess(leaf->keys, count, key);
+    page.markDirty();
+    if(pos < count && !(key < leaf->keys[pos])){
+        leaf->values[pos] = value;
+        return 0;
+    }
+    if(count < leafCapacity_){
+        insertAt(leaf, pos, key, value);
+        ++meta_.size;
+        return 0;
+    }
+    // split the full leaf in half, then insert into the half that owns pos
+    uint32_t rightId;
+    BufferPool::Page rightPage = allocatePage(true, rightId);
+    Leaf* right = rightPage.as<Leaf>();
+    int keep = leafCapacity_ / 2;
+    right->h.count = leafCapacity_ - keep;
+    std::memcpy(right->keys, &leaf->keys[keep], right->h.count * sizeof(Key));
+    std::memcpy(right->values, &leaf->values[keep], right->h.count * sizeof(Value));
+    leaf->h.count = keep;
+    right->h.next = leaf->h.next;
+    leaf->h.next = rightId;
+    if(pos > keep){
+        insertAt(right, pos - keep, key, value);
+    } else {
+        insertAt(leaf, pos, key, value);
+    }
+    ++meta_.size;
+    splitKey = right->keys[0];
+    return rightId;
+}
+
+//shifts the items from pos up one slot to make room for the new one
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::insertAt(Leaf* leaf, int pos, const Key& key, const Value& value)
+{
+    int n = leaf->h.count;
+    std::memmove(&leaf->keys[pos + 1], &leaf->keys[pos], (n - pos) * sizeof(Key));
+    std::memmove(&leaf->values[pos + 1], &leaf->values[pos], (n - pos) * sizeof(Value));
+    leaf->keys[pos] = key;
+    leaf->values[pos] = value;
+    ++leaf->h.count;
+}
+
+/**
+* Splits a full inner page while adding key and child at idx. The middle
+* separator moves up to the parent through splitKey.
+*/
+template<class Key, class Value>
+uint32_t PagedBPlusTree<Key, Value>::splitInner(Inner* node, int idx, const Key& key, uint32_t child, Key& splitKey)
+{
+    std::vector<Key> keys(innerCapacity_ + 1);
+    std::vector<uint32_t> children(innerCapacity_ + 2);
+    children[0] = node->children[0];
+    for(int i = 0, j = 0; i <= innerCapacity_; ++i){
+        if(i == idx){
+            keys[i] = key;
+            children[i + 1] = child;
+        } else {
+            keys[i] = node->keys[j];
+            children[i + 1] = node->children[j + 1];
+            ++j;
+        }
+    }
+    int mid = (innerCapacity_ + 1) / 2;
+    uint32_t rightId;
+    BufferPool::Page page = allocatePage(false, rightId);
+    Inner* right = page.as<Inner>();
+    node->h.count = mid;
+    for(int i = 0; i < mid; ++i){
+        node->keys[i] = keys[i];
+        node->children[i + 1] = children[i + 1];
+    }
+    right->h.count = innerCapacity_ - mid;
+    right->children[0] = children[mid + 1];
+    for(int i = 0; i < int(right->h.count); ++i){
+        right->keys[i] = keys[mid + 1 + i];
+        right->children[i + 1] = children[mid + 2 + i];
+    }
+    splitKey = keys[mid];
+    return rightId;
+}
+
+/**
+* Removes key from the subtree at page id and returns whether it was
+* there. A child left less than half full is repaired on the way back up,
+* so the page itself may be left underfull for its own parent to fix.
+*/
+template<class Key, class Value>
+bool PagedBPlusTree<Key, Value>::removeFrom(uint32_t id, const Key& key)
+{
+    BufferPool::Page page = pool_->fetch(id);
+    if(page.as<PageHeader>()->leaf){
+        Leaf* leaf = page.as<Leaf>();
+        int count = leaf->h.count;
+        int pos = countLess(leaf->keys, count, key);
+        if(pos == count || key < leaf->keys[pos]){
+            return false;
+        }
+        std::memmove(&leaf->keys[pos], &leaf->keys[pos + 1], (count - pos - 1) * sizeof(Key));
+        std::memmove(&leaf->values[pos], &leaf->values[pos + 1], (count - pos - 1) * sizeof(Value));
+        --leaf->h.count;
+        page.markDirty();
+        --meta_.size;
+        return true;
+    }
+    Inner* inner = page.as<Inner>();
+    int idx = countLessEqual(inner->keys, inner->h.count, key);
+    if(!removeFrom(inner->children[idx], key)){
+        return false;
+    }
+    BufferPool::Page child = pool_->fetch(inner->children[idx]);
+    const PageHeader* h = child.as<PageHeader>();
+    if(h->leaf && int(h->count) < leafMin_){
+        page.markDirty();
+        fixLeaf(inner, idx);
+    } else if(!h->leaf && int(h->count) < innerMin_){
+        page.markDirty();
+        fixInner(inner, idx);
+    }
+    return true;
+}
+
+/**
+* Refills the underfull leaf parent->children[idx] with an item from a
+* sibling that can spare one, or merges it with a sibling.
+*/
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::fixLeaf(Inner* parent, int idx)
+{
+    BufferPool::Page page = pool_->fetch(parent->children[idx]);
+    Leaf* leaf = page.as<Leaf>();
+    page.markDirty();
+    if(idx > 0){
+        BufferPool::Page leftPage = pool_->fetch(parent->children[idx - 1]);
+        Leaf* left = leftPage.as<Leaf>();
+        if(int(left->h.count) > leafMin_){
+            int n = leaf->h.count;
+            std::memmove(&leaf->keys[1], &leaf->keys[0], n * sizeof(Key));
+            std::memmove(&leaf->values[1], &leaf->values[0], n * sizeof(Value));
+            --left->h.count;
+            leaf->keys[0] = left->keys[left->h.count];
+            leaf->values[0] = left->values[left->h.count];
+            ++leaf->h.count;
+            leftPage.markDirty();
+            parent->keys[idx - 1] = leaf->keys[0];
+            return;
+        }
+    }
+    if(idx < int(parent->h.count)){
+        BufferPool::Page rightPage = pool_->fetch(parent->children[idx + 1]);
+        Leaf* right = rightPage.as<Leaf>();
+        if(int(right->h.count) > leafMin_){
+            leaf->keys[leaf->h.count] = right->keys[0];
+            leaf->values[leaf->h.count] = right->values[0];
+            ++leaf->h.count;
+            --right->h.count;
+            std::memmove(&right->keys[0], &right->keys[1], right->h.count * sizeof(Key));
+            std::memmove(&right->values[0], &right->values[1], right->h.count * sizeof(Value));
+            rightPage.markDirty();
+            parent->keys[idx] = right->keys[0];
+            return;
+        }
+    }
+    // merge the right one of the pair into the left one
+    if(idx == 0){
+        ++idx;
+    }
+    BufferPool::Page leftPage = pool_->fetch(parent->children[idx - 1]);
+    BufferPool::Page rightPage = pool_->fetch(parent->children[idx]);
+    Leaf* left = leftPage.as<Leaf>();
+    Leaf* right = rightPage.as<Leaf>();
+    std::memcpy(&left->keys[left->h.count], right->keys, right->h.count * sizeof(Key));
+    std::memcpy(&left->values[left->h.count], right->values, right->h.count * sizeof(Value));
+    left->h.count += right->h.count;
+    left->h.next = right->h.next;
+    leftPage.markDirty();
+    uint32_t freed = parent->children[idx];
+    for(int i = idx; i < int(parent->h.count); ++i){
+        parent->keys[i - 1] = parent->keys[i];
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->h.count;
+    freePage(freed);
+}
+
+/**
+* Like fixLeaf for an inner child. Separators rotate through the parent
+* when borrowing, and the parent's separator joins the two halves of a
+* merge.
+*/
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::fixInner(Inner* parent, int idx)
+{
+    BufferPool::Page page = pool_->fetch(parent->children[idx]);
+    Inner* node = page.as<Inner>();
+    page.markDirty();
+    if(idx > 0){
+        BufferPool::Page leftPage = pool_->fetch(parent->children[idx - 1]);
+        Inner* left = leftPage.as<Inner>();
+        if(int(left->h.count) > innerMin_){
+            int n = node->h.count;
+            std::memmove(&node->keys[1], &node->keys[0], n * sizeof(Key));
+            std::memmove(&node->children[1], &node->children[0], (n + 1) * sizeof(uint32_t));
+            node->keys[0] = parent->keys[idx - 1];
+            node->children[0] = left->children[left->h.count];
+            ++node->h.count;
+            parent->keys[idx - 1] = left->keys[left->h.count - 1];
+            --left->h.count;
+            leftPage.markDirty();
+            return;
+        }
+    }
+    if(idx < int(parent->h.count)){
+        BufferPool::Page rightPage = pool_->fetch(parent->children[idx + 1]);
+        Inner* right = rightPage.as<Inner>();
+        if(int(right->h.count) > innerMin_){
+            node->keys[node->h.count] = parent->keys[idx];
+            node->children[node->h.count + 1] = right->children[0];
+            ++node->h.count;
+            parent->keys[idx] = right->keys[0];
+            --right->h.count;
+            std::memmove(&right->keys[0], &right->keys[1], right->h.count * sizeof(Key));
+            std::memmove(&right->children[0], &right->children[1], (right->h.count + 1) * sizeof(uint32_t));
+            rightPage.markDirty();
+            return;
+        }
+    }
+    if(idx == 0){
+        ++idx;
+    }
+    BufferPool::Page leftPage = pool_->fetch(parent->children[idx - 1]);
+    BufferPool::Page rightPage = pool_->fetch(parent->children[idx]);
+    Inner* left = leftPage.as<Inner>();
+    Inner* right = rightPage.as<Inner>();
+    int n = left->h.count;
+    left->keys[n] = parent->keys[idx - 1];
+    std::memcpy(&left->keys[n + 1], right->keys, right->h.count * sizeof(Key));
+    std::memcpy(&left->children[n + 1], right->children, (right->h.count + 1) * sizeof(uint32_t));
+    left->h.count += right->h.count + 1;
+    leftPage.markDirty();
+    uint32_t freed = parent->children[idx];
+    for(int i = idx; i < int(parent->h.count); ++i){
+        parent->keys[i - 1] = parent->keys[i];
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->h.count;
+    freePage(freed);
+}
+
+//a zeroed leaf or inner page, from the free list if it has one
+template<class Key, class Value>
+BufferPool::Page PagedBPlusTree<Key, Value>::allocatePage(bool leaf, uint32_t& id)
+{
+    if(meta_.freeList != 0){
+        id = meta_.freeList;
+        BufferPool::Page page = pool_->fetch(id);
+        meta_.freeList = page.as<PageHeader>()->next;
+    } else {
+        if(meta_.pageCount == UINT32_MAX){
+            throw std::length_error("PagedBPlusTree: the file is out of page ids");
+        }
+        id = meta_.pageCount++;
+    }
+    BufferPool::Page page = pool_->create(id);
+    page.as<PageHeader>()->leaf = leaf;
+    return page;
+}
+
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::freePage(uint32_t id)
+{
+    BufferPool::Page page = pool_->create(id);
+    page.as<PageHeader>()->next = meta_.freeList;
+    meta_.freeList = id;
+}
+
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::writeMeta()
+{
+    std::vector<char> page(static_cast<size_t>(pageSize_), 0);
+    std::memcpy(page.data(), &meta_, sizeof(meta_));
+    if(::pwrite(fd_, page.data(), pageSize_, 0) != static_cast<ssize_t>(pageSize_)){
+        fail("cannot write metadata to");
+    }
+}
+
+template<class Key, class Value>
+void PagedBPlusTree<Key, Value>::fail(const std::string& what) const
+{
+    throw std::runtime_error("paged tree: " + what + " " + path_ + ": " + std::strerror(errno));
+}
+
+
+#endif
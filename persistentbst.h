@@ -0,0 +1,586 @@
+#ifndef PERSISTENTBST_H
+#define PERSISTENTBST_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+/**
+* A node of a persistent AVL tree. Nodes are immutable once they are shared
+* and may belong to many versions of a tree at the same time, so there is no
+* parent pointer; refs_ counts the trees and parent nodes that point here.
+*/
+template <typename Key, typename Value>
+class PersistentNode
+{
+public:
+    PersistentNode(const std::pair<const Key, Value>& item, PersistentNode<Key, Value>* left,
+                   PersistentNode<Key, Value>* right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    PersistentNode<Key, Value>* getLeft() const;
+    PersistentNode<Key, Value>* getRight() const;
+    int getHeight() const;
+
+    static PersistentNode<Key, Value>* retain(PersistentNode<Key, Value>* n);
+    static void release(PersistentNode<Key, Value>* n);
+
+protected:
+    std::pair<const Key, Value> item_;
+    PersistentNode<Key, Value>* left_;
+    PersistentNode<Key, Value>* right_;
+    int height_;
+    std::atomic<unsigned> refs_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PersistentNode class.
+  -----------------------------------------------
+*/
+
+/**
+* Takes over one reference to each child; the new node starts with a single
+* reference, owned by the caller.
+*/
+template<class Key, class Value>
+PersistentNode<Key, Value>::PersistentNode(const std::pair<const Key, Value>& item,
+                                           PersistentNode<Key, Value>* left,
+                                           PersistentNode<Key, Value>* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    refs_(1)
+{
+    int hl = (left == nullptr) ? 0 : left->height_;
+    int hr = (right == nullptr) ? 0 : right->height_;
+    height_ = std::max(hl, hr) + 1;
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>& PersistentNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<class Key, class Value>
+const Key& PersistentNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<class Key, class Value>
+const Value& PersistentNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<class Key, class Value>
+int PersistentNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+/**
+* Adds a reference to n (which may be NULL) and returns it.
+*/
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentNode<Key, Value>::retain(PersistentNode<Key, Value>* n)
+{
+    if(n != nullptr){
+        n->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return n;
+}
+
+/**
+* Drops a reference to n. Nodes whose last reference goes away are freed
+* together with every child that was only reachable through them.
+*/
+template<class Key, class Value>
+void PersistentNode<Key, Value>::release(PersistentNode<Key, Value>* n)
+{
+    std::vector<PersistentNode<Key, Value>*> doomed;
+    while(n != nullptr){
+        if(n->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            if(n->left_ != nullptr) doomed.push_back(n->left_);
+            if(n->right_ != nullptr) doomed.push_back(n->right_);
+            delete n;
+        }
+        if(doomed.empty()){
+            break;
+        }
+        n = doomed.back();
+        doomed.pop_back();
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PersistentNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A persistent AVL tree. insert and remove never modify a node; they copy
+* the O(log n) nodes on the search path and share every other subtree with
+* the previous version. snapshot() (or the copy constructor) is therefore
+* O(1), and an old version stays readable for as long as it is kept, costing
+* only the nodes written since it was taken. Nodes are reference counted
+* and freed when the last version using them goes away.
+*
+* A single tree object is not thread-safe, but different trees may share
+* nodes and be used from different threads: a writer can hand snapshots to
+* readers and keep updating its own copy.
+*
+* Iterators are invalidated by any update of the tree they came from;
+* iterate over a snapshot for a view that stays stable.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    PersistentAVLTree();
+    PersistentAVLTree(const PersistentAVLTree<Key, Value>& other);
+    PersistentAVLTree<Key, Value>& operator=(const PersistentAVLTree<Key, Value>& other);
+    ~PersistentAVLTree();
+
+    PersistentAVLTree<Key, Value> snapshot() const;
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    /**
+    * An in-order iterator. Without parent pointers it keeps the ancestors
+    * it still has to visit on a stack of O(log n) nodes.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        void pushLeft(PersistentNode<Key, Value>* n);
+        std::vector<PersistentNode<Key, Value>*> path_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+
+protected:
+    static PersistentNode<Key, Value>* makeNode(const std::pair<const Key, Value>& item,
+                                                PersistentNode<Key, Value>* l,
+                                                PersistentNode<Key, Value>* r);
+    static PersistentNode<Key, Value>* balance(const std::pair<const Key, Value>& item,
+                                               PersistentNode<Key, Value>* l,
+                                               PersistentNode<Key, Value>* r);
+    static PersistentNode<Key, Value>* insertNode(PersistentNode<Key, Value>* t,
+                                                  const std::pair<const Key, Value>& new_item,
+                                                  bool& added);
+    static PersistentNode<Key, Value>* removeNode(PersistentNode<Key, Value>* t, const Key& key);
+    static PersistentNode<Key, Value>* removeMax(PersistentNode<Key, Value>* t);
+    static int heightOf(PersistentNode<Key, Value>* n);
+    PersistentNode<Key, Value>* internalFind(const Key& key) const;
+
+    PersistentNode<Key, Value>* root_;
+    size_t size_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PersistentAVLTree::iterator class.
+  -----------------------------------------------
+*/
+
+/**
+* Creates an iterator equal to end().
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::iterator::iterator()
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>& PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return path_.back()->getItem();
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(path_.back()->getItem());
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()){
+        return path_.empty() && rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next key. The stack holds the current node on top of the
+* ancestors still to be visited, so the next key is the leftmost node of the
+* right subtree if there is one and the top of the stack otherwise.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator& PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+    PersistentNode<Key, Value>* n = path_.back();
+    path_.pop_back();
+    pushLeft(n->getRight());
+    return *this;
+}
+
+//pushes n and its chain of left children
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeft(PersistentNode<Key, Value>* n)
+{
+    for(; n != nullptr; n = n->getLeft()){
+        path_.push_back(n);
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PersistentAVLTree::iterator class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() :
+    root_(nullptr),
+    size_(0)
+{
+
+}
+
+/**
+* Shares other's nodes in O(1); the two trees diverge from here on.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const PersistentAVLTree<Key, Value>& other) :
+    root_(PersistentNode<Key, Value>::retain(other.root_)),
+    size_(other.size_)
+{
+
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>& PersistentAVLTree<Key, Value>::operator=(const PersistentAVLTree<Key, Value>& other)
+{
+    PersistentNode<Key, Value>* old = root_;
+    root_ = PersistentNode<Key, Value>::retain(other.root_);
+    size_ = other.size_;
+    PersistentNode<Key, Value>::release(old);
+    return *this;
+}
+
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::~PersistentAVLTree()
+{
+    PersistentNode<Key, Value>::release(root_);
+}
+
+/**
+* Returns a read-only point-in-time view of the tree in O(1).
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value> PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return PersistentAVLTree<Key, Value>(*this);
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present,
+* by copying the path from the root. Snapshots taken earlier keep the old
+* path.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    bool added = false;
+    PersistentNode<Key, Value>* t = insertNode(root_, new_item, added);
+    PersistentNode<Key, Value>::release(root_);
+    root_ = t;
+    if(added){
+        ++size_;
+    }
+}
+
+/**
+* Removes key if present by copying the path from the root; a node with two
+* children is replaced by a copy of its predecessor. Snapshots taken earlier
+* keep the old path.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    if(internalFind(key) == nullptr){
+        return;
+    }
+    PersistentNode<Key, Value>* t = removeNode(root_, key);
+    PersistentNode<Key, Value>::release(root_);
+    root_ = t;
+    --size_;
+}
+
+/**
+* Drops this tree's reference to its nodes; nodes still used by snapshots
+* survive.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    PersistentNode<Key, Value>::release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return root_ == nullptr;
+}
+
+template<class Key, class Value>
+size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::height() const
+{
+    return heightOf(root_);
+}
+
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::begin() const
+{
+    iterator it;
+    it.pushLeft(root_);
+    return it;
+}
+
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(). The search
+* path doubles as the iterator's stack, keeping only the nodes the
+* iteration still has to come back to.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it;
+    PersistentNode<Key, Value>* n = root_;
+    while(n != nullptr){
+        if(key < n->getKey()){
+            it.path_.push_back(n);
+            n = n->getLeft();
+        } else if(n->getKey() < key){
+            n = n->getRight();
+        } else {
+            it.path_.push_back(n);
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+const Value& PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    PersistentNode<Key, Value>* n = internalFind(key);
+    if(n == nullptr) throw std::out_of_range("Invalid key");
+    return n->getValue();
+}
+
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::internalFind(const Key& key) const
+{
+    PersistentNode<Key, Value>* n = root_;
+    while(n != nullptr){
+        if(key < n->getKey()){
+            n = n->getLeft();
+        } else if(n->getKey() < key){
+            n = n->getRight();
+        } else {
+            return n;
+        }
+    }
+    return nullptr;
+}
+
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::heightOf(PersistentNode<Key, Value>* n)
+{
+    return (n == nullptr) ? 0 : n->getHeight();
+}
+
+/*
+ * The helpers below follow one ownership rule: arguments named t are
+ * borrowed, l and r are references the callee takes over, and the
+ * returned subtree is a new reference owned by the caller.
+ */
+
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::makeNode(const std::pair<const Key, Value>& item,
+                                                                    PersistentNode<Key, Value>* l,
+                                                                    PersistentNode<Key, Value>* r)
+{
+    return new PersistentNode<Key, Value>(item, l, r);
+}
+
+/**
+* Builds a node for item over l and r, whose heights may differ by at most
+* two. A difference of two is repaired with a single or double rotation
+* that copies the rotated nodes instead of relinking them.
+*/
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item,
+                                                                   PersistentNode<Key, Value>* l,
+                                                                   PersistentNode<Key, Value>* r)
+{
+    typedef PersistentNode<Key, Value> PNode;
+    int hl = heightOf(l);
+    int hr = heightOf(r);
+    PNode* result;
+    if(hl > hr + 1){
+        PNode* ll = l->getLeft();
+        PNode* lr = l->getRight();
+        if(heightOf(ll) >= heightOf(lr)){ //right rotation
+            PNode* n = makeNode(item, PNode::retain(lr), r);
+            result = makeNode(l->getItem(), PNode::retain(ll), n);
+        } else { //left-right rotation
+            PNode* a = makeNode(l->getItem(), PNode::retain(ll), PNode::retain(lr->getLeft()));
+            PNode* b = makeNode(item, PNode::retain(lr->getRight()), r);
+            result = makeNode(lr->getItem(), a, b);
+        }
+        PNode::release(l);
+        return result;
+    }
+    if(hr > hl + 1){
+        PNode* rl = r->getLeft();
+        PNode* rr = r->getRight();
+        if(heightOf(rr) >= heightOf(rl)){ //left rotation
+            PNode* n = makeNode(item, l, PNode::retain(rl));
+            result = makeNode(r->getItem(), n, PNode::retain(rr));
+        } else { //right-left rotation
+            PNode* a = makeNode(item, l, PNode::retain(rl->getLeft()));
+            PNode* b = makeNode(r->getItem(), PNode::retain(rl->getRight()), PNode::retain(rr));
+            result = makeNode(rl->getItem(), a, b);
+        }
+        PNode::release(r);
+        return result;
+    }
+    return makeNode(item, l, r);
+}
+
+//copy of t with new_item inserted; added reports whether the key was new
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::insertNode(PersistentNode<Key, Value>* t,
+                                                                      const std::pair<const Key, Value>& new_item,
+                                                                      bool& added)
+{
+    typedef PersistentNode<Key, Value> PNode;
+    if(t == nullptr){
+        added = true;
+        return makeNode(new_item, nullptr, nullptr);
+    }
+    if(new_item.first < t->getKey()){
+        return balance(t->getItem(), insertNode(t->getLeft(), new_item, added), PNode::retain(t->getRight()));
+    }
+    if(t->getKey() < new_item.first){
+        return balance(t->getItem(), PNode::retain(t->getLeft()), insertNode(t->getRight(), new_item, added));
+    }
+    return makeNode(new_item, PNode::retain(t->getLeft()), PNode::retain(t->getRight()));
+}
+
+//copy of t without key, which must be present
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::removeNode(PersistentNode<Key, Value>* t, const Key& key)
+{
+    typedef PersistentNode<Key, Value> PNode;
+    if(key < t->getKey()){
+        return balance(t->getItem(), removeNode(t->getLeft(), key), PNode::retain(t->getRight()));
+    }
+    if(t->getKey() < key){
+        return balance(t->getItem(), PNode::retain(t->getLeft()), removeNode(t->getRight(), key));
+    }
+    if(t->getLeft() == nullptr){
+        return PNode::retain(t->getRight());
+    }
+    if(t->getRight() == nullptr){
+        return PNode::retain(t->getLeft());
+    }
+    //two children: the predecessor takes t's place
+    PNode* pred = t->getLeft();
+    while(pred->getRight() != nullptr){
+        pred = pred->getRight();
+    }
+    return balance(pred->getItem(), removeMax(t->getLeft()), PNode::retain(t->getRight()));
+}
+
+//copy of t without its largest key
+template<class Key, class Value>
+PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::removeMax(PersistentNode<Key, Value>* t)
+{
+    typedef PersistentNode<Key, Value> PNode;
+    if(t->getRight() == nullptr){
+        return PNode::retain(t->getLeft());
+    }
+    return balance(t->getItem(), PNode::retain(t->getLeft()), removeMax(t->getRight()));
+}
+
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds the node's color as a data member.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructor/destructor.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    virtual ~RBNode();
+
+    // Getter/setter for the node's color.
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Getters for parent, left, and right, redefined to return RBNodes.
+    // See the Node class in bst.h for more information.
+    virtual RBNode<Key, Value>* getParent() const override;
+    virtual RBNode<Key, Value>* getLeft() const override;
+    virtual RBNode<Key, Value>* getRight() const override;
+
+    virtual RBNode<Key, Value>* clone(Node<Key, Value>* parent) const override;
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor; new nodes start out red.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+/**
+* A getter for the color of a RBNode.
+*/
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+/**
+* A setter for the color of a RBNode.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+/**
+* Copies the item and the color under parent.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::clone(Node<Key, Value>* parent) const
+{
+    RBNode<Key, Value>* n = new RBNode<Key, Value>(this->item_.first, this->item_.second,
+                                                   static_cast<RBNode<Key, Value>*>(parent));
+    n->red_ = red_;
+    return n;
+}
+
+/**
+* An overridden function for getting the parent since a static_cast is necessary to make sure
+* that our node is a RBNode.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+/**
+* Overridden for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree. Every update does O(log n) recoloring in the worst case
+* but at most two rotations per insert and three per remove, O(1) amortized
+* restructuring overall, which makes it cheaper than an AVL tree for
+* write-heavy workloads at the cost of somewhat deeper searches.
+*/
+template <class Key, class Value>
+class RedBlackTree : public BinarySearchTree<Key, Value>
+{
+public:
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    virtual void remove(const Key& key);
+protected:
+    virtual void nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2);
+
+    void rotateLeft(RBNode<Key, Value>* n);
+    void rotateRight(RBNode<Key, Value>* n);
+    void fixInsert(RBNode<Key, Value>* n);
+    void fixRemove(RBNode<Key, Value>* n, RBNode<Key, Value>* parent);
+    static bool isRed(RBNode<Key, Value>* n);
+    RBNode<Key, Value>* root() const;
+};
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    RBNode<Key, Value>* parent = nullptr;
+    RBNode<Key, Value>* temp = root();
+    while(temp != nullptr){
+        parent = temp;
+        if(new_item.first < temp->getKey()){
+            temp = temp->getLeft();
+        } else if(temp->getKey() < new_item.first){
+            temp = temp->getRight();
+        } else {
+            temp->setValue(new_item.second);
+            return;
+        }
+    }
+    RBNode<Key, Value>* n = new RBNode<Key, Value>(new_item.first, new_item.second, parent);
+    if(parent == nullptr){
+        this->root_ = n;
+    } else if(new_item.first < parent->getKey()){
+        parent->setLeft(n);
+    } else {
+        parent->setRight(n);
+    }
+    fixInsert(n);
+}
+
+/**
+* Restores the red-black properties after inserting the red node n. Red
+* uncles are handled by recoloring and moving up two levels; a black uncle
+* ends the loop after one or two rotations.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::fixInsert(RBNode<Key, Value>* n)
+{
+    while(n != this->root_ && n->getParent()->isRed()){
+        RBNode<Key, Value>* p = n->getParent();
+        RBNode<Key, Value>* g = p->getParent(); //exists since the root is black
+        if(p == g->getLeft()){
+            RBNode<Key, Value>* u = g->getRight();
+            if(isRed(u)){
+                p->setRed(false); u->setRed(false); g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getRight()){ //zig-zag, turn into zig-zig
+                rotateLeft(p);
+                n = p;
+                p = n->getParent();
+            }
+            p->setRed(false); g->setRed(true);
+            rotateRight(g);
+        } else {
+            RBNode<Key, Value>* u = g->getLeft();
+            if(isRed(u)){
+                p->setRed(false); u->setRed(false); g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getLeft()){
+                rotateRight(p);
+                n = p;
+                p = n->getParent();
+            }
+            p->setRed(false); g->setRed(true);
+            rotateLeft(g);
+        }
+        break;
+    }
+    root()->setRed(false);
+}
+
+/**
+* Removes key if present; a node with two children first swaps places with
+* its predecessor.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::remove(const Key& key)
+{
+    RBNode<Key, Value>* n = static_cast<RBNode<Key, Value>*>(this->internalFind(key));
+    if(n == nullptr){
+        return;
+    }
+    if(n->getLeft() != nullptr && n->getRight() != nullptr){
+        nodeSwap(n, static_cast<RBNode<Key, Value>*>(this->predecessor(n)));
+    }
+    //n now has at most one child, which takes its place
+    RBNode<Key, Value>* child = (n->getLeft() != nullptr) ? n->getLeft() : n->getRight();
+    RBNode<Key, Value>* parent = n->getParent();
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(parent == nullptr){
+        this->root_ = child;
+    } else if(parent->getLeft() == n){
+        parent->setLeft(child);
+    } else {
+        parent->setRight(child);
+    }
+    if(!n->isRed()){
+        if(isRed(child)){
+            child->setRed(false);
+        } else {
+            fixRemove(child, parent);
+        }
+    }
+    delete n;
+}
+
+/**
+* Removes the extra black carried by n (possibly NULL), whose parent is
+* parent. Only the recolor-and-move-up case loops; the rotation cases
+* finish after at most three rotations.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::fixRemove(RBNode<Key, Value>* n, RBNode<Key, Value>* parent)
+{
+    while(n != this->root_ && !isRed(n)){
+        if(n == parent->getLeft()){
+            RBNode<Key, Value>* s = parent->getRight(); //non-null: n's side is short one black
+            if(s->isRed()){
+                s->setRed(false); parent->setRed(true);
+                rotateLeft(parent);
+                s = parent->getRight();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())){
+                s->setRed(true);
+                n = parent;
+                parent = n->getParent();
+                continue;
+            }
+            if(!isRed(s->getRight())){
+                s->getLeft()->setRed(false); s->setRed(true);
+                rotateRight(s);
+                s = parent->getRight();
+            }
+            s->setRed(parent->isRed());
+            parent->setRed(false);
+            s->getRight()->setRed(false);
+            rotateLeft(parent);
+        } else {
+            RBNode<Key, Value>* s = parent->getLeft();
+            if(s->isRed()){
+                s->setRed(false); parent->setRed(true);
+                rotateRight(parent);
+                s = parent->getLeft();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())){
+                s->setRed(true);
+                n = parent;
+                parent = n->getParent();
+                continue;
+            }
+            if(!isRed(s->getLeft())){
+                s->getRight()->setRed(false); s->setRed(true);
+                rotateLeft(s);
+                s = parent->getLeft();
+            }
+            s->setRed(parent->isRed());
+            parent->setRed(false);
+            s->getLeft()->setRed(false);
+            rotateRight(parent);
+        }
+        n = root();
+        break;
+    }
+    if(n != nullptr){
+        n->setRed(false);
+    }
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rotateLeft(RBNode<Key, Value>* n)
+{
+    RBNode<Key, Value>* p = n->getParent();
+    RBNode<Key, Value>* c = n->getRight();
+    n->setRight(c->getLeft());
+    if(c->getLeft() != nullptr)
+        c->getLeft()->setParent(n);
+    c->setLeft(n);
+    c->setParent(p);
+    n->setParent(c);
+    if(p == nullptr){
+        this->root_ = c;
+    } else if(p->getLeft() == n){
+        p->setLeft(c);
+    } else {
+        p->setRight(c);
+    }
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rotateRight(RBNode<Key, Value>* n)
+{
+    RBNode<Key, Value>* p = n->getParent();
+    RBNode<Key, Value>* c = n->getLeft();
+    n->setLeft(c->getRight());
+    if(c->getRight() != nullptr)
+        c->getRight()->setParent(n);
+    c->setRight(n);
+    c->setParent(p);
+    n->setParent(c);
+    if(p == nullptr){
+        this->root_ = c;
+    } else if(p->getLeft() == n){
+        p->setLeft(c);
+    } else {
+        p->setRight(c);
+    }
+}
+
+//NULL leaves count as black
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRed(RBNode<Key, Value>* n)
+{
+    return n != nullptr && n->isRed();
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RedBlackTree<Key, Value>::root() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->root_);
+}
+
+/**
+* Swaps the positions of two nodes; the colors stay with the positions.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+
+#endif
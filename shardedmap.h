@@ -0,0 +1,361 @@
+#ifndef SHARDEDMAP_H
+#define SHARDEDMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/**
+* A reader/writer spin lock in one word, for C++11 which has no
+* std::shared_mutex. Readers share the lock by counting themselves in the
+* low bits. A waiting writer sets a flag that keeps new readers out, so a
+* steady stream of lookups cannot starve updates. Waiters spin briefly and
+* then yield, which suits the short critical sections of a tree shard.
+*
+* lock/unlock make it usable with std::lock_guard.
+*/
+class ReadWriteLock
+{
+public:
+    ReadWriteLock();
+
+    void lock();
+    void unlock();
+    void lock_shared();
+    void unlock_shared();
+
+private:
+    static const unsigned writer_ = 1u << 31;
+    static const unsigned waiting_ = 1u << 30;
+    static void pause(unsigned& spins);
+
+    ReadWriteLock(const ReadWriteLock&);
+    ReadWriteLock& operator=(const ReadWriteLock&);
+
+    std::atomic<unsigned> state_;
+};
+
+inline ReadWriteLock::ReadWriteLock() :
+    state_(0)
+{
+
+}
+
+inline void ReadWriteLock::lock()
+{
+    unsigned spins = 0;
+    while(true)
+    {
+        unsigned s = state_.load(std::memory_order_relaxed);
+        if((s & ~waiting_) == 0)
+        {
+            if(state_.compare_exchange_weak(s, writer_, std::memory_order_acquire))
+            {
+                return;
+            }
+        }
+        else if((s & waiting_) == 0)
+        {
+            state_.fetch_or(waiting_, std::memory_order_relaxed);
+        }
+        pause(spins);
+    }
+}
+
+inline void ReadWriteLock::unlock()
+{
+    state_.fetch_and(~writer_, std::memory_order_release);
+}
+
+inline void ReadWriteLock::lock_shared()
+{
+    unsigned spins = 0;
+    while(true)
+    {
+        unsigned s = state_.load(std::memory_order_relaxed);
+        if((s & (writer_ | waiting_)) == 0)
+        {
+            if(state_.compare_exchange_weak(s, s + 1, std::memory_order_acquire))
+            {
+                return;
+            }
+        }
+        pause(spins);
+    }
+}
+
+inline void ReadWriteLock::unlock_shared()
+{
+    state_.fetch_sub(1, std::memory_order_release);
+}
+
+inline void ReadWriteLock::pause(unsigned& spins)
+{
+    if(++spins > 64)
+    {
+        std::this_thread::yield();
+    }
+}
+
+/**
+* A concurrent ordered map made of AVLTree shards, each covering one key
+* range and guarded by its own ReadWriteLock. Lookups take a shard's lock
+* shared and updates take it exclusively, so threads working on different
+* shards never contend and readers of one shard run in parallel.
+*
+* The key ranges are fixed by the splitter keys given to the constructor:
+* shard i holds the keys k with splitters[i-1] <= k < splitters[i].
+* pickSplitters() chooses splitters from a sample of the expected keys so
+* that the shards come out about equally full.
+*
+* for_each and visit_range visit the shards in key order, holding each
+* shard's lock only while that shard is walked. Every shard is seen in a
+* consistent state, but updates to shards not yet visited may show up.
+* Callbacks run under a shard lock and must not call back into the map.
+*/
+template <typename Key, typename Value>
+class ShardedAVLMap
+{
+public:
+    explicit ShardedAVLMap(const std::vector<Key>& splitters);
+    ~ShardedAVLMap();
+
+    template<typename InputIt>
+    static std::vector<Key> pickSplitters(InputIt first, InputIt last, size_t shards);
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    template<typename Fn>
+    bool update(const Key& key, Fn fn);
+    void clear();
+    size_t shardCount() const;
+
+    template<typename Fn>
+    void for_each(Fn fn) const;
+    template<typename Fn>
+    void visit_range(const Key& low, const Key& high, Fn fn) const;
+
+private:
+    // Padded so that the locks of neighbouring shards never share a cache line.
+    struct Shard
+    {
+        ReadWriteLock lock;
+        AVLTree<Key, Value> tree;
+        char pad[64];
+    };
+
+    // std::lock_guard for the shared side of a ReadWriteLock.
+    struct ReadGuard
+    {
+        explicit ReadGuard(ReadWriteLock& lock) : lock_(lock) { lock_.lock_shared(); }
+        ~ReadGuard() { lock_.unlock_shared(); }
+        ReadWriteLock& lock_;
+    };
+
+    size_t shardFor(const Key& key) const;
+
+    ShardedAVLMap(const ShardedAVLMap&);
+    ShardedAVLMap& operator=(const ShardedAVLMap&);
+
+    std::vector<Key> splitters_;
+    std::vector<Shard*> shards_;
+};
+
+/**
+* Creates one shard per range between consecutive splitters, plus one below
+* the first and one above the last. Throws std::invalid_argument unless the
+* splitters are strictly increasing.
+*/
+template<class Key, class Value>
+ShardedAVLMap<Key, Value>::ShardedAVLMap(const std::vector<Key>& splitters) :
+    splitters_(splitters)
+{
+    for(size_t i = 1; i < splitters_.size(); ++i)
+    {
+        if(!(splitters_[i - 1] < splitters_[i]))
+        {
+            throw std::invalid_argument("ShardedAVLMap: splitters must be strictly increasing");
+        }
+    }
+    for(size_t i = 0; i <= splitters_.size(); ++i)
+    {
+        shards_.push_back(new Shard);
+    }
+}
+
+template<class Key, class Value>
+ShardedAVLMap<Key, Value>::~ShardedAVLMap()
+{
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        delete shards_[i];
+    }
+}
+
+/**
+* Picks shards - 1 splitters at evenly spaced ranks of the sample
+* [first, last). Duplicate keys in the sample are ignored, so a sample
+* with fewer distinct keys than shards yields fewer shards.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+std::vector<Key> ShardedAVLMap<Key, Value>::pickSplitters(InputIt first, InputIt last, size_t shards)
+{
+    std::vector<Key> sample(first, last);
+    std::sort(sample.begin(), sample.end());
+    sample.erase(std::unique(sample.begin(), sample.end(),
+                             [](const Key& a, const Key& b) { return !(a < b) && !(b < a); }),
+                 sample.end());
+    std::vector<Key> splitters;
+    for(size_t i = 1; i < shards && !sample.empty(); ++i)
+    {
+        const Key& k = sample[i * sample.size() / shards];
+        if(splitters.empty() || splitters.back() < k)
+        {
+            splitters.push_back(k);
+        }
+    }
+    return splitters;
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present,
+* holding the lock of the shard that owns the key exclusively.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    Shard* s = shards_[shardFor(new_item.first)];
+    std::lock_guard<ReadWriteLock> guard(s->lock);
+    s->tree.insert(new_item);
+}
+
+/**
+* Removes key if present, holding the lock of the shard that owns the key
+* exclusively.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::remove(const Key& key)
+{
+    Shard* s = shards_[shardFor(key)];
+    std::lock_guard<ReadWriteLock> guard(s->lock);
+    s->tree.remove(key);
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns
+* false if the key is missing. A copy is returned rather than a reference
+* because another thread may remove the item as soon as the lock is dropped.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    Shard* s = shards_[shardFor(key)];
+    ReadGuard guard(s->lock);
+    typename AVLTree<Key, Value>::iterator it = s->tree.find(key);
+    if(it == s->tree.end())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::contains(const Key& key) const
+{
+    Shard* s = shards_[shardFor(key)];
+    ReadGuard guard(s->lock);
+    return s->tree.find(key) != s->tree.end();
+}
+
+/**
+* Calls fn(value) on the value stored under key while holding the shard
+* exclusively, for atomic read-modify-write. Returns false, without
+* calling fn, if the key is missing.
+*/
+template<class Key, class Value>
+template<typename Fn>
+bool ShardedAVLMap<Key, Value>::update(const Key& key, Fn fn)
+{
+    Shard* s = shards_[shardFor(key)];
+    std::lock_guard<ReadWriteLock> guard(s->lock);
+    typename AVLTree<Key, Value>::iterator it = s->tree.find(key);
+    if(it == s->tree.end())
+    {
+        return false;
+    }
+    fn(it->second);
+    return true;
+}
+
+/**
+* Empties every shard, one at a time.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::clear()
+{
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        std::lock_guard<ReadWriteLock> guard(shards_[i]->lock);
+        shards_[i]->tree.clear();
+    }
+}
+
+template<class Key, class Value>
+size_t ShardedAVLMap<Key, Value>::shardCount() const
+{
+    return shards_.size();
+}
+
+/**
+* Calls fn(item) with a const std::pair<const Key, Value>& for every item,
+* in key order.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void ShardedAVLMap<Key, Value>::for_each(Fn fn) const
+{
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        ReadGuard guard(shards_[i]->lock);
+        shards_[i]->tree.visit_inorder([&fn](const std::pair<const Key, Value>& item) { fn(item); });
+    }
+}
+
+/**
+* Like for_each, but only for keys in [low, high]. Only the shards whose
+* ranges overlap [low, high] are locked.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void ShardedAVLMap<Key, Value>::visit_range(const Key& low, const Key& high, Fn fn) const
+{
+    if(high < low)
+    {
+        return;
+    }
+    size_t last = shardFor(high);
+    for(size_t i = shardFor(low); i <= last; ++i)
+    {
+        ReadGuard guard(shards_[i]->lock);
+        shards_[i]->tree.visit_range(low, high, [&fn](const std::pair<const Key, Value>& item) { fn(item); });
+    }
+}
+
+//index of the shard whose range holds key
+template<class Key, class Value>
+size_t ShardedAVLMap<Key, Value>::shardFor(const Key& key) const
+{
+    return std::upper_bound(splitters_.begin(), splitters_.end(), key) - splitters_.begin();
+}
+
+
+#endif
@@ -0,0 +1,806 @@
+#ifndef SHAREDAVL_H
+#define SHAREDAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* An AVL tree that lives in a named POSIX shared memory segment, so that
+* several processes can map the same tree instead of each holding its own
+* copy. The segment holds a small header and a fixed array of nodes. Links
+* are node indexes into that array (0 is null) rather than pointers, so
+* they mean the same thing wherever a process happens to map the segment.
+* Keys and values are stored in place and must be trivially copyable.
+*
+* Updates are serialized by a spin lock in the header, so any process may
+* write, but one at a time. A seqlock coordinates them with readers: the
+* writer makes the sequence number odd before it changes anything and
+* even again when it is done. A reader takes no lock. It notes the
+* sequence number, descends, and keeps its answer only if the number was
+* even and has not moved; otherwise it tries again. A reader may see a
+* half-updated tree, so it bounds-checks every link and gives up after
+* more steps than an AVL tree of the segment's capacity can be deep. Like
+* every seqlock, this reads keys and values while the writer may be
+* copying them and relies on the validation to discard what was torn.
+*
+* The capacity is fixed when the segment is created; removed nodes go on
+* a free list and are reused. A writer that dies holding the lock leaves
+* the tree locked and the sequence number odd, so readers spin; the
+* segment must then be unlinked and rebuilt.
+*/
+template <typename Key, typename Value>
+class SharedAVLTree
+{
+public:
+    SharedAVLTree(const std::string& name, size_t capacity);
+    explicit SharedAVLTree(const std::string& name);
+    ~SharedAVLTree();
+
+    static void unlink(const std::string& name);
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    size_t capacity() const;
+    size_t bytes() const;
+
+    template<typename Fn>
+    void for_each(Fn fn) const;
+
+private:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "shared trees need trivially copyable keys and values");
+    static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+                  "shared trees need lock-free atomics, which are address-free");
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t nodeSize;
+        uint64_t capacity;
+        // set last by the creator; openers wait for it
+        std::atomic<uint32_t> ready;
+        std::atomic<uint32_t> writer;
+        // odd while a writer is changing the tree
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint32_t> root;
+        std::atomic<uint64_t> size;
+        // only touched under the writer lock
+        uint32_t freeList;
+        uint32_t used;
+    };
+
+    // Free nodes are chained through left.
+    struct Node
+    {
+        Key key;
+        Value value;
+        std::atomic<uint32_t> left;
+        std::atomic<uint32_t> right;
+        int height;
+    };
+
+    // Holds the writer lock; begin() makes the sequence number odd until
+    // the guard goes away.
+    class WriteGuard
+    {
+    public:
+        explicit WriteGuard(SharedAVLTree* tree);
+        ~WriteGuard();
+        void begin();
+    private:
+        SharedAVLTree* tree_;
+        bool writing_;
+    };
+
+    enum Outcome { Retry, Absent, Present };
+
+    static const uint32_t version_ = 1;
+    // deeper than any AVL tree of 2^32 nodes
+    static const unsigned maxDepth_ = 64;
+    static const size_t nodesOffset_ = (sizeof(Header) + 63) / 64 * 64;
+
+    void map(const std::string& name, int fd);
+    void lockWriter();
+    void unlockWriter();
+    uint64_t beginRead(unsigned& spins) const;
+    bool endRead(uint64_t seq) const;
+    Outcome attemptFind(const Key& key, Value& value) const;
+    Outcome attemptCollect(std::vector<std::pair<Key, Value> >& items) const;
+
+    uint32_t left(uint32_t i) const { return nodes_[i].left.load(std::memory_order_relaxed); }
+    uint32_t right(uint32_t i) const { return nodes_[i].right.load(std::memory_order_relaxed); }
+    void setLeft(uint32_t i, uint32_t c) { nodes_[i].left.store(c, std::memory_order_relaxed); }
+    void setRight(uint32_t i, uint32_t c) { nodes_[i].right.store(c, std::memory_order_relaxed); }
+    int heightOf(uint32_t i) const { return i == 0 ? 0 : nodes_[i].height; }
+
+    uint32_t allocate(const Key& key, const Value& value);
+    void release(uint32_t i);
+    bool locate(const Key& key) const;
+    uint32_t insertAt(uint32_t i, const Key& key, const Value& value);
+    uint32_t removeAt(uint32_t i, const Key& key);
+    uint32_t removeMin(uint32_t i, uint32_t& min);
+    uint32_t rebalance(uint32_t i);
+    uint32_t rotateLeft(uint32_t i);
+    uint32_t rotateRight(uint32_t i);
+    void fixHeight(uint32_t i);
+
+    static void pause(unsigned& spins);
+    static void fail(const std::string& what, const std::string& name);
+
+    SharedAVLTree(const SharedAVLTree&);
+    SharedAVLTree& operator=(const SharedAVLTree&);
+
+    void* map_;
+    size_t length_;
+    Header* header_;
+    Node* nodes_;
+    // copied from the header when mapped, so a writer cannot widen it
+    uint32_t capacity_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the SharedAVLTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Creates the segment name with room for capacity keys, or maps it if it
+* already exists, in which case capacity is ignored. Names follow
+* shm_open: a slash followed by up to NAME_MAX characters, e.g. "/tree".
+* Throws std::runtime_error if the segment cannot be created or mapped or
+* holds a tree of other key or value types.
+*/
+template<class Key, class Value>
+SharedAVLTree<Key, Value>::SharedAVLTree(const std::string& name, size_t capacity) :
+    map_(nullptr),
+    length_(0),
+    header_(nullptr),
+    nodes_(nullptr),
+    capacity_(0)
+{
+    if(capacity == 0 || capacity >= UINT32_MAX)
+    {
+        throw std::invalid_argument("SharedAVLTree: capacity must be between 1 and 2^32 - 2");
+    }
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST)
+    {
+        fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if(fd < 0)
+        {
+            fail("cannot open", name);
+        }
+        map(name, fd);
+        return;
+    }
+    if(fd < 0)
+    {
+        fail("cannot create", name);
+    }
+    size_t length = nodesOffset_ + (capacity + 1) * sizeof(Node);
+    if(::ftruncate(fd, static_cast<off_t>(length)) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        errno = err;
+        fail("cannot size", name);
+    }
+    map_ = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if(map_ == MAP_FAILED)
+    {
+        map_ = nullptr;
+        ::shm_unlink(name.c_str());
+        errno = err;
+        fail("cannot map", name);
+    }
+    length_ = length;
+    // the segment arrives zero-filled, so the nodes need no initialization
+    header_ = new (map_) Header;
+    std::memcpy(header_->magic, "BSTSHM", 7);
+    header_->version = version_;
+    header_->keySize = sizeof(Key);
+    header_->valueSize = sizeof(Value);
+    header_->nodeSize = sizeof(Node);
+    header_->capacity = capacity;
+    header_->writer.store(0, std::memory_order_relaxed);
+    header_->sequence.store(0, std::memory_order_relaxed);
+    header_->root.store(0, std::memory_order_relaxed);
+    header_->size.store(0, std::memory_order_relaxed);
+    header_->freeList = 0;
+    header_->used = 1;
+    nodes_ = reinterpret_cast<Node*>(static_cast<char*>(map_) + nodesOffset_);
+    capacity_ = static_cast<uint32_t>(capacity);
+    header_->ready.store(1, std::memory_order_release);
+}
+
+/**
+* Maps the existing segment name. Throws std::runtime_error if there is
+* none or it does not hold a tree of these key and value types.
+*/
+template<class Key, class Value>
+SharedAVLTree<Key, Value>::SharedAVLTree(const std::string& name) :
+    map_(nullptr),
+    length_(0),
+    header_(nullptr),
+    nodes_(nullptr),
+    capacity_(0)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if(fd < 0)
+    {
+        fail("cannot open", name);
+    }
+    map(name, fd);
+}
+
+template<class Key, class Value>
+SharedAVLTree<Key, Value>::~SharedAVLTree()
+{
+    if(map_ != nullptr)
+    {
+        ::munmap(map_, length_);
+    }
+}
+
+/**
+* Removes the name; processes that have the segment mapped keep it until
+* they unmap it. A missing name is not an error.
+*/
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::unlink(const std::string& name)
+{
+    ::shm_unlink(name.c_str());
+}
+
+/**
+* Maps a segment that another process may still be setting up: it waits
+* for the creator to size it and then to mark the header ready, and
+* checks the header before trusting anything else in it. Takes ownership
+* of fd.
+*/
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::map(const std::string& name, int fd)
+{
+    struct stat st;
+    unsigned spins = 0;
+    while(true)
+    {
+        if(::fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            fail("cannot stat", name);
+        }
+        if(st.st_size > 0 || spins > 100000)
+        {
+            break;
+        }
+        pause(spins);
+    }
+    size_t length = static_cast<size_t>(st.st_size);
+    if(length < nodesOffset_)
+    {
+        ::close(fd);
+        throw std::runtime_error("shared tree " + name + " is truncated");
+    }
+    map_ = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if(map_ == MAP_FAILED)
+    {
+        map_ = nullptr;
+        errno = err;
+        fail("cannot map", name);
+    }
+    length_ = length;
+    header_ = static_cast<Header*>(map_);
+    spins = 0;
+    while(header_->ready.load(std::memory_order_acquire) == 0 && spins <= 100000)
+    {
+        pause(spins);
+    }
+
+    std::string problem;
+    if(header_->ready.load(std::memory_order_acquire) == 0)
+    {
+        problem = "was never initialized";
+    }
+    else if(std::memcmp(header_->magic, "BSTSHM", 7) != 0)
+    {
+        problem = "is not a shared tree";
+    }
+    else if(header_->version != version_)
+    {
+        problem = "has unsupported version " + std::to_string(header_->version);
+    }
+    else if(header_->keySize != sizeof(Key) || header_->valueSize != sizeof(Value)
+            || header_->nodeSize != sizeof(Node))
+    {
+        problem = "holds keys or values of another size";
+    }
+    else if(header_->capacity == 0 || header_->capacity >= UINT32_MAX
+            || header_->capacity > (length - nodesOffset_) / sizeof(Node) - 1)
+    {
+        problem = "is truncated or corrupt";
+    }
+    if(!problem.empty())
+    {
+        ::munmap(map_, length_);
+        map_ = nullptr;
+        throw std::runtime_error("shared tree " + name + " " + problem);
+    }
+    nodes_ = reinterpret_cast<Node*>(static_cast<char*>(map_) + nodesOffset_);
+    capacity_ = static_cast<uint32_t>(header_->capacity);
+}
+
+/**
+* Adds the item, or replaces the value if the key is present. Throws
+* std::length_error, leaving the tree unchanged, if the key is new and the
+* segment is full.
+*/
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    WriteGuard guard(this);
+    guard.begin();
+    uint32_t root = insertAt(header_->root.load(std::memory_order_relaxed), new_item.first, new_item.second);
+    header_->root.store(root, std::memory_order_relaxed);
+}
+
+/**
+* Removes key and returns whether it was there. Readers are only
+* disturbed if it was.
+*/
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::remove(const Key& key)
+{
+    WriteGuard guard(this);
+    if(!locate(key))
+    {
+        return false;
+    }
+    guard.begin();
+    uint32_t root = removeAt(header_->root.load(std::memory_order_relaxed), key);
+    header_->root.store(root, std::memory_order_relaxed);
+    return true;
+}
+
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    unsigned spins = 0;
+    while(true)
+    {
+        uint64_t seq = beginRead(spins);
+        Outcome o = attemptFind(key, value);
+        if(endRead(seq) && o != Retry)
+        {
+            return o == Present;
+        }
+        pause(spins);
+    }
+}
+
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::contains(const Key& key) const
+{
+    Value value;
+    return find(key, value);
+}
+
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+template<class Key, class Value>
+size_t SharedAVLTree<Key, Value>::size() const
+{
+    return static_cast<size_t>(header_->size.load(std::memory_order_relaxed));
+}
+
+template<class Key, class Value>
+size_t SharedAVLTree<Key, Value>::capacity() const
+{
+    return capacity_;
+}
+
+//the size of the segment, which every process shares
+template<class Key, class Value>
+size_t SharedAVLTree<Key, Value>::bytes() const
+{
+    return length_;
+}
+
+/**
+* Calls fn on every item in key order. The items are copied out under the
+* seqlock first, so fn sees one consistent state of the tree and may take
+* as long as it likes.
+*/
+template<class Key, class Value>
+template<typename Fn>
+void SharedAVLTree<Key, Value>::for_each(Fn fn) const
+{
+    std::vector<std::pair<Key, Value> > items;
+    unsigned spins = 0;
+    while(true)
+    {
+        uint64_t seq = beginRead(spins);
+        Outcome o = attemptCollect(items);
+        if(endRead(seq) && o != Retry)
+        {
+            break;
+        }
+        pause(spins);
+    }
+    for(size_t i = 0; i < items.size(); ++i)
+    {
+        fn(items[i]);
+    }
+}
+
+template<class Key, class Value>
+SharedAVLTree<Key, Value>::WriteGuard::WriteGuard(SharedAVLTree* tree) :
+    tree_(tree),
+    writing_(false)
+{
+    tree_->lockWriter();
+}
+
+template<class Key, class Value>
+SharedAVLTree<Key, Value>::WriteGuard::~WriteGuard()
+{
+    if(writing_)
+    {
+        std::atomic<uint64_t>& seq = tree_->header_->sequence;
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    tree_->unlockWriter();
+}
+
+/**
+* Readers that start from here on wait, and readers already descending
+* will fail validation. The fence keeps the stores that follow from
+* becoming visible before the odd number.
+*/
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::WriteGuard::begin()
+{
+    std::atomic<uint64_t>& seq = tree_->header_->sequence;
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    writing_ = true;
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::lockWriter()
+{
+    unsigned spins = 0;
+    uint32_t expected = 0;
+    while(!header_->writer.compare_exchange_weak(expected, 1, std::memory_order_acquire))
+    {
+        expected = 0;
+        pause(spins);
+    }
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::unlockWriter()
+{
+    header_->writer.store(0, std::memory_order_release);
+}
+
+//waits out a writer and returns the even sequence number it left
+template<class Key, class Value>
+uint64_t SharedAVLTree<Key, Value>::beginRead(unsigned& spins) const
+{
+    uint64_t seq = header_->sequence.load(std::memory_order_acquire);
+    while((seq & 1) != 0)
+    {
+        pause(spins);
+        seq = header_->sequence.load(std::memory_order_acquire);
+    }
+    return seq;
+}
+
+//whether nothing was written since beginRead returned seq
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::endRead(uint64_t seq) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header_->sequence.load(std::memory_order_relaxed) == seq;
+}
+
+/**
+* One unvalidated descent. A link out of range or a path too long to be
+* real can only come from a concurrent update, and means Retry.
+*/
+template<class Key, class Value>
+typename SharedAVLTree<Key, Value>::Outcome SharedAVLTree<Key, Value>::attemptFind(const Key& key, Value& value) const
+{
+    uint32_t i = header_->root.load(std::memory_order_relaxed);
+    for(unsigned depth = 0; i != 0; ++depth)
+    {
+        if(i > capacity_ || depth > maxDepth_)
+        {
+            return Retry;
+        }
+        const Node& n = nodes_[i];
+        if(key < n.key)
+        {
+            i = n.left.load(std::memory_order_relaxed);
+        }
+        else if(n.key < key)
+        {
+            i = n.right.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            value = n.value;
+            return Present;
+        }
+    }
+    return Absent;
+}
+
+//an unvalidated in-order copy of the tree, checked like attemptFind
+template<class Key, class Value>
+typename SharedAVLTree<Key, Value>::Outcome SharedAVLTree<Key, Value>::attemptCollect(std::vector<std::pair<Key, Value> >& items) const
+{
+    items.clear();
+    uint32_t stack[maxDepth_ + 1];
+    unsigned depth = 0;
+    uint32_t i = header_->root.load(std::memory_order_relaxed);
+    while(i != 0 || depth > 0)
+    {
+        while(i != 0)
+        {
+            if(i > capacity_ || depth > maxDepth_)
+            {
+                return Retry;
+            }
+            stack[depth++] = i;
+            i = left(i);
+        }
+        i = stack[--depth];
+        if(items.size() >= capacity_)
+        {
+            return Retry;
+        }
+        items.push_back(std::make_pair(nodes_[i].key, nodes_[i].value));
+        i = right(i);
+    }
+    return Present;
+}
+
+//a free node holding key and value, or std::length_error
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::allocate(const Key& key, const Value& value)
+{
+    uint32_t i = header_->freeList;
+    if(i != 0)
+    {
+        header_->freeList = left(i);
+    }
+    else if(header_->used <= capacity_)
+    {
+        i = header_->used++;
+    }
+    else
+    {
+        throw std::length_error("SharedAVLTree: segment is full");
+    }
+    Node& n = nodes_[i];
+    n.key = key;
+    n.value = value;
+    setLeft(i, 0);
+    setRight(i, 0);
+    n.height = 1;
+    header_->size.fetch_add(1, std::memory_order_relaxed);
+    return i;
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::release(uint32_t i)
+{
+    setRight(i, 0);
+    setLeft(i, header_->freeList);
+    header_->freeList = i;
+    header_->size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//whether key is present; for the writer, which needs no validation
+template<class Key, class Value>
+bool SharedAVLTree<Key, Value>::locate(const Key& key) const
+{
+    uint32_t i = header_->root.load(std::memory_order_relaxed);
+    while(i != 0)
+    {
+        if(key < nodes_[i].key)
+        {
+            i = left(i);
+        }
+        else if(nodes_[i].key < key)
+        {
+            i = right(i);
+        }
+        else
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Inserts into the subtree at i and returns its new root. A new node is
+* allocated before any link changes, so a full segment leaves the tree
+* as it was.
+*/
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::insertAt(uint32_t i, const Key& key, const Value& value)
+{
+    if(i == 0)
+    {
+        return allocate(key, value);
+    }
+    if(key < nodes_[i].key)
+    {
+        setLeft(i, insertAt(left(i), key, value));
+    }
+    else if(nodes_[i].key < key)
+    {
+        setRight(i, insertAt(right(i), key, value));
+    }
+    else
+    {
+        nodes_[i].value = value;
+        return i;
+    }
+    return rebalance(i);
+}
+
+/**
+* Removes key, which must be present, from the subtree at i and returns
+* its new root. A node with two children takes over the item of its
+* successor, whose node is freed instead.
+*/
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::removeAt(uint32_t i, const Key& key)
+{
+    if(key < nodes_[i].key)
+    {
+        setLeft(i, removeAt(left(i), key));
+    }
+    else if(nodes_[i].key < key)
+    {
+        setRight(i, removeAt(right(i), key));
+    }
+    else if(left(i) == 0 || right(i) == 0)
+    {
+        uint32_t child = left(i) != 0 ? left(i) : right(i);
+        release(i);
+        return child;
+    }
+    else
+    {
+        uint32_t min = 0;
+        setRight(i, removeMin(right(i), min));
+        nodes_[i].key = nodes_[min].key;
+        nodes_[i].value = nodes_[min].value;
+        release(min);
+    }
+    return rebalance(i);
+}
+
+//unlinks the smallest node of the subtree at i into min; returns the new root
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::removeMin(uint32_t i, uint32_t& min)
+{
+    if(left(i) == 0)
+    {
+        min = i;
+        return right(i);
+    }
+    setLeft(i, removeMin(left(i), min));
+    return rebalance(i);
+}
+
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::rebalance(uint32_t i)
+{
+    fixHeight(i);
+    int balance = heightOf(left(i)) - heightOf(right(i));
+    if(balance > 1)
+    {
+        uint32_t l = left(i);
+        if(heightOf(left(l)) < heightOf(right(l)))
+        {
+            setLeft(i, rotateLeft(l));
+        }
+        return rotateRight(i);
+    }
+    if(balance < -1)
+    {
+        uint32_t r = right(i);
+        if(heightOf(right(r)) < heightOf(left(r)))
+        {
+            setRight(i, rotateRight(r));
+        }
+        return rotateLeft(i);
+    }
+    return i;
+}
+
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::rotateLeft(uint32_t i)
+{
+    uint32_t r = right(i);
+    setRight(i, left(r));
+    setLeft(r, i);
+    fixHeight(i);
+    fixHeight(r);
+    return r;
+}
+
+template<class Key, class Value>
+uint32_t SharedAVLTree<Key, Value>::rotateRight(uint32_t i)
+{
+    uint32_t l = left(i);
+    setLeft(i, right(l));
+    setRight(l, i);
+    fixHeight(i);
+    fixHeight(l);
+    return l;
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::fixHeight(uint32_t i)
+{
+    nodes_[i].height = 1 + std::max(heightOf(left(i)), heightOf(right(i)));
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::pause(unsigned& spins)
+{
+    if(++spins > 64)
+    {
+        std::this_thread::yield();
+    }
+}
+
+template<class Key, class Value>
+void SharedAVLTree<Key, Value>::fail(const std::string& what, const std::string& name)
+{
+    throw std::runtime_error("shared tree: " + what + " " + name + ": " + std::strerror(errno));
+}
+
+
+#endif
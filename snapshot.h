@@ -0,0 +1,491 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* A binary snapshot of a sorted map with trivially copyable keys and
+* values, as written by AVLTree::save().
+*
+* The file is a 64-byte header followed by two arrays, so that it can be
+* mapped and searched in place:
+*
+*   offset 0   magic "BSTSNAP\0"
+*          8   format version (uint32)
+*         12   0x01020304 as written, to catch a byte order mismatch
+*         16   sizeof(Key), sizeof(Value) (uint32 each)
+*         24   item count (uint64)
+*         32   offset of the keys (uint64), 64
+*         40   offset of the values (uint64), a multiple of 64
+*   keys     count keys in strictly increasing order
+*   values   count values, in the order of their keys
+*
+* The header is checked when the file is opened; the arrays are trusted.
+*/
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+    uint64_t keysOffset;
+    uint64_t valuesOffset;
+    char reserved[16];
+};
+
+/**
+* A read-only view of a snapshot file, mapped into memory. Opening it
+* costs one mmap; pages are read in as lookups touch them. Lookups are a
+* branchless binary search over the mapped keys.
+*
+* The iterator walks the items in key order. Dereferencing it yields a
+* std::pair of const references into the mapping, which stay valid as
+* long as the view does.
+*/
+template <typename Key, typename Value>
+class SnapshotView
+{
+public:
+    static const uint32_t version = 1;
+
+    explicit SnapshotView(const std::string& path);
+    ~SnapshotView();
+
+    static void write(const std::string& path, const std::vector<Key>& keys, const std::vector<Value>& values);
+
+    /**
+    * An in-order iterator. operator-> goes through a small proxy that
+    * holds the pair of references.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, const Value&> reference;
+        struct pointer
+        {
+            reference item;
+            const reference* operator->() const { return &item; }
+        };
+
+        iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+
+    protected:
+        friend class SnapshotView<Key, Value>;
+        iterator(const SnapshotView<Key, Value>* view, size_t i);
+        const SnapshotView<Key, Value>* view_;
+        size_t i_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+
+    bool empty() const;
+    size_t size() const;
+    const Key* keys() const;
+    const Value* values() const;
+    void prefetch() const;
+
+private:
+    SnapshotView(const SnapshotView&);
+    SnapshotView& operator=(const SnapshotView&);
+
+    static const size_t align_ = 64;
+    static void fail(const std::string& what, const std::string& path);
+    static void abandon(const std::string& what, const std::string& tmp);
+    static void syncDirectory(const std::string& path);
+    size_t search(const Key& key) const;
+
+    void* map_;
+    size_t length_;
+    const Key* keys_;
+    const Value* values_;
+    size_t size_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the SnapshotView::iterator class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value>
+SnapshotView<Key, Value>::iterator::iterator() :
+    view_(nullptr),
+    i_(0)
+{
+
+}
+
+template<class Key, class Value>
+SnapshotView<Key, Value>::iterator::iterator(const SnapshotView<Key, Value>* view, size_t i) :
+    view_(view),
+    i_(i)
+{
+
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator::reference SnapshotView<Key, Value>::iterator::operator*() const
+{
+    return reference(view_->keys_[i_], view_->values_[i_]);
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator::pointer SnapshotView<Key, Value>::iterator::operator->() const
+{
+    pointer p = { **this };
+    return p;
+}
+
+template<class Key, class Value>
+bool SnapshotView<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return i_ == rhs.i_;
+}
+
+template<class Key, class Value>
+bool SnapshotView<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return i_ != rhs.i_;
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator& SnapshotView<Key, Value>::iterator::operator++()
+{
+    ++i_;
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  Begin implementations for the SnapshotView class.
+  -----------------------------------------------
+*/
+
+/**
+* Maps the snapshot at path. Throws std::runtime_error if the file cannot
+* be opened or mapped, or if its header does not describe a snapshot of
+* this version for these key and value types.
+*/
+template<class Key, class Value>
+SnapshotView<Key, Value>::SnapshotView(const std::string& path) :
+    map_(nullptr),
+    length_(0),
+    keys_(nullptr),
+    values_(nullptr),
+    size_(0)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "snapshots need trivially copyable keys and values");
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        fail("cannot open", path);
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        fail("cannot stat", path);
+    }
+    length_ = static_cast<size_t>(st.st_size);
+    if(length_ < sizeof(SnapshotHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("snapshot " + path + " is truncated");
+    }
+    map_ = ::mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if(map_ == MAP_FAILED)
+    {
+        map_ = nullptr;
+        errno = err;
+        fail("cannot map", path);
+    }
+
+    const SnapshotHeader* h = static_cast<const SnapshotHeader*>(map_);
+    std::string problem;
+    if(std::memcmp(h->magic, "BSTSNAP", 8) != 0)
+    {
+        problem = "is not a snapshot";
+    }
+    else if(h->byteOrder != 0x01020304)
+    {
+        problem = "was written with another byte order";
+    }
+    else if(h->version != version)
+    {
+        problem = "has unsupported version " + std::to_string(h->version);
+    }
+    else if(h->keySize != sizeof(Key) || h->valueSize != sizeof(Value))
+    {
+        problem = "holds keys or values of another size";
+    }
+    else if(h->keysOffset % align_ != 0 || h->valuesOffset % align_ != 0
+            || h->keysOffset < sizeof(SnapshotHeader) || h->keysOffset > length_
+            || h->count > (length_ - h->keysOffset) / sizeof(Key)
+            || h->valuesOffset < h->keysOffset + h->count * sizeof(Key) || h->valuesOffset > length_
+            || h->count > (length_ - h->valuesOffset) / sizeof(Value))
+    {
+        problem = "is truncated or corrupt";
+    }
+    if(!problem.empty())
+    {
+        ::munmap(map_, length_);
+        throw std::runtime_error("snapshot " + path + " " + problem);
+    }
+    const char* base = static_cast<const char*>(map_);
+    keys_ = reinterpret_cast<const Key*>(base + h->keysOffset);
+    values_ = reinterpret_cast<const Value*>(base + h->valuesOffset);
+    size_ = static_cast<size_t>(h->count);
+}
+
+template<class Key, class Value>
+SnapshotView<Key, Value>::~SnapshotView()
+{
+    if(map_ != nullptr)
+    {
+        ::munmap(map_, length_);
+    }
+}
+
+/**
+* Writes keys (strictly increasing) and their values as a snapshot. The
+* data goes to a temporary file that is synced and then renamed over
+* path, and the directory is synced so the rename itself survives a
+* crash: a crash leaves either the old snapshot or the new one. Throws
+* std::runtime_error on any I/O error, after removing the temporary file.
+*/
+template<class Key, class Value>
+void SnapshotView<Key, Value>::write(const std::string& path, const std::vector<Key>& keys, const std::vector<Value>& values)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "snapshots need trivially copyable keys and values");
+    SnapshotHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "BSTSNAP", 8);
+    h.version = version;
+    h.byteOrder = 0x01020304;
+    h.keySize = sizeof(Key);
+    h.valueSize = sizeof(Value);
+    h.count = keys.size();
+    h.keysOffset = align_;
+    uint64_t keysEnd = h.keysOffset + h.count * sizeof(Key);
+    h.valuesOffset = (keysEnd + align_ - 1) / align_ * align_;
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        fail("cannot create", tmp);
+    }
+    static const char zeros[align_] = { 0 };
+    const std::pair<const void*, size_t> parts[] = {
+        std::make_pair(static_cast<const void*>(&h), sizeof(h)),
+        std::make_pair(static_cast<const void*>(zeros), static_cast<size_t>(h.keysOffset - sizeof(h))),
+        std::make_pair(static_cast<const void*>(keys.data()), keys.size() * sizeof(Key)),
+        std::make_pair(static_cast<const void*>(zeros), static_cast<size_t>(h.valuesOffset - keysEnd)),
+        std::make_pair(static_cast<const void*>(values.data()), values.size() * sizeof(Value))
+    };
+    for(size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); ++p)
+    {
+        const char* data = static_cast<const char*>(parts[p].first);
+        size_t left = parts[p].second;
+        while(left > 0)
+        {
+            ssize_t n = ::write(fd, data, left);
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(n <= 0)
+            {
+                int err = (n < 0) ? errno : EIO;
+                ::close(fd);
+                errno = err;
+                abandon("cannot write", tmp);
+            }
+            data += n;
+            left -= static_cast<size_t>(n);
+        }
+    }
+    int err = (::fsync(fd) != 0) ? errno : 0;
+    if(::close(fd) != 0 && err == 0)
+    {
+        err = errno;
+    }
+    if(err != 0)
+    {
+        errno = err;
+        abandon("cannot sync", tmp);
+    }
+    if(::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        abandon("cannot rename over " + path + " from", tmp);
+    }
+    syncDirectory(path);
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator SnapshotView<Key, Value>::begin() const
+{
+    return iterator(this, 0);
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator SnapshotView<Key, Value>::end() const
+{
+    return iterator(this, size_);
+}
+
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator SnapshotView<Key, Value>::find(const Key& key) const
+{
+    size_t i = search(key);
+    if(i == size_ || key < keys_[i])
+    {
+        return end();
+    }
+    return iterator(this, i);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename SnapshotView<Key, Value>::iterator SnapshotView<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(this, search(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+const Value& SnapshotView<Key, Value>::operator[](const Key& key) const
+{
+    size_t i = search(key);
+    if(i == size_ || key < keys_[i]) throw std::out_of_range("Invalid key");
+    return values_[i];
+}
+
+template<class Key, class Value>
+bool SnapshotView<Key, Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value>
+size_t SnapshotView<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+const Key* SnapshotView<Key, Value>::keys() const
+{
+    return keys_;
+}
+
+template<class Key, class Value>
+const Value* SnapshotView<Key, Value>::values() const
+{
+    return values_;
+}
+
+/**
+* Asks the kernel to read the whole file ahead, for callers that are
+* about to touch all of it.
+*/
+template<class Key, class Value>
+void SnapshotView<Key, Value>::prefetch() const
+{
+    ::madvise(map_, length_, MADV_WILLNEED);
+}
+
+template<class Key, class Value>
+void SnapshotView<Key, Value>::fail(const std::string& what, const std::string& path)
+{
+    throw std::runtime_error("snapshot: " + what + " " + path + ": " + std::strerror(errno));
+}
+
+//fail() for write(), which must not leave its temporary file behind
+template<class Key, class Value>
+void SnapshotView<Key, Value>::abandon(const std::string& what, const std::string& tmp)
+{
+    int err = errno;
+    ::unlink(tmp.c_str());
+    errno = err;
+    fail(what, tmp);
+}
+
+//makes a rename into the directory holding path durable
+template<class Key, class Value>
+void SnapshotView<Key, Value>::syncDirectory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if(fd < 0 || ::fsync(fd) != 0)
+    {
+        int err = errno;
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        errno = err;
+        fail("cannot sync directory", dir);
+    }
+    ::close(fd);
+}
+
+/**
+* The index of the first key not less than key, or size() if there is
+* none. Each step halves the range with a conditional move instead of a
+* branch, so the loop runs the same log n steps for every key.
+*/
+template<class Key, class Value>
+size_t SnapshotView<Key, Value>::search(const Key& key) const
+{
+    if(size_ == 0)
+    {
+        return 0;
+    }
+    const Key* base = keys_;
+    size_t n = size_;
+    while(n > 1)
+    {
+        size_t half = n / 2;
+        base = (base[half] < key) ? base + half : base;
+        n -= half;
+    }
+    return static_cast<size_t>(base - keys_) + (*base < key);
+}
+
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include "bst.h"
+
+/**
+* A splay tree. Every insert, find and operator[] rotates the node it
+* touched to the root, so frequently used keys stay near the top and a
+* skewed (e.g. Zipfian) access stream costs far less than log n per lookup.
+* All operations are O(log n) amortized.
+*
+* Lookups restructure the tree, so only the non-const find and operator[]
+* splay. The const overloads inherited from BinarySearchTree still work but
+* leave the tree alone. Splaying needs no per-node data, so the tree uses
+* plain Nodes.
+*/
+template <class Key, class Value>
+class SplayTree : public BinarySearchTree<Key, Value>
+{
+public:
+    using BinarySearchTree<Key, Value>::find;
+    using BinarySearchTree<Key, Value>::operator[];
+
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    virtual void remove(const Key& key);
+    typename BinarySearchTree<Key, Value>::iterator find(const Key& key);
+    Value& operator[](const Key& key);
+protected:
+    Node<Key, Value>* access(const Key& key);
+    void splay(Node<Key, Value>* x);
+    void rotateUp(Node<Key, Value>* x);
+};
+
+/**
+* Inserts the item, or overwrites the value if the key is already present,
+* and splays the node to the root either way.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    Node<Key, Value>* parent = nullptr;
+    Node<Key, Value>* temp = this->root_;
+    while(temp != nullptr){
+        parent = temp;
+        if(new_item.first < temp->getKey()){
+            temp = temp->getLeft();
+        } else if(temp->getKey() < new_item.first){
+            temp = temp->getRight();
+        } else {
+            temp->setValue(new_item.second);
+            splay(temp);
+            return;
+        }
+    }
+    Node<Key, Value>* n = new Node<Key, Value>(new_item.first, new_item.second, parent);
+    if(parent == nullptr){
+        this->root_ = n;
+    } else if(new_item.first < parent->getKey()){
+        parent->setLeft(n);
+    } else {
+        parent->setRight(n);
+    }
+    splay(n);
+}
+
+/**
+* Splays the node to the root, then joins its two subtrees by splaying the
+* largest key of the left subtree to the top and hanging the right subtree
+* off it.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* n = access(key);
+    if(n == nullptr){
+        return;
+    }
+    Node<Key, Value>* l = n->getLeft();
+    Node<Key, Value>* r = n->getRight();
+    delete n;
+    if(l == nullptr){
+        this->root_ = r;
+        if(r != nullptr) r->setParent(nullptr);
+        return;
+    }
+    l->setParent(nullptr);
+    this->root_ = l;
+    Node<Key, Value>* max = l;
+    while(max->getRight() != nullptr){
+        max = max->getRight();
+    }
+    splay(max);
+    max->setRight(r);
+    if(r != nullptr) r->setParent(max);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(), and splays
+* the last node on the search path to the root.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator SplayTree<Key, Value>::find(const Key& key)
+{
+    Node<Key, Value>* n = access(key);
+    if(n == nullptr){
+        return this->end();
+    }
+    return BinarySearchTree<Key, Value>::iteratorAt(n);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key, splaying it to the root
+ */
+template<class Key, class Value>
+Value& SplayTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value>* n = access(key);
+    if(n == NULL) throw std::out_of_range("Invalid key");
+    return n->getValue();
+}
+
+/*
+ * access, splay and rotateUp run on every lookup, so like the traversal
+ * helpers in bst.h they call the Node getters non-virtually.
+ */
+
+//searches for key and splays the node found (or the last node visited)
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::access(const Key& key)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* last = nullptr;
+    while(curr != nullptr){
+        last = curr;
+        if(key < curr->getKey()){
+            curr = curr->Node<Key, Value>::getLeft();
+        } else if(curr->getKey() < key){
+            curr = curr->Node<Key, Value>::getRight();
+        } else {
+            splay(curr);
+            return curr;
+        }
+    }
+    if(last != nullptr){
+        splay(last);
+    }
+    return nullptr;
+}
+
+/**
+* Bottom-up splay: zig-zig steps rotate the parent first, zig-zag steps
+* rotate x twice, and a final zig handles a child of the root.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::splay(Node<Key, Value>* x)
+{
+    while(x->Node<Key, Value>::getParent() != nullptr){
+        Node<Key, Value>* p = x->Node<Key, Value>::getParent();
+        Node<Key, Value>* g = p->Node<Key, Value>::getParent();
+        if(g == nullptr){
+            rotateUp(x);
+        } else if((g->Node<Key, Value>::getLeft() == p) == (p->Node<Key, Value>::getLeft() == x)){
+            rotateUp(p);
+            rotateUp(x);
+        } else {
+            rotateUp(x);
+            rotateUp(x);
+        }
+    }
+}
+
+//rotates x above its parent
+template<class Key, class Value>
+void SplayTree<Key, Value>::rotateUp(Node<Key, Value>* x)
+{
+    Node<Key, Value>* p = x->Node<Key, Value>::getParent();
+    Node<Key, Value>* g = p->Node<Key, Value>::getParent();
+    if(p->Node<Key, Value>::getLeft() == x){
+        p->setLeft(x->Node<Key, Value>::getRight());
+        if(x->Node<Key, Value>::getRight() != nullptr) x->Node<Key, Value>::getRight()->setParent(p);
+        x->setRight(p);
+    } else {
+        p->setRight(x->Node<Key, Value>::getLeft());
+        if(x->Node<Key, Value>::getLeft() != nullptr) x->Node<Key, Value>::getLeft()->setParent(p);
+        x->setLeft(p);
+    }
+    p->setParent(x);
+    x->setParent(g);
+    if(g == nullptr){
+        this->root_ = x;
+    } else if(g->Node<Key, Value>::getLeft() == p){
+        g->setLeft(x);
+    } else {
+        g->setRight(x);
+    }
+}
+
+
+#endif
@@ -0,0 +1,1143 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "persistentbst.h"
+#include "shardedmap.h"
+#include "concurrentavl.h"
+#include "bplustree.h"
+#include "sharedavl.h"
+#include "durableavl.h"
+#include "pagedbtree.h"
+
+using namespace std;
+
+/**
+* Benchmarks for the tree engines. Run with no arguments for every section
+* or name one section, optionally followed by a size:
+*   ./tree-bench rb 1000000
+*/
+
+// results are folded in here so the optimizer cannot drop the lookups
+static volatile size_t sink;
+
+static double msSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static void printRow(const string& label, const string& engine, double ms, size_t ops)
+{
+    cout << "  " << left << setw(32) << label << setw(14) << engine
+         << right << setw(10) << fixed << setprecision(1) << ms << " ms"
+         << setw(10) << setprecision(2) << (ops / ms / 1000.0) << " Mops/s" << endl;
+}
+
+/**
+* Fills the tree with n random keys from [0, 2n), then runs ops operations
+* with the given percentages of inserts and removes (the rest are finds).
+* Returns the time of the second phase only.
+*/
+template<typename Tree>
+double runMix(size_t n, size_t ops, int insertPct, int removePct, unsigned seed)
+{
+    mt19937 gen(seed);
+    uniform_int_distribution<int> keys(0, static_cast<int>(2 * n));
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys(gen), 0));
+    }
+    vector<pair<int, int> > script(ops);
+    for(size_t i = 0; i < ops; ++i) {
+        int kind = static_cast<int>(gen() % 100);
+        script[i] = make_pair(kind < insertPct ? 0 : (kind < insertPct + removePct ? 1 : 2), keys(gen));
+    }
+    size_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        if(script[i].first == 0) tree.insert(make_pair(script[i].second, 1));
+        else if(script[i].first == 1) tree.remove(script[i].second);
+        else if(tree.find(script[i].second) != tree.end()) ++found;
+    }
+    double ms = msSince(start);
+    sink = sink + found;
+    return ms;
+}
+
+/**
+* The parallel set operations on two trees of 10n keys each, with a third
+* of the keys in both, at 1 to 8 pool workers. The trees are rebuilt for
+* every run, since each operation consumes its argument; only the
+* operation itself is timed. Worker counts above the machine's hardware
+* threads only measure scheduling overhead.
+*/
+static void benchSetOps(size_t n)
+{
+    size_t m = 10 * n;
+    cout << "AVLTree set operations, 2 x " << m << " keys, "
+         << thread::hardware_concurrency() << " hardware threads" << endl;
+    vector<pair<int, int> > a(m), b(m);
+    for(size_t i = 0; i < m; ++i) {
+        a[i] = make_pair(static_cast<int>(3 * i), 1);
+        b[i] = make_pair(static_cast<int>(2 * i), 2);
+    }
+    mt19937 gen(13);
+    shuffle(a.begin(), a.end(), gen);
+    shuffle(b.begin(), b.end(), gen);
+    const char* ops[] = { "union", "intersection", "difference" };
+    const unsigned workerCounts[] = { 1, 2, 4, 8 };
+    for(size_t c = 0; c < sizeof(workerCounts) / sizeof(workerCounts[0]); ++c) {
+        WorkStealingPool pool(workerCounts[c]);
+        for(int op = 0; op < 3; ++op) {
+            AVLTree<int, int> left, right;
+            left.build_parallel(a.begin(), a.end(), pool);
+            right.build_parallel(b.begin(), b.end(), pool);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if(op == 0) left.unionWith(right, pool);
+            else if(op == 1) left.intersectWith(right, pool);
+            else left.differenceWith(right, pool);
+            double ms = msSince(start);
+            printRow(string(ops[op]) + ", " + to_string(workerCounts[c]) + " worker" + (workerCounts[c] > 1 ? "s" : ""),
+                     "AVLTree", ms, 2 * m);
+        }
+    }
+}
+
+/**
+* build_parallel against n inserts, from the same shuffled items with
+* about a fifth of the keys repeated, at 1 to 8 pool workers.
+*/
+static void benchBuild(size_t n)
+{
+    cout << "AVLTree construction, " << n << " items, "
+         << thread::hardware_concurrency() << " hardware threads" << endl;
+    vector<pair<int, int> > items(n);
+    mt19937 gen(14);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i));
+    }
+    {
+        AVLTree<int, int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        printRow("insert", "AVLTree", msSince(start), n);
+    }
+    const unsigned workerCounts[] = { 1, 2, 4, 8 };
+    for(size_t c = 0; c < sizeof(workerCounts) / sizeof(workerCounts[0]); ++c) {
+        WorkStealingPool pool(workerCounts[c]);
+        AVLTree<int, int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        tree.build_parallel(items.begin(), items.end(), pool);
+        printRow("build_parallel, " + to_string(workerCounts[c]) + " worker" + (workerCounts[c] > 1 ? "s" : ""),
+                 "AVLTree", msSince(start), n);
+    }
+}
+
+static void benchRedBlack(size_t n)
+{
+    cout << "AVLTree vs RedBlackTree, " << n << " keys, " << n << " operations" << endl;
+    struct Mix { const char* label; int insertPct; int removePct; };
+    const Mix mixes[] = {
+        { "insert only", 100, 0 },
+        { "50% insert / 50% remove", 50, 50 },
+        { "20% remove / 80% insert", 80, 20 },
+        { "10% ins / 10% rem / 80% find", 10, 10 },
+    };
+    for(size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); ++i) {
+        const Mix& m = mixes[i];
+        printRow(m.label, "AVLTree", runMix<AVLTree<int, int> >(n, n, m.insertPct, m.removePct, 1), n);
+        printRow(m.label, "RedBlackTree", runMix<RedBlackTree<int, int> >(n, n, m.insertPct, m.removePct, 1), n);
+    }
+}
+
+/**
+* Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^skew,
+* by binary search over the cumulative distribution.
+*/
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double skew) : cdf_(n)
+    {
+        double sum = 0;
+        for(size_t i = 0; i < n; ++i) {
+            sum += 1.0 / pow(double(i + 1), skew);
+            cdf_[i] = sum;
+        }
+        for(size_t i = 0; i < n; ++i) {
+            cdf_[i] /= sum;
+        }
+    }
+
+    size_t operator()(mt19937& gen)
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(gen);
+        size_t rank = lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+        return min(rank, cdf_.size() - 1);
+    }
+
+private:
+    vector<double> cdf_;
+};
+
+/**
+* Looks up a stream of Zipf-distributed keys. Ranks are mapped to keys
+* through a random permutation, so hot keys are scattered over the tree.
+*/
+template<typename Tree>
+double runZipfLookups(Tree& tree, const vector<int>& stream)
+{
+    size_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < stream.size(); ++i) {
+        if(tree.find(stream[i]) != tree.end()) ++found;
+    }
+    double ms = msSince(start);
+    sink = sink + found;
+    return ms;
+}
+
+static void benchSplay(size_t n)
+{
+    cout << "AVLTree vs SplayTree, Zipfian lookups over " << n << " keys" << endl;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(i);
+    mt19937 gen(2);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    AVLTree<int, int> avl;
+    SplayTree<int, int> splay;
+    for(size_t i = 0; i < n; ++i) {
+        avl.insert(make_pair(keys[i], 0));
+        splay.insert(make_pair(keys[i], 0));
+    }
+
+    const double skews[] = { 0.0, 0.8, 0.99, 1.2 };
+    for(size_t s = 0; s < sizeof(skews) / sizeof(skews[0]); ++s) {
+        ZipfGenerator zipf(n, skews[s]);
+        vector<int> stream(n);
+        for(size_t i = 0; i < n; ++i) stream[i] = keys[zipf(gen)];
+        ostringstream label;
+        label << "zipf skew " << skews[s];
+        printRow(label.str(), "AVLTree", runZipfLookups(avl, stream), n);
+        printRow(label.str(), "SplayTree", runZipfLookups(splay, stream), n);
+    }
+}
+
+/**
+* Per-operation latency of eager against relaxed balancing over n random
+* inserts followed by n/2 removes. Each update is timed on its own, so the
+* tail shows the cost of the deferred repairs that relaxed mode hands to
+* later updates; the clock itself adds a few tens of nanoseconds to every
+* sample. Every mode runs in its own child process, since the nodes the
+* previous mode freed would otherwise be consolidated by malloc in the
+* middle of the next one.
+*/
+static void benchRelaxed(size_t n)
+{
+    cout << "AVLTree eager vs relaxed balancing, " << n << " random inserts, "
+         << n / 2 << " removes" << endl;
+    mt19937 gen(15);
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(gen() % (4 * n));
+    const size_t limits[] = { 0, 64, 1024 };
+    for(size_t m = 0; m < sizeof(limits) / sizeof(limits[0]); ++m) {
+        pid_t pid = fork();
+        if(pid != 0) {
+            waitpid(pid, NULL, 0);
+            continue;
+        }
+        vector<double> ns(n + n / 2);
+        AVLTree<int, int> tree;
+        if(limits[m] > 0) tree.setRelaxed(true, limits[m]);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < ns.size(); ++i) {
+            chrono::steady_clock::time_point t = chrono::steady_clock::now();
+            if(i < n) tree.insert(make_pair(keys[i], 0));
+            else tree.remove(keys[i - n]);
+            ns[i] = chrono::duration<double, nano>(chrono::steady_clock::now() - t).count();
+        }
+        double ms = msSince(start);
+        string engine = limits[m] > 0 ? "relaxed " + to_string(limits[m]) : "eager";
+        printRow("updates", engine, ms, ns.size());
+        sort(ns.begin(), ns.end());
+        const double points[] = { 0.5, 0.99, 0.999, 1.0 };
+        const char* names[] = { "p50", "p99", "p99.9", "max" };
+        cout << "  " << left << setw(32) << "latency" << setw(14) << engine << right;
+        for(int p = 0; p < 4; ++p) {
+            size_t at = min(ns.size() - 1, static_cast<size_t>(points[p] * ns.size()));
+            cout << "  " << names[p] << " " << fixed << setprecision(2) << ns[at] / 1000.0 << " us";
+        }
+        cout << endl;
+        _exit(0);
+    }
+}
+
+/**
+* Insert cost of path copying, with and without old versions being kept
+* alive, and the cost of taking a snapshot.
+*/
+static void benchPersistent(size_t n)
+{
+    cout << "AVLTree vs PersistentAVLTree, " << n << " random inserts" << endl;
+    mt19937 gen(3);
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(gen());
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<int, int> avl;
+        for(size_t i = 0; i < n; ++i) avl.insert(make_pair(keys[i], 0));
+        printRow("insert", "AVLTree", msSince(start), n);
+    }
+    start = chrono::steady_clock::now();
+    {
+        PersistentAVLTree<int, int> tree;
+        for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], 0));
+        printRow("insert", "Persistent", msSince(start), n);
+    }
+    start = chrono::steady_clock::now();
+    PersistentAVLTree<int, int> tree;
+    vector<PersistentAVLTree<int, int> > versions;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], 0));
+        if(i % 1000 == 0) versions.push_back(tree.snapshot());
+    }
+    printRow("insert, snapshot every 1000", "Persistent", msSince(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        PersistentAVLTree<int, int> view = tree.snapshot();
+        sink = sink + view.size();
+    }
+    printRow("snapshot of the full tree", "Persistent", msSince(start), n);
+}
+
+// the single-lock baseline that ShardedAVLMap replaces
+class LockedAVLMap
+{
+public:
+    void insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.remove(key);
+    }
+    bool contains(int key)
+    {
+        lock_guard<mutex> guard(lock_);
+        return tree_.find(key) != tree_.end();
+    }
+private:
+    mutex lock_;
+    AVLTree<int, int> tree_;
+};
+
+/**
+* Runs ops operations split over the given number of threads, 80% lookups
+* and 10% each inserts and removes of random keys from [0, 2n).
+*/
+template<typename Map>
+double runThreads(Map& map, size_t n, size_t ops, unsigned threads)
+{
+    vector<thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&map, n, ops, threads, t]() {
+            mt19937 gen(100 + t);
+            size_t found = 0;
+            for(size_t i = t; i < ops; i += threads) {
+                int key = static_cast<int>(gen() % (2 * n));
+                unsigned kind = gen() % 10;
+                if(kind == 0) map.insert(make_pair(key, 1));
+                else if(kind == 1) map.remove(key);
+                else if(map.contains(key)) ++found;
+            }
+            sink = sink + found;
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    return msSince(start);
+}
+
+static void benchSharded(size_t n)
+{
+    cout << "Global mutex vs ShardedAVLMap (64 shards), " << n << " keys, 80% find, "
+         << thread::hardware_concurrency() << " hardware threads" << endl;
+    vector<int> splitters;
+    for(int i = 1; i < 64; ++i) splitters.push_back(static_cast<int>(2 * n * i / 64));
+    const unsigned threadCounts[] = { 1, 2, 4, 8 };
+    for(size_t c = 0; c < sizeof(threadCounts) / sizeof(threadCounts[0]); ++c) {
+        unsigned threads = threadCounts[c];
+        LockedAVLMap locked;
+        ShardedAVLMap<int, int> sharded(splitters);
+        for(size_t i = 0; i < n; ++i) {
+            int key = static_cast<int>(2 * i);
+            locked.insert(make_pair(key, 0));
+            sharded.insert(make_pair(key, 0));
+        }
+        ostringstream label;
+        label << threads << " thread" << (threads > 1 ? "s" : "");
+        printRow(label.str(), "global mutex", runThreads(locked, n, n, threads), n);
+        printRow(label.str(), "sharded", runThreads(sharded, n, n, threads), n);
+    }
+}
+
+/**
+* A single shard is what a hot key range turns into: every thread meets on
+* one lock. The optimistic tree has no such lock, so it is compared against
+* both one shard and the 64 shards of the previous section.
+*/
+static void benchConcurrent(size_t n)
+{
+    cout << "ShardedAVLMap vs ConcurrentAVLTree, " << n << " keys, 80% find, "
+         << thread::hardware_concurrency() << " hardware threads" << endl;
+    vector<int> splitters;
+    for(int i = 1; i < 64; ++i) splitters.push_back(static_cast<int>(2 * n * i / 64));
+    const unsigned threadCounts[] = { 1, 2, 4, 8 };
+    for(size_t c = 0; c < sizeof(threadCounts) / sizeof(threadCounts[0]); ++c) {
+        unsigned threads = threadCounts[c];
+        ShardedAVLMap<int, int> single((vector<int>()));
+        ShardedAVLMap<int, int> sharded(splitters);
+        ConcurrentAVLTree<int, int> optimistic;
+        for(size_t i = 0; i < n; ++i) {
+            int key = static_cast<int>(2 * i);
+            single.insert(make_pair(key, 0));
+            sharded.insert(make_pair(key, 0));
+            optimistic.insert(make_pair(key, 0));
+        }
+        ostringstream label;
+        label << threads << " thread" << (threads > 1 ? "s" : "");
+        printRow(label.str(), "1 shard", runThreads(single, n, n, threads), n);
+        printRow(label.str(), "64 shards", runThreads(sharded, n, n, threads), n);
+        printRow(label.str(), "optimistic", runThreads(optimistic, n, n, threads), n);
+    }
+}
+
+/**
+* Scans every key in [low, low + width) for count random values of low and
+* returns the time taken.
+*/
+template<typename Tree>
+double runRangeScans(Tree& tree, size_t n, size_t count, int width)
+{
+    mt19937 gen(4);
+    size_t seen = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < count; ++i) {
+        int low = static_cast<int>(gen() % (2 * n));
+        tree.visit_range(low, low + width - 1, [&seen](pair<const int, int>& item) { seen += item.second + 1; });
+    }
+    double ms = msSince(start);
+    sink = sink + seen;
+    return ms;
+}
+
+static void benchBPlus(size_t n)
+{
+    cout << "AVLTree vs BPlusTree, " << n << " keys, " << n << " operations" << endl;
+    struct Mix { const char* label; int insertPct; int removePct; };
+    const Mix mixes[] = {
+        { "insert only", 100, 0 },
+        { "find only", 0, 0 },
+        { "50% insert / 50% remove", 50, 50 },
+        { "10% ins / 10% rem / 80% find", 10, 10 },
+    };
+    for(size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); ++i) {
+        const Mix& m = mixes[i];
+        printRow(m.label, "AVLTree", runMix<AVLTree<int, int> >(n, n, m.insertPct, m.removePct, 1), n);
+        printRow(m.label, "BPlusTree", runMix<BPlusTree<int, int> >(n, n, m.insertPct, m.removePct, 1), n);
+    }
+
+    AVLTree<int, int> avl;
+    BPlusTree<int, int> bplus;
+    mt19937 gen(2);
+    for(size_t i = 0; i < n; ++i) {
+        int key = static_cast<int>(gen() % (2 * n));
+        avl.insert(make_pair(key, 0));
+        bplus.insert(make_pair(key, 0));
+    }
+    size_t scans = max<size_t>(1, n / 100);
+    printRow("range scans of 200 keys", "AVLTree", runRangeScans(avl, n, scans, 200), scans);
+    printRow("range scans of 200 keys", "BPlusTree", runRangeScans(bplus, n, scans, 200), scans);
+    cout << "  heights: AVLTree " << avl.stats().height << ", BPlusTree " << bplus.height() << " levels" << endl;
+}
+
+static void benchFrozen(size_t n)
+{
+    cout << "AVLTree vs frozen Eytzinger snapshot, " << n << " keys, " << n << " lookups" << endl;
+    AVLTree<int, int> tree;
+    mt19937 gen(3);
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    FrozenTree<int, int> frozen = tree.freeze();
+    printRow("freeze()", "Frozen", msSince(start), frozen.size());
+
+    vector<int> probes(n);
+    for(size_t i = 0; i < n; ++i) {
+        probes[i] = static_cast<int>(gen() % (2 * n));
+    }
+    size_t found = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(tree.find(probes[i]) != tree.end()) ++found;
+    }
+    printRow("find", "AVLTree", msSince(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(frozen.find(probes[i]) != frozen.end()) ++found;
+    }
+    printRow("find", "Frozen", msSince(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        FrozenTree<int, int>::iterator it = frozen.lower_bound(probes[i]);
+        if(it != frozen.end()) found += it->second;
+    }
+    printRow("lower_bound", "Frozen", msSince(start), n);
+
+    start = chrono::steady_clock::now();
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        found += it->second;
+    }
+    printRow("in-order iteration", "AVLTree", msSince(start), frozen.size());
+    start = chrono::steady_clock::now();
+    for(FrozenTree<int, int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        found += it->second;
+    }
+    printRow("in-order iteration", "Frozen", msSince(start), frozen.size());
+    sink = sink + found;
+    cout << "  bytes per key: AVLTree node " << sizeof(AVLNode<int, int>)
+         << " + allocator header, Frozen " << sizeof(int) + sizeof(int) << endl;
+}
+
+/**
+* Looks up the same random keys one find at a time and in batches of 256,
+* unsorted and sorted.
+*/
+static void benchBatch(size_t n)
+{
+    cout << "AVLTree find vs find_batch, " << n << " keys, " << n << " lookups in batches of 256" << endl;
+    AVLTree<int, int> tree;
+    mt19937 gen(5);
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), 0));
+    }
+    const size_t batch = 256;
+    vector<vector<int> > batches(max<size_t>(1, n / batch));
+    for(size_t b = 0; b < batches.size(); ++b) {
+        batches[b].resize(batch);
+        for(size_t i = 0; i < batch; ++i) {
+            batches[b][i] = static_cast<int>(gen() % (2 * n));
+        }
+    }
+    size_t lookups = batches.size() * batch;
+    vector<AVLTree<int, int>::iterator> out;
+    for(int sorted = 0; sorted < 2; ++sorted) {
+        if(sorted) {
+            for(size_t b = 0; b < batches.size(); ++b) sort(batches[b].begin(), batches[b].end());
+        }
+        string label = sorted ? "sorted batches" : "random batches";
+        size_t found = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t b = 0; b < batches.size(); ++b) {
+            for(size_t i = 0; i < batch; ++i) {
+                if(tree.find(batches[b][i]) != tree.end()) ++found;
+            }
+        }
+        printRow(label, "find", msSince(start), lookups);
+        start = chrono::steady_clock::now();
+        for(size_t b = 0; b < batches.size(); ++b) {
+            tree.find_batch(batches[b], out);
+            for(size_t i = 0; i < batch; ++i) {
+                if(out[i] != tree.end()) ++found;
+            }
+        }
+        printRow(label, "find_batch", msSince(start), lookups);
+        sink = sink + found;
+    }
+}
+
+/**
+* Zipfian lookups on an AVLTree with the hot-key cache off and on, and
+* lookups confined to a hot set small enough to stay cached.
+*/
+static void benchCache(size_t n)
+{
+    cout << "AVLTree find with and without the lookup cache, Zipfian lookups over " << n << " keys" << endl;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(i);
+    mt19937 gen(6);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], 0));
+    }
+
+    const double skews[] = { 0.0, 0.99, 1.2 };
+    for(size_t s = 0; s < sizeof(skews) / sizeof(skews[0]); ++s) {
+        ZipfGenerator zipf(n, skews[s]);
+        vector<int> stream(n);
+        for(size_t i = 0; i < n; ++i) stream[i] = keys[zipf(gen)];
+        ostringstream label;
+        label << "zipf skew " << skews[s];
+        tree.setLookupCache(0);
+        printRow(label.str(), "no cache", runZipfLookups(tree, stream), n);
+        tree.setLookupCache(16384);
+        tree.resetCacheStats();
+        printRow(label.str(), "16384 slots", runZipfLookups(tree, stream), n);
+        cout << "  hit rate " << setprecision(1)
+             << 100.0 * tree.cacheHits() / (tree.cacheHits() + tree.cacheMisses()) << "%" << endl;
+    }
+
+    // only the 1000 hottest keys, which all fit in the cache
+    vector<int> hot(n);
+    for(size_t i = 0; i < n; ++i) hot[i] = keys[gen() % min<size_t>(n, 1000)];
+    tree.setLookupCache(0);
+    printRow("1000 hot keys", "no cache", runZipfLookups(tree, hot), n);
+    tree.setLookupCache(16384);
+    printRow("1000 hot keys", "16384 slots", runZipfLookups(tree, hot), n);
+}
+
+/**
+* Cost and benefit of the hash index: building the tree with inserts,
+* random finds and updates, removing every key, and the index's memory.
+*/
+static void benchHashIndex(size_t n)
+{
+    cout << "AVLTree with and without the hash index, " << n << " keys" << endl;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(i);
+    mt19937 gen(7);
+    shuffle(keys.begin(), keys.end(), gen);
+    vector<int> probes(n);
+    for(size_t i = 0; i < n; ++i) probes[i] = static_cast<int>(gen() % (2 * n));
+
+    for(int indexed = 0; indexed < 2; ++indexed) {
+        string engine = indexed ? "hash index" : "tree only";
+        AVLTree<int, int> tree;
+        tree.setHashIndex(indexed != 0);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(make_pair(keys[i], 0));
+        }
+        printRow("insert", engine, msSince(start), n);
+
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            if(tree.find(probes[i]) != tree.end()) ++found;
+        }
+        printRow("find", engine, msSince(start), n);
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree[keys[i]] += 1;
+        }
+        printRow("operator[] update", engine, msSince(start), n);
+        start = chrono::steady_clock::now();
+        for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            found += it->second;
+        }
+        printRow("in-order iteration", engine, msSince(start), n);
+        if(indexed) {
+            cout << "  index bytes per key: " << setprecision(1)
+                 << double(tree.hashIndexBytes()) / n << " (node " << sizeof(AVLNode<int, int>) << ")" << endl;
+        }
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.remove(keys[i]);
+        }
+        printRow("remove", engine, msSince(start), n);
+        sink = sink + found;
+    }
+}
+
+/**
+* Lookups where 80% of the keys are absent, with and without the
+* membership filter, plus the filter's cost on inserts and removes.
+*/
+static void benchFilter(size_t n)
+{
+    cout << "AVLTree with and without the membership filter, " << n << " keys, 80% absent lookups" << endl;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(2 * i);
+    mt19937 gen(8);
+    shuffle(keys.begin(), keys.end(), gen);
+    vector<int> probes(n);
+    for(size_t i = 0; i < n; ++i) {
+        int k = keys[gen() % n];
+        probes[i] = (gen() % 100 < 80) ? k + 1 : k;
+    }
+
+    for(int filtered = 0; filtered < 2; ++filtered) {
+        string engine = filtered ? "filter 1%" : "tree only";
+        AVLTree<int, int> tree;
+        if(filtered) tree.setMembershipFilter(n);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(make_pair(keys[i], 0));
+        }
+        printRow("insert", engine, msSince(start), n);
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            if(tree.find(probes[i]) != tree.end()) ++found;
+        }
+        printRow("find", engine, msSince(start), n);
+        if(filtered) {
+            cout << "  rejected " << tree.filterRejects() << " of " << n - found << " absent, filter bytes per key "
+                 << setprecision(1) << double(tree.filterBytes()) / n << endl;
+        }
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.remove(keys[i]);
+        }
+        printRow("remove", engine, msSince(start), n);
+        sink = sink + found;
+    }
+}
+
+/**
+* Copying an AVLTree with the structural clone against rebuilding it with
+* one insert per item, and moving it.
+*/
+static void benchCopy(size_t n)
+{
+    cout << "AVLTree copy, " << n << " keys" << endl;
+    AVLTree<int, int> tree;
+    mt19937 gen(9);
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+    }
+    size_t size = 0;
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) ++size;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<int, int> copy;
+        for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            copy.insert(*it);
+        }
+        sink = sink + copy.empty();
+    }
+    printRow("rebuild by inserts", "AVLTree", msSince(start), size);
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<int, int> copy(tree);
+        sink = sink + copy.empty();
+    }
+    printRow("copy constructor", "AVLTree", msSince(start), size);
+    vector<AVLTree<int, int> > moved;
+    moved.reserve(1000);
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < 1000; ++i) {
+        moved.push_back(std::move(tree));
+        tree = std::move(moved.back());
+    }
+    printRow("1000 move round trips", "AVLTree", msSince(start), 1000);
+}
+
+/**
+* Restarting from a snapshot: saving, loading it back into a tree against
+* replaying every item through insert, and serving lookups from the
+* mapped file directly.
+*/
+static void benchSnapshot(size_t n)
+{
+    cout << "AVLTree snapshots, " << n << " keys" << endl;
+    AVLTree<int, int> tree;
+    mt19937 gen(10);
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+    }
+    vector<pair<int, int> > items;
+    tree.visit_inorder([&items](const pair<const int, int>& item) { items.push_back(item); });
+    shuffle(items.begin(), items.end(), gen);
+    const string path = "tree-bench.snap";
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    tree.save(path);
+    double ms = msSince(start);
+    printRow("save", "AVLTree", ms, items.size());
+    struct stat st;
+    stat(path.c_str(), &st);
+    cout << "  " << st.st_size / 1048576.0 << " MB, " << st.st_size / 1048576.0 / (ms / 1000) << " MB/s" << endl;
+
+    {
+        AVLTree<int, int> replay;
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < items.size(); ++i) {
+            replay.insert(items[i]);
+        }
+        printRow("replay inserts", "AVLTree", msSince(start), items.size());
+    }
+    {
+        AVLTree<int, int> loaded;
+        start = chrono::steady_clock::now();
+        loaded.load(path);
+        ms = msSince(start);
+        printRow("load", "AVLTree", ms, items.size());
+    }
+    cout << "  " << st.st_size / 1048576.0 / (ms / 1000) << " MB/s" << endl;
+
+    start = chrono::steady_clock::now();
+    SnapshotView<int, int> view(path);
+    printRow("open view", "SnapshotView", msSince(start), items.size());
+    size_t found = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(tree.find(static_cast<int>(gen() % (2 * n))) != tree.end()) ++found;
+    }
+    printRow("find", "AVLTree", msSince(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(view.find(static_cast<int>(gen() % (2 * n))) != view.end()) ++found;
+    }
+    printRow("find", "SnapshotView", msSince(start), n);
+    sink = sink + found;
+    remove(path.c_str());
+}
+
+//the proportional set size of this process in KB, or 0 if unknown
+static size_t pssKB()
+{
+    ifstream in("/proc/self/smaps_rollup");
+    string field;
+    size_t kb = 0;
+    while(in >> field) {
+        if(field == "Pss:") {
+            in >> kb;
+            break;
+        }
+    }
+    return kb;
+}
+
+/**
+* procs processes that each do n random finds, either on a private
+* AVLTree built by the process or on the shared tree mapped by name. They
+* are forked before the parent builds anything, so that they inherit
+* none of its memory, and wait for go(). Each reports the CPU time of its
+* lookups and how much its proportional set size grew, in which shared
+* pages are split between the processes that map them.
+*/
+class SharedReaders
+{
+public:
+    SharedReaders(size_t n, int procs, const string& name, bool shared) :
+        n_(n),
+        procs_(procs),
+        shared_(shared)
+    {
+        out_ = static_cast<volatile size_t*>(mmap(NULL, (2 * procs + 1) * sizeof(size_t), PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+        for(int p = 0; p < procs; ++p) {
+            pid_t pid = fork();
+            if(pid == 0) {
+                run(p, name);
+                _exit(0);
+            }
+            children_.push_back(pid);
+        }
+    }
+
+    void go()
+    {
+        out_[2 * procs_] = 1;
+        double ms = 0;
+        double mb = 0;
+        for(int p = 0; p < procs_; ++p) {
+            waitpid(children_[p], NULL, 0);
+            ms += 1000.0 * out_[2 * p] / CLOCKS_PER_SEC;
+            mb += out_[2 * p + 1] / 1024.0;
+        }
+        printRow(to_string(procs_) + " processes, find", shared_ ? "SharedAVLTree" : "AVLTree", ms, procs_ * n_);
+        cout << "  " << mb / procs_ << " MB per process for the tree" << endl;
+        munmap(const_cast<size_t*>(out_), (2 * procs_ + 1) * sizeof(size_t));
+    }
+
+private:
+    void run(int p, const string& name)
+    {
+        size_t n = n_;
+        while(out_[2 * procs_] == 0) {
+            usleep(1000);
+        }
+        size_t before = pssKB();
+        mt19937 gen(20 + p);
+        size_t found = 0;
+        clock_t start;
+        if(shared_) {
+            SharedAVLTree<int, int> tree(name);
+            start = clock();
+            int value = 0;
+            for(size_t i = 0; i < n; ++i) {
+                if(tree.find(static_cast<int>(gen() % (2 * n)), value)) ++found;
+            }
+            out_[2 * p] = clock() - start;
+            out_[2 * p + 1] = pssKB() - before;
+        } else {
+            AVLTree<int, int> tree;
+            mt19937 keys(10);
+            for(size_t i = 0; i < n; ++i) {
+                tree.insert(make_pair(static_cast<int>(keys() % (2 * n)), static_cast<int>(i)));
+            }
+            start = clock();
+            for(size_t i = 0; i < n; ++i) {
+                if(tree.find(static_cast<int>(gen() % (2 * n))) != tree.end()) ++found;
+            }
+            out_[2 * p] = clock() - start;
+            out_[2 * p + 1] = pssKB() - before;
+        }
+        sink = sink + found;
+    }
+
+    size_t n_;
+    int procs_;
+    bool shared_;
+    // the CPU time and Pss growth of each process, then the start flag
+    volatile size_t* out_;
+    vector<pid_t> children_;
+};
+
+/**
+* One shared tree against a private copy per process. The lookup times are
+* CPU time summed over the processes, since they share the machine.
+*/
+static void benchShared(size_t n)
+{
+    cout << "SharedAVLTree, " << n << " keys" << endl;
+    const int procs = 4;
+    const string name = "/tree-bench-" + to_string(getpid());
+    SharedAVLTree<int, int>::unlink(name);
+    {
+        SharedReaders readers(n, procs, name, false);
+        readers.go();
+    }
+    SharedReaders readers(n, procs, name, true);
+    {
+        AVLTree<int, int> tree;
+        mt19937 gen(10);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+        }
+        printRow("insert", "AVLTree", msSince(start), n);
+    }
+    SharedAVLTree<int, int> tree(name, n);
+    mt19937 gen(10);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+    }
+    printRow("insert", "SharedAVLTree", msSince(start), n);
+    cout << "  segment " << tree.bytes() / 1048576.0 << " MB, " << tree.size() << " keys" << endl;
+    readers.go();
+    SharedAVLTree<int, int>::unlink(name);
+}
+
+static void removeDurableDir(const string& dir)
+{
+    remove((dir + "/wal.log").c_str());
+    remove((dir + "/checkpoint.snap").c_str());
+    rmdir(dir.c_str());
+}
+
+/**
+* The cost of the write-ahead log against the in-memory tree: deferred
+* commits, one synchronous writer (an fsync per update), and synchronous
+* writers sharing fsyncs through group commit. Then the time to reopen
+* from the log alone and from a checkpoint.
+*/
+static void benchDurable(size_t n)
+{
+    cout << "DurableAVLTree, " << n << " keys" << endl;
+    const string dir = "tree-bench.wal";
+    removeDurableDir(dir);
+    vector<pair<int, int> > items(n);
+    mt19937 gen(10);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i));
+    }
+    {
+        AVLTree<int, int> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        printRow("insert", "AVLTree", msSince(start), n);
+    }
+    {
+        DurableAVLTree<int, int> tree(dir, false);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        tree.sync();
+        printRow("insert, deferred commit", "DurableAVLTree", msSince(start), n);
+        cout << "  " << tree.commits() << " fsyncs, " << tree.logBytes() / 1048576.0 << " MB of log" << endl;
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        DurableAVLTree<int, int> tree(dir);
+        printRow("reopen, replay log", "DurableAVLTree", msSince(start), tree.replayed());
+        tree.checkpoint();
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        DurableAVLTree<int, int> tree(dir);
+        printRow("reopen, load checkpoint", "DurableAVLTree", msSince(start), n);
+    }
+    removeDurableDir(dir);
+
+    size_t m = min(n, static_cast<size_t>(2000));
+    for(int threads = 1; threads <= 16; threads *= 4) {
+        DurableAVLTree<int, int> tree(dir);
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int t = 0; t < threads; ++t) {
+            workers.push_back(thread([&, t]() {
+                for(size_t i = t; i < m; i += threads) {
+                    tree.insert(items[i]);
+                }
+            }));
+        }
+        for(size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+        printRow("insert, " + to_string(threads) + " sync writers", "DurableAVLTree", msSince(start), m);
+        cout << "  " << tree.commits() << " fsyncs, " << double(m) / tree.commits() << " updates per fsync" << endl;
+        removeDurableDir(dir);
+    }
+}
+
+/**
+* A PagedBPlusTree reopened with pools of 1x down to 1/10 of its pages, so
+* the data is 1x to 10x the pool. Each row starts from a cold pool warmed
+* by the same number of lookups, and reports how many pages were read (and
+* for inserts, written) per operation besides the throughput. The page
+* reads hit the OS page cache here; against a cold disk each one would
+* cost a device read instead.
+*/
+static void benchPaged(size_t n)
+{
+    cout << "PagedBPlusTree, " << n << " keys" << endl;
+    const string path = "tree-bench.pages";
+    remove(path.c_str());
+    size_t ops = max<size_t>(1, n / 4);
+    size_t pages;
+    {
+        BPlusTree<int, int> bplus;
+        mt19937 gen(11);
+        for(size_t i = 0; i < n; ++i) {
+            bplus.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+        }
+        size_t found = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < ops; ++i) {
+            if(bplus.find(static_cast<int>(gen() % (2 * n))) != bplus.end()) ++found;
+        }
+        printRow("find, in memory", "BPlusTree", msSince(start), ops);
+        sink = sink + found;
+    }
+    {
+        PagedBPlusTree<int, int> tree(path, n / 100 + 64);
+        mt19937 gen(11);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+        }
+        tree.flush();
+        printRow("insert, pool holds all", "PagedBPlusTree", msSince(start), n);
+        pages = tree.pages();
+        cout << "  " << pages << " pages (" << pages * BufferPool::pageSize / 1048576.0 << " MB), "
+             << tree.height() << " levels" << endl;
+    }
+    const size_t ratios[] = { 1, 2, 5, 10 };
+    for(size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); ++r) {
+        size_t frames = max<size_t>(16, pages / ratios[r]);
+        PagedBPlusTree<int, int> tree(path, frames);
+        const string label = "data " + to_string(ratios[r]) + "x pool, ";
+        mt19937 gen(12 + r);
+        size_t found = 0;
+        int value;
+        for(size_t i = 0; i < ops; ++i) {
+            if(tree.find(static_cast<int>(gen() % (2 * n)), value)) ++found;
+        }
+        size_t reads = tree.pool().reads();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < ops; ++i) {
+            if(tree.find(static_cast<int>(gen() % (2 * n)), value)) ++found;
+        }
+        printRow(label + "find", "PagedBPlusTree", msSince(start), ops);
+        sink = sink + found;
+        double findReads = double(tree.pool().reads() - reads) / ops;
+
+        reads = tree.pool().reads();
+        size_t writes = tree.pool().writes();
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < ops; ++i) {
+            tree.insert(make_pair(static_cast<int>(gen() % (2 * n)), static_cast<int>(i)));
+        }
+        tree.flush();
+        printRow(label + "insert", "PagedBPlusTree", msSince(start), ops);
+        cout << "  " << frames << " frames; page reads per find " << findReads << ", per insert "
+             << double(tree.pool().reads() - reads) / ops << ", writes per insert "
+             << double(tree.pool().writes() - writes) / ops << endl;
+    }
+    remove(path.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    string section = (argc > 1) ? argv[1] : "all";
+    size_t n = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    if(section == "all" || section == "setops") benchSetOps(n);
+    if(section == "all" || section == "build") benchBuild(n);
+    if(section == "all" || section == "rb") benchRedBlack(n);
+    if(section == "all" || section == "splay") benchSplay(n);
+    if(section == "all" || section == "relaxed") benchRelaxed(n);
+    if(section == "all" || section == "persistent") benchPersistent(n);
+    if(section == "all" || section == "sharded") benchSharded(n);
+    if(section == "all" || section == "concurrent") benchConcurrent(n);
+    if(section == "all" || section == "bplus") benchBPlus(n);
+    if(section == "all" || section == "frozen") benchFrozen(n);
+    if(section == "all" || section == "batch") benchBatch(n);
+    if(section == "all" || section == "cache") benchCache(n);
+    if(section == "all" || section == "hash") benchHashIndex(n);
+    if(section == "all" || section == "filter") benchFilter(n);
+    if(section == "all" || section == "copy") benchCopy(n);
+    if(section == "all" || section == "snapshot") benchSnapshot(n);
+    if(section == "all" || section == "shared") benchShared(n);
+    if(section == "all" || section == "wal") benchDurable(n);
+    if(section == "all" || section == "paged") benchPaged(n);
+    return 0;
+}
@@ -0,0 +1,484 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+* A fork-join thread pool with one task deque per worker.
+* A worker pushes and pops forked tasks at the back of its own deque and
+* idle workers steal from the front of the others', so the oldest (and
+* usually largest) pieces of work are the ones that migrate.
+*
+* The only way to use the pool is invoke(a, b), which runs a and b,
+* possibly in parallel, and returns once both are done. Calls made from
+* outside the pool hand the whole job to a worker and block until it ends.
+* A pool of size 1 starts no threads and simply runs a then b.
+*/
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threads = 0);
+    ~WorkStealingPool();
+
+    unsigned size() const;
+
+    template<typename F1, typename F2>
+    void invoke(F1&& a, F2&& b);
+
+    static WorkStealingPool& global();
+
+    template<typename T, typename Compare>
+    void stableSort(std::vector<T>& items, Compare comp);
+
+    template<typename F>
+    void forChunks(size_t n, size_t chunks, F fn);
+
+private:
+    struct Task
+    {
+        void (*run)(void*);
+        void* ctx;
+        std::atomic<bool> done;
+        // an outside thread sleeps on finished_ until this one is done
+        bool blocking;
+        std::exception_ptr error;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    template<typename F>
+    static void trampoline(void* ctx);
+
+    template<typename F>
+    void runInPool(F& f);
+
+    void push(Worker* w, Task* t);
+    Task* popBack(Worker* w, Task* expected);
+    Task* findWork(Worker* self);
+    void execute(Task* t);
+    void waitFor(Task* t, Worker* self);
+    void workerLoop(unsigned index);
+    Worker* currentWorker() const;
+    static Worker*& threadWorker();
+
+    template<typename T, typename Compare>
+    void sortInto(T* src, T* dst, size_t n, bool toDst, int depth, Compare& comp);
+    template<typename T, typename Compare>
+    void mergeInto(T* a, size_t na, T* b, size_t nb, T* out, int depth, Compare& comp);
+    template<typename F>
+    void chunkRange(size_t n, size_t chunks, size_t first, size_t last, F& fn);
+    static const size_t sortGrain_ = 8192;
+
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+
+    std::vector<Worker*> workers_;
+    std::vector<std::thread> threads_;
+    Worker injected_;
+    std::atomic<unsigned> queued_;
+    std::atomic<bool> stop_;
+    std::mutex idleLock_;
+    std::condition_variable idle_;
+    std::mutex finishLock_;
+    std::condition_variable finished_;
+};
+
+/**
+* Creates a pool with the given number of workers, or one per hardware
+* thread when threads is 0.
+*/
+inline WorkStealingPool::WorkStealingPool(unsigned threads) :
+    queued_(0),
+    stop_(false)
+{
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    for(unsigned i = 0; i < threads; ++i)
+    {
+        workers_.push_back(new Worker);
+    }
+    if(threads > 1)
+    {
+        for(unsigned i = 0; i < threads; ++i)
+        {
+            threads_.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+        }
+    }
+}
+
+/**
+* Stops and joins the workers. Must not be called while work is running.
+*/
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(idleLock_);
+        stop_ = true;
+    }
+    idle_.notify_all();
+    for(size_t i = 0; i < threads_.size(); ++i)
+    {
+        threads_[i].join();
+    }
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+        delete workers_[i];
+    }
+}
+
+/**
+* Returns the number of workers.
+*/
+inline unsigned WorkStealingPool::size() const
+{
+    return static_cast<unsigned>(workers_.size());
+}
+
+/**
+* A process-wide pool sized to the machine, created on first use.
+*/
+inline WorkStealingPool& WorkStealingPool::global()
+{
+    static WorkStealingPool pool;
+    return pool;
+}
+
+/**
+* Runs a and b and returns when both have finished. b is offered to thieves
+* while the calling worker runs a; if nobody took it, it is run inline.
+* An exception thrown by either function is rethrown here.
+*/
+template<typename F1, typename F2>
+void WorkStealingPool::invoke(F1&& a, F2&& b)
+{
+    if(threads_.empty())
+    {
+        a();
+        b();
+        return;
+    }
+    Worker* self = currentWorker();
+    if(self == nullptr)
+    {
+        auto both = [&]() { this->invoke(a, b); };
+        runInPool(both);
+        return;
+    }
+
+    typedef typename std::remove_reference<F2>::type F2Type;
+    Task forked;
+    forked.run = &trampoline<F2Type>;
+    forked.ctx = const_cast<void*>(static_cast<const void*>(&b));
+    forked.done = false;
+    forked.blocking = false;
+    push(self, &forked);
+
+    std::exception_ptr error;
+    try
+    {
+        a();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    if(popBack(self, &forked) != nullptr)
+    {
+        execute(&forked);
+    }
+    else
+    {
+        waitFor(&forked, self);
+    }
+    if(error) std::rethrow_exception(error);
+    if(forked.error) std::rethrow_exception(forked.error);
+}
+
+template<typename F>
+void WorkStealingPool::trampoline(void* ctx)
+{
+    (*static_cast<F*>(ctx))();
+}
+
+//hands f to the workers and blocks the (non-worker) caller until it is done
+template<typename F>
+void WorkStealingPool::runInPool(F& f)
+{
+    Task root;
+    root.run = &trampoline<F>;
+    root.ctx = &f;
+    root.done = false;
+    root.blocking = true;
+    push(&injected_, &root);
+    waitFor(&root, nullptr);
+    if(root.error) std::rethrow_exception(root.error);
+}
+
+inline void WorkStealingPool::push(Worker* w, Task* t)
+{
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->tasks.push_back(t);
+    }
+    ++queued_;
+    {
+        std::lock_guard<std::mutex> guard(idleLock_);
+    }
+    idle_.notify_one();
+}
+
+//takes expected back off the owner's end of w's deque, unless it was stolen
+inline WorkStealingPool::Task* WorkStealingPool::popBack(Worker* w, Task* expected)
+{
+    std::lock_guard<std::mutex> guard(w->lock);
+    if(w->tasks.empty() || w->tasks.back() != expected)
+    {
+        return nullptr;
+    }
+    w->tasks.pop_back();
+    --queued_;
+    return expected;
+}
+
+/**
+* Looks for a runnable task: the back of the caller's own deque first, then
+* the front of every other worker's deque, then jobs submitted from outside.
+*/
+inline WorkStealingPool::Task* WorkStealingPool::findWork(Worker* self)
+{
+    if(self != nullptr)
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if(!self->tasks.empty())
+        {
+            Task* t = self->tasks.back();
+            self->tasks.pop_back();
+            --queued_;
+            return t;
+        }
+    }
+    size_t n = workers_.size();
+    size_t start = 0;
+    if(self != nullptr)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(workers_[i] == self) start = i + 1;
+        }
+    }
+    for(size_t i = 0; i <= n; ++i)
+    {
+        Worker* victim = (i == n) ? &injected_ : workers_[(start + i) % n];
+        if(victim == self) continue;
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if(!victim->tasks.empty())
+        {
+            Task* t = victim->tasks.front();
+            victim->tasks.pop_front();
+            --queued_;
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+inline void WorkStealingPool::execute(Task* t)
+{
+    try
+    {
+        t->run(t->ctx);
+    }
+    catch(...)
+    {
+        t->error = std::current_exception();
+    }
+    if(t->blocking)
+    {
+        // under the lock, so the waiter cannot miss the wakeup or free t
+        // before this thread is done with it
+        std::lock_guard<std::mutex> guard(finishLock_);
+        t->done.store(true, std::memory_order_release);
+        finished_.notify_all();
+    }
+    else
+    {
+        t->done.store(true, std::memory_order_release);
+    }
+}
+
+/**
+* Waits for a stolen task to finish. A worker keeps running other tasks in
+* the meantime; an outside thread sleeps until execute() wakes it.
+*/
+inline void WorkStealingPool::waitFor(Task* t, Worker* self)
+{
+    if(self == nullptr)
+    {
+        std::unique_lock<std::mutex> guard(finishLock_);
+        finished_.wait(guard, [t]() { return t->done.load(std::memory_order_acquire); });
+        return;
+    }
+    while(!t->done.load(std::memory_order_acquire))
+    {
+        Task* other = findWork(self);
+        if(other != nullptr)
+        {
+            execute(other);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline void WorkStealingPool::workerLoop(unsigned index)
+{
+    Worker* self = workers_[index];
+    threadWorker() = self;
+    while(true)
+    {
+        Task* t = findWork(self);
+        if(t != nullptr)
+        {
+            execute(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(idleLock_);
+        idle_.wait(guard, [this]() { return stop_.load() || queued_.load() > 0; });
+        if(stop_) return;
+    }
+}
+
+//the deque of the calling thread if it is one of this pool's workers
+inline WorkStealingPool::Worker* WorkStealingPool::currentWorker() const
+{
+    Worker* w = threadWorker();
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+        if(workers_[i] == w) return w;
+    }
+    return nullptr;
+}
+
+/**
+* Stable parallel merge sort of items. Uses one extra copy of the input as
+* scratch space, so T only needs to be copyable and movable.
+*/
+template<typename T, typename Compare>
+void WorkStealingPool::stableSort(std::vector<T>& items, Compare comp)
+{
+    if(items.size() <= sortGrain_ || threads_.empty())
+    {
+        std::stable_sort(items.begin(), items.end(), comp);
+        return;
+    }
+    std::vector<T> scratch(items);
+    int depth = 2;
+    for(size_t n = workers_.size(); n > 1; n >>= 1)
+    {
+        depth += 2;
+    }
+    sortInto(&items[0], &scratch[0], items.size(), false, depth, comp);
+}
+
+/**
+* Sorts the n items at src. The result ends up in dst when toDst is set and
+* in src otherwise; the other array is used as scratch space. Each half is
+* sorted into the opposite array so that the final merge lands in place.
+*/
+template<typename T, typename Compare>
+void WorkStealingPool::sortInto(T* src, T* dst, size_t n, bool toDst, int depth, Compare& comp)
+{
+    if(depth <= 0 || n <= sortGrain_)
+    {
+        std::stable_sort(src, src + n, comp);
+        if(toDst) std::move(src, src + n, dst);
+        return;
+    }
+    size_t half = n / 2;
+    invoke([&]() { sortInto(src, dst, half, !toDst, depth - 1, comp); },
+           [&]() { sortInto(src + half, dst + half, n - half, !toDst, depth - 1, comp); });
+    if(toDst)
+    {
+        mergeInto(src, half, src + half, n - half, dst, depth, comp);
+    }
+    else
+    {
+        mergeInto(dst, half, dst + half, n - half, src, depth, comp);
+    }
+}
+
+/**
+* Stable merge of a and b into out, split recursively around the middle of
+* the longer run so both halves can be merged in parallel. Ties keep
+* elements of a ahead of elements of b.
+*/
+template<typename T, typename Compare>
+void WorkStealingPool::mergeInto(T* a, size_t na, T* b, size_t nb, T* out, int depth, Compare& comp)
+{
+    if(depth <= 0 || na + nb <= sortGrain_)
+    {
+        std::merge(std::make_move_iterator(a), std::make_move_iterator(a + na),
+                   std::make_move_iterator(b), std::make_move_iterator(b + nb), out, comp);
+        return;
+    }
+    size_t ma, mb;
+    if(na >= nb)
+    {
+        ma = na / 2;
+        mb = std::lower_bound(b, b + nb, a[ma], comp) - b;
+    }
+    else
+    {
+        mb = nb / 2;
+        ma = std::upper_bound(a, a + na, b[mb], comp) - a;
+    }
+    invoke([&]() { mergeInto(a, ma, b, mb, out, depth - 1, comp); },
+           [&]() { mergeInto(a + ma, na - ma, b + mb, nb - mb, out + ma + mb, depth - 1, comp); });
+}
+
+/**
+* Cuts [0, n) into chunks slices of nearly equal size and calls
+* fn(chunk, begin, end) for each, in parallel. Returns when all are done.
+*/
+template<typename F>
+void WorkStealingPool::forChunks(size_t n, size_t chunks, F fn)
+{
+    if(chunks == 0) return;
+    chunkRange(n, chunks, 0, chunks, fn);
+}
+
+template<typename F>
+void WorkStealingPool::chunkRange(size_t n, size_t chunks, size_t first, size_t last, F& fn)
+{
+    if(last - first == 1)
+    {
+        fn(first, n * first / chunks, n * last / chunks);
+        return;
+    }
+    size_t mid = first + (last - first) / 2;
+    invoke([&]() { chunkRange(n, chunks, first, mid, fn); },
+           [&]() { chunkRange(n, chunks, mid, last, fn); });
+}
+
+inline WorkStealingPool::Worker*& WorkStealingPool::threadWorker()
+{
+    static thread_local Worker* w = nullptr;
+    return w;
+}
+
+#endif